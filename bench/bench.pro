@@ -0,0 +1,9 @@
+include(../common.pri)
+
+# Headless, drives GstreamerCameraCapture without the window
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = bench
+TEMPLATE = app
+SOURCES += $$PWD/main.cpp
@@ -0,0 +1,371 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QDebug>
+#include "inc/gstreamer.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <optional>
+
+// Every heap allocation of the process goes through these, GLib's g_malloc
+// and operator new included, so the count covers GStreamer as well
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static std::atomic<quint64> allocations{0};
+
+extern "C" void *malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    void *memory = memalign(alignment, size);
+    if (!memory) {
+        return ENOMEM;
+    }
+
+    *ptr = memory;
+    return 0;
+}
+
+extern "C" void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+// Peak RSS since the last reset, resetting needs Linux 4.0 or newer
+static void reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+}
+
+static qint64 peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stoll(line.substr(6));
+        }
+    }
+
+    return -1;
+}
+
+static double cpu_time_ms() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static void spin(int ms) {
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+// set_mode() applies on the capture's state worker, waits for the outcome
+static bool apply_mode(GstreamerCameraCapture *capture, const VideoMode &mode) {
+    bool applied = false;
+    QEventLoop loop;
+    QObject::connect(capture, &GstreamerCameraCapture::modeApplied, &loop, [&](bool ok) {
+        applied = ok;
+        loop.quit();
+    }, Qt::QueuedConnection);
+    QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+
+    capture->set_mode(mode);
+    loop.exec();
+    return applied;
+}
+
+struct BenchCase {
+    ConvertBackend backend;
+    std::optional<VideoMode> mode;
+};
+
+// Fresh capture instances per case, so pools and caches start cold every
+// time and the warm-up is excluded from the figures. With several cameras
+// they all run the same mode at once, totals are summed over cameras.
+static QJsonObject run_case(const CaptureSource &source, const BenchCase &bench, int cameras,
+                            bool processing, int warmup_ms, int duration_ms) {
+    QJsonObject result;
+    result["backend"] = bench.backend == NativeConvert ? "native" : "videoconvert";
+    result["cameras"] = cameras;
+
+    if (bench.mode) {
+        result["format"] = QString::fromStdString(bench.mode->format);
+        result["width"] = bench.mode->width;
+        result["height"] = bench.mode->height;
+        result["fps_target"] = double(bench.mode->fps_n) / bench.mode->fps_d;
+    }
+
+    std::vector<std::unique_ptr<GstreamerCameraCapture>> captures;
+    for (int i = 0; i < cameras; ++i) {
+        captures.emplace_back(new GstreamerCameraCapture(source, bench.backend));
+
+        if (bench.mode && !apply_mode(captures.back().get(), *bench.mode)) {
+            result["error"] = "mode not supported";
+            return result;
+        }
+    }
+
+    // Consumed on this thread through a queued connection, like the window does
+    std::vector<quint64> displayed(captures.size(), 0);
+    std::vector<quint64> last_sequence(captures.size(), 0);
+    for (size_t i = 0; i < captures.size(); ++i) {
+        GstreamerCameraCapture *capture = captures[i].get();
+        QObject::connect(capture, &GstreamerCameraCapture::frameReady, capture, [&, capture, i]() {
+            quint64 sequence = 0;
+            QImage frame = capture->pull_image_from_frame(&sequence);
+            if (!frame.isNull() && sequence != last_sequence[i]) {
+                last_sequence[i] = sequence;
+                ++displayed[i];
+            }
+        }, Qt::QueuedConnection);
+    }
+
+    for (auto &capture : captures) {
+        if (processing) {
+            capture->processing_engine()->start();
+        }
+        capture->run();
+    }
+    spin(warmup_ms);
+
+    std::vector<CaptureCounters> counters_before;
+    quint64 exhausted_before = 0;
+    for (auto &capture : captures) {
+        counters_before.push_back(capture->counters());
+        exhausted_before += capture->pool_stats().exhausted;
+    }
+    std::vector<quint64> displayed_before = displayed;
+    quint64 allocations_before = allocations.load();
+    double cpu_before = cpu_time_ms();
+    reset_peak_rss();
+
+    QElapsedTimer wall;
+    wall.start();
+    spin(duration_ms);
+    double seconds = wall.nsecsElapsed() / 1e9;
+
+    double cpu_ms = cpu_time_ms() - cpu_before;
+    quint64 allocated = allocations.load() - allocations_before;
+    qint64 peak_rss = peak_rss_kb();
+
+    quint64 received = 0, delivered = 0, shown = 0, exhausted = 0;
+    QJsonArray camera_fps;
+    for (size_t i = 0; i < captures.size(); ++i) {
+        CaptureCounters counters = captures[i]->counters();
+        quint64 camera_delivered = counters.delivered - counters_before[i].delivered;
+
+        received += counters.received - counters_before[i].received;
+        delivered += camera_delivered;
+        shown += displayed[i] - displayed_before[i];
+        exhausted += captures[i]->pool_stats().exhausted;
+        camera_fps.append(camera_delivered / seconds);
+    }
+    exhausted -= exhausted_before;
+
+    for (auto &capture : captures) {
+        capture->processing_engine()->stop();
+        capture->stop();
+    }
+
+    result["seconds"] = seconds;
+    result["frames_received"] = double(received);
+    result["frames_delivered"] = double(delivered);
+    result["frames_displayed"] = double(shown);
+    result["fps"] = delivered / seconds / cameras;
+    result["fps_per_camera"] = camera_fps;
+    result["cpu_ms_per_frame"] = delivered ? cpu_ms / delivered : 0.0;
+    result["allocations"] = double(allocated);
+    result["allocations_per_frame"] = delivered ? double(allocated) / delivered : 0.0;
+    result["peak_rss_kb"] = double(peak_rss);
+    result["dropped_frames"] = double(received > delivered ? received - delivered : 0);
+    result["coalesced_frames"] = double(delivered > shown ? delivered - shown : 0);
+    result["pool_exhausted"] = double(exhausted);
+
+    if (delivered == 0) {
+        result["error"] = "no frames";
+    }
+
+    return result;
+}
+
+static bool parse_resolution(const QString &text, int &width, int &height) {
+    QStringList parts = text.split('x');
+    bool width_ok = false, height_ok = false;
+
+    if (parts.size() == 2) {
+        width = parts[0].toInt(&width_ok);
+        height = parts[1].toInt(&height_ok);
+    }
+
+    return width_ok && height_ok && width > 0 && height > 0;
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Drives GstreamerCameraCapture without the window and prints JSON results.");
+    parser.addHelpOption();
+    QCommandLineOption sourceOption("source",
+        "test[:pattern] runs the whole matrix, file:<path> or uri:<uri> runs the clip as it is.",
+        "source", "test:smpte");
+    parser.addOption(sourceOption);
+    QCommandLineOption resolutionsOption("resolutions", "Comma separated WxH list.",
+        "list", "640x480,1280x720,1920x1080");
+    parser.addOption(resolutionsOption);
+    QCommandLineOption formatsOption("formats", "Comma separated source formats.",
+        "list", "YUY2,NV12,RGB");
+    parser.addOption(formatsOption);
+    QCommandLineOption fpsOption("fps", "Comma separated framerates.", "list", "30,60");
+    parser.addOption(fpsOption);
+    QCommandLineOption convertOption("convert", "Comma separated conversion backends.",
+        "list", "videoconvert,native");
+    parser.addOption(convertOption);
+    QCommandLineOption durationOption("duration", "Measured seconds per case.", "seconds", "5");
+    parser.addOption(durationOption);
+    QCommandLineOption warmupOption("warmup", "Unmeasured seconds before each case.",
+        "seconds", "1");
+    parser.addOption(warmupOption);
+    QCommandLineOption camerasOption("cameras",
+        "Capture instances running each case side by side.", "count", "1");
+    parser.addOption(camerasOption);
+    QCommandLineOption processingOption("processing", "Run the analysis stages as well.");
+    parser.addOption(processingOption);
+    QCommandLineOption outputOption("output", "Write the JSON here instead of stdout.", "file");
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    CaptureSource source;
+    if (!CaptureSource::from_string(parser.value(sourceOption).toStdString(), source) ||
+        source.kind == CaptureSource::AppSrc || source.kind == CaptureSource::V4L2) {
+        qCritical() << "Unsupported benchmark source:" << parser.value(sourceOption);
+        return 1;
+    }
+
+    std::vector<ConvertBackend> backends;
+    for (const QString &name : parser.value(convertOption).split(',', Qt::SkipEmptyParts)) {
+        if (name == "native") {
+            backends.push_back(NativeConvert);
+        } else if (name == "videoconvert") {
+            backends.push_back(VideoConvert);
+        } else {
+            qCritical() << "Invalid conversion backend:" << name;
+            return 1;
+        }
+    }
+
+    // Modes only apply to the test source, clips run at their own format
+    std::vector<BenchCase> cases;
+    for (ConvertBackend backend : backends) {
+        if (source.kind != CaptureSource::TestPattern) {
+            cases.push_back({ backend, std::nullopt });
+            continue;
+        }
+
+        for (const QString &resolution : parser.value(resolutionsOption).split(',', Qt::SkipEmptyParts)) {
+            VideoMode mode;
+            if (!parse_resolution(resolution, mode.width, mode.height)) {
+                qCritical() << "Invalid resolution:" << resolution;
+                return 1;
+            }
+
+            for (const QString &format : parser.value(formatsOption).split(',', Qt::SkipEmptyParts)) {
+                for (const QString &fps : parser.value(fpsOption).split(',', Qt::SkipEmptyParts)) {
+                    mode.format = format.toStdString();
+                    mode.fps_n = fps.toInt();
+                    mode.fps_d = 1;
+                    if (mode.fps_n <= 0) {
+                        qCritical() << "Invalid framerate:" << fps;
+                        return 1;
+                    }
+                    cases.push_back({ backend, mode });
+                }
+            }
+        }
+    }
+
+    int warmup_ms = int(parser.value(warmupOption).toDouble() * 1000);
+    int duration_ms = int(parser.value(durationOption).toDouble() * 1000);
+    bool processing = parser.isSet(processingOption);
+    int cameras = parser.value(camerasOption).toInt();
+    if (cameras < 1) {
+        qCritical() << "Invalid camera count:" << parser.value(camerasOption);
+        return 1;
+    }
+
+    // Logger writes to stderr, stdout only ever carries the JSON
+    QJsonArray runs;
+    bool complete = true;
+
+    for (const BenchCase &bench : cases) {
+        QJsonObject result = run_case(source, bench, cameras, processing, warmup_ms, duration_ms);
+        complete = complete && !result.contains("error");
+        runs.append(result);
+    }
+
+    QJsonObject report;
+    report["source"] = QString::fromStdString(source.to_string());
+    report["isa"] = color_convert_isa();
+    report["processing"] = processing;
+    report["warmup_s"] = warmup_ms / 1000.0;
+    report["duration_s"] = duration_ms / 1000.0;
+    report["runs"] = runs;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            qCritical() << "Cannot write" << parser.value(outputOption);
+            return 1;
+        }
+    } else {
+        std::cout << json.constData() << std::flush;
+    }
+
+    return complete ? 0 : 1;
+}
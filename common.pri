@@ -0,0 +1,29 @@
+# Shared by the GUI (proj.pro) and the headless benchmark (bench/bench.pro)
+
+QT += core gui
+
+CONFIG += c++17
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv4
+PKGCONFIG += gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0
+# shm_open for the shared-memory frame export on older glibc
+LIBS += -lrt
+
+INCLUDEPATH += $$PWD
+
+# Everything but the window and its entry point
+GUI_SOURCES = $$PWD/src/main.cpp $$PWD/src/window.cpp $$PWD/src/framewidget.cpp
+GUI_HEADERS = $$PWD/inc/window.h $$PWD/inc/framewidget.h
+
+CORE_SOURCES = $$files($$PWD/src/*.cpp)
+CORE_SOURCES -= $$GUI_SOURCES
+CORE_HEADERS = $$files($$PWD/inc/*.h)
+CORE_HEADERS -= $$GUI_HEADERS
+
+SOURCES += $$CORE_SOURCES
+HEADERS += $$CORE_HEADERS
+
+OBJECTS_DIR = obj
+MOC_DIR = moc
+UI_DIR = ui
+RCC_DIR = rcc
@@ -0,0 +1,100 @@
+#ifndef ACTUATORLINK_H
+#define ACTUATORLINK_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frames on the wire, little endian:
+//   0xA5, type, sequence (u16), payload length (u8), payload, CRC-8 (poly 0x07)
+// over everything after the start byte. The host sends ACTUATOR_SETPOINT with
+// x and y as i16 hundredths of an axis unit, the device answers every frame
+// with ACTUATOR_ACK carrying the same sequence and no payload.
+enum ActuatorFrameType {
+    ACTUATOR_SETPOINT = 0x01,
+    ACTUATOR_ACK = 0x81
+};
+
+struct ActuatorStats {
+    bool connected = false;
+    std::string path;
+    uint64_t submitted = 0;
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    // Setpoints replaced by a newer one before they went out
+    uint64_t coalesced = 0;
+    // Frames never acknowledged
+    uint64_t timeouts = 0;
+    uint64_t io_errors = 0;
+    int in_flight = 0;
+    double rtt_last_ms = 0;
+    double rtt_average_ms = 0;
+    double rtt_max_ms = 0;
+};
+
+// Streams axis setpoints to a serial device from its own thread. submit()
+// only stores the newest setpoint and never blocks, the I/O thread sends it
+// when the device has room, so a slow or stalled device only makes
+// setpoints coalesce. A few frames may be in flight waiting for their acks.
+class ActuatorLink {
+    public:
+        static constexpr int MAX_IN_FLIGHT = 4;
+        static constexpr int ACK_TIMEOUT_MS = 100;
+
+        ActuatorLink();
+        ~ActuatorLink();
+
+        // A tty path, or "pty" to create a pseudo terminal whose slave side
+        // stands in for the device, its path is printed and kept in stats()
+        bool open(const std::string &path);
+        void close();
+        bool is_open() const { return running.load(); }
+
+        // Any thread, never blocks, identical setpoints are ignored
+        void submit(double x, double y);
+
+        ActuatorStats stats() const;
+
+    private:
+        struct InFlight {
+            uint16_t sequence;
+            int64_t sent_ns;
+        };
+
+        void run();
+        bool fill_frame();
+        bool flush();
+        void read_acks();
+        void expire(int64_t now);
+        void acknowledge(uint16_t sequence, int64_t now);
+
+        int fd;
+        // The pty slave, held open so the master does not hang up without a device
+        int slave_fd;
+        int wake_fd;
+        std::thread worker;
+        std::atomic<bool> running;
+
+        // Newest setpoint, x in the low and y in the high 32 bits
+        std::atomic<uint64_t> setpoint;
+        std::atomic<uint64_t> setpoint_generation;
+
+        // Only touched by the I/O thread
+        uint64_t sent_generation;
+        uint64_t last_sent_setpoint;
+        bool have_sent;
+        uint16_t next_sequence;
+        uint16_t tx_sequence;
+        std::vector<uint8_t> tx;
+        size_t tx_offset;
+        std::vector<uint8_t> rx;
+        std::vector<InFlight> in_flight;
+
+        mutable std::mutex stats_mutex;
+        ActuatorStats counters;
+};
+
+#endif // ACTUATORLINK_H
@@ -0,0 +1,111 @@
+#ifndef BACKPRESSURE_H
+#define BACKPRESSURE_H
+
+#include <glib.h>
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Quality steps, each one keeps those below it
+enum DegradeLevel {
+    DegradeNone,
+    // Half the frame rate, dropped by videorate before conversion
+    DegradeFramerate,
+    // Half the width and height at the appsink
+    DegradeResolution,
+    // Analysis only gets every other frame
+    DegradeAnalysis,
+    DEGRADE_LEVEL_COUNT
+};
+
+// Load of the frame path over the last tick
+struct LoadSample {
+    quint64 frames = 0;
+    // Share of the buffers the appsink replaced before they were pulled
+    double drop_ratio = 0;
+    // Fullest analysis queue
+    size_t queue_depth = 0;
+    // Frames the analysis queues dropped
+    quint64 stage_dropped = 0;
+    double latency_p95_ms = 0;
+};
+
+struct BackpressureStats {
+    bool enabled = false;
+    DegradeLevel level = DegradeNone;
+    double latency_ceiling_ms = 0;
+    LoadSample last;
+    quint64 degrades = 0;
+    quint64 restores = 0;
+};
+
+// Keeps the frame path under a latency ceiling by trading quality for
+// time. Ticks on the capture scheduler's thread: a saturated path for
+// SATURATED_TICKS in a row goes one level down, headroom for
+// HEADROOM_TICKS in a row comes one level back up, and nothing changes
+// for SETTLE_TICKS after a step so the new level shows in the numbers.
+class BackpressureController {
+    public:
+        static constexpr int TICK_MS = 500;
+        static constexpr int SATURATED_TICKS = 2;
+        static constexpr int HEADROOM_TICKS = 10;
+        static constexpr int SETTLE_TICKS = 4;
+        static constexpr double DEFAULT_CEILING_MS = 100;
+        // Saturated above this drop ratio, headroom below the lower one
+        static constexpr double MAX_DROP_RATIO = 0.05;
+        static constexpr double HEADROOM_DROP_RATIO = 0.01;
+        // Headroom needs the latency this far under the ceiling
+        static constexpr double HEADROOM_LATENCY = 0.6;
+
+        // Called with tick_mutex held, so never at the same time. The sampler
+        // runs on the scheduler thread, the applier there too or on the
+        // thread calling set_enabled(false)
+        typedef std::function<LoadSample()> Sampler;
+        typedef std::function<void(DegradeLevel)> Applier;
+
+        explicit BackpressureController(const std::string &name);
+        ~BackpressureController();
+
+        void attach(Sampler sampler, Applier applier);
+        void detach();
+
+        // Disabling goes straight back to full quality
+        void set_enabled(bool enabled);
+        void set_latency_ceiling(double ms);
+
+        BackpressureStats stats() const;
+
+        static const char *level_name(DegradeLevel level);
+
+    private:
+        static gboolean tick_callback(gpointer data);
+        void tick();
+        void change(DegradeLevel level, const char *reason);
+
+        std::string name;
+        Sampler sampler;
+        Applier applier;
+        GSource *tick_source;
+        // Held by the tick and detach(), so nothing is applied to a pipeline being destroyed
+        std::mutex tick_mutex;
+
+        std::atomic<bool> enabled;
+        std::atomic<double> ceiling_ms;
+
+        // Only touched by the scheduler thread
+        int saturated_ticks;
+        int headroom_ticks;
+        int settle_ticks;
+
+        mutable std::mutex stats_mutex;
+        DegradeLevel level;
+        LoadSample last;
+        quint64 degrades;
+        quint64 restores;
+};
+
+#endif // BACKPRESSURE_H
@@ -0,0 +1,123 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// What a full queue does with a new item
+enum DropPolicy {
+    DropOldest,     // evict the oldest queued item, keep the newest
+    DropNewest      // refuse the incoming item
+};
+
+// Bounded queue between a producer that must never block (capture) and a
+// worker thread. push() never waits, pop() waits until an item arrives or
+// the queue is closed. Items that do not fit are dropped and counted.
+template <typename T>
+class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity = 2, DropPolicy policy = DropOldest) :
+            m_capacity(capacity ? capacity : 1),
+            m_policy(policy),
+            m_closed(false),
+            m_dropped(0)
+        {}
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue &operator=(const BoundedQueue&) = delete;
+
+        // Returns false when an item (the incoming or an evicted one) was dropped
+        bool push(T item) {
+            T evicted;
+            bool dropped = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_closed)
+                    return false;
+
+                if (m_items.size() >= m_capacity) {
+                    dropped = true;
+                    if (m_policy == DropNewest) {
+                        m_dropped++;
+                        return false;
+                    }
+                    evicted = std::move(m_items.front());
+                    m_items.pop_front();
+                }
+                m_items.push_back(std::move(item));
+            }
+
+            if (dropped)
+                m_dropped++;
+            m_ready.notify_one();
+
+            // The evicted item is released here, outside of the lock
+            return !dropped;
+        }
+
+        // Blocks until an item is available, returns false once closed and drained
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+
+            if (m_items.empty())
+                return false;
+
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            return true;
+        }
+
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = true;
+            }
+            m_ready.notify_all();
+        }
+
+        void reopen() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_items.clear();
+            m_closed = false;
+        }
+
+        void set_policy(DropPolicy policy) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_policy = policy;
+        }
+
+        void set_capacity(size_t capacity) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_capacity = capacity ? capacity : 1;
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_items.size();
+        }
+
+        size_t capacity() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_capacity;
+        }
+
+        uint64_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        std::condition_variable m_ready;
+        std::deque<T> m_items;
+        size_t m_capacity;
+        DropPolicy m_policy;
+        bool m_closed;
+        std::atomic<uint64_t> m_dropped;
+};
+
+#endif // BOUNDEDQUEUE_H
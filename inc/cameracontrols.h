@@ -0,0 +1,82 @@
+#ifndef CAMERACONTROLS_H
+#define CAMERACONTROLS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum CameraControl {
+    ControlZoom,
+    ControlFocus,
+    CAMERA_CONTROL_COUNT
+};
+
+struct CameraControlStats {
+    bool open = false;
+    bool zoom = false;
+    bool focus = false;
+    uint64_t requested = 0;
+    uint64_t applied = 0;
+    // Replaced by a newer value before the device took them
+    uint64_t coalesced = 0;
+    uint64_t errors = 0;
+};
+
+// Hardware zoom and focus of a V4L2 device, set through its controls on a
+// descriptor of our own next to the one v4l2src streams from. set() only
+// stores the newest value and never blocks, the ioctls run on a worker
+// thread, so a slider dragged faster than the camera answers just skips
+// the values in between.
+class CameraControls {
+    public:
+        CameraControls();
+        ~CameraControls();
+
+        // False when the device has none of the controls
+        bool open(const std::string &device);
+        void close();
+        bool is_open() const { return fd >= 0; }
+
+        bool available(CameraControl control) const { return ranges[control].available; }
+
+        // Any thread, level from 0 to 1 over the control's range
+        void set(CameraControl control, double level);
+
+        CameraControlStats stats() const;
+
+    private:
+        struct Range {
+            bool available = false;
+            uint32_t id = 0;
+            int32_t minimum = 0;
+            int32_t maximum = 0;
+            int32_t step = 1;
+        };
+
+        bool query(CameraControl control, uint32_t id);
+        bool apply(uint32_t id, int32_t value);
+        void run();
+
+        int fd;
+        Range ranges[CAMERA_CONTROL_COUNT];
+        // Autofocus has to be off before an absolute focus sticks
+        bool has_autofocus;
+        bool autofocus_off;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool running;
+        double pending[CAMERA_CONTROL_COUNT];
+        bool dirty[CAMERA_CONTROL_COUNT];
+
+        std::atomic<uint64_t> requested;
+        std::atomic<uint64_t> applied;
+        std::atomic<uint64_t> coalesced;
+        std::atomic<uint64_t> errors;
+};
+
+#endif // CAMERACONTROLS_H
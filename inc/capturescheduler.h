@@ -0,0 +1,36 @@
+#ifndef CAPTURESCHEDULER_H
+#define CAPTURESCHEDULER_H
+
+#include <gst/gst.h>
+
+#include <thread>
+
+// Process-wide state shared by every GstreamerCameraCapture: GStreamer is
+// initialised once, and the buses of all pipelines are watched from one
+// thread with its own main context, instead of one watch per camera on the
+// GUI's default context. Per camera, only the pipeline's own streaming
+// thread remains.
+class CaptureScheduler {
+    public:
+        static CaptureScheduler &instance();
+
+        // The callbacks run on the bus thread, not the GUI thread
+        GSource *add_bus_watch(GstBus *bus, GstBusFunc callback, gpointer data);
+        GSource *add_timeout(guint interval_ms, GSourceFunc callback, gpointer data);
+        // Once this returns the callback no longer runs, a call already
+        // running on the bus thread has been waited for
+        void remove_source(GSource *source);
+
+    private:
+        CaptureScheduler();
+        ~CaptureScheduler();
+
+        CaptureScheduler(const CaptureScheduler&) = delete;
+        CaptureScheduler &operator=(const CaptureScheduler&) = delete;
+
+        GMainContext *context;
+        GMainLoop *loop;
+        std::thread bus_thread;
+};
+
+#endif // CAPTURESCHEDULER_H
@@ -0,0 +1,33 @@
+#ifndef CAPTURESOURCE_H
+#define CAPTURESOURCE_H
+
+#include <string>
+
+// Describes where GstreamerCameraCapture takes its frames from.
+// Parsed from "<kind>:<location>" strings, e.g.
+//   v4l2:/dev/video0   - V4L2 camera (default device when location is empty)
+//   test:smpte         - videotestsrc with the given pattern
+//   uri:rtsp://host/x  - anything uridecodebin can play
+//   file:/tmp/a.mp4    - local file, played through uridecodebin
+//   appsrc             - frames pushed by the caller with push_frame()
+struct CaptureSource {
+    enum Kind {
+        V4L2,
+        TestPattern,
+        Uri,
+        AppSrc
+    };
+
+    Kind kind;
+    std::string location;
+
+    CaptureSource(Kind kind = V4L2, const std::string &location = std::string()) :
+        kind(kind),
+        location(location)
+    {}
+
+    static bool from_string(const std::string &spec, CaptureSource &source);
+    std::string to_string() const;
+};
+
+#endif // CAPTURESOURCE_H
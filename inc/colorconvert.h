@@ -0,0 +1,35 @@
+#ifndef COLORCONVERT_H
+#define COLORCONVERT_H
+
+#include <cstdint>
+
+// Colour conversion kernels for the formats our cameras deliver.
+//
+// Every kernel works row by row on explicit strides, so padded or cropped
+// planes are fine, and writes packed RGB888 straight into the destination.
+// YUV kernels use the BT.601 limited range fixed-point math of OpenCV's
+// COLOR_YUV2RGB_YUY2 / COLOR_YUV2RGB_NV12, so results match cvtColor.
+// The SSE4.1 or AVX2 variant is picked once at startup from the CPU
+// features, with a scalar fallback for everything else.
+
+void convert_yuy2_to_rgb(const uint8_t *src, int src_stride,
+                         uint8_t *dst, int dst_stride,
+                         int width, int height);
+
+void convert_nv12_to_rgb(const uint8_t *src_y, int y_stride,
+                         const uint8_t *src_uv, int uv_stride,
+                         uint8_t *dst, int dst_stride,
+                         int width, int height);
+
+// BGR888 <-> RGB888, the same swizzle works both ways
+void convert_swap_rb(const uint8_t *src, int src_stride,
+                     uint8_t *dst, int dst_stride,
+                     int width, int height);
+
+// Name of the instruction set the kernels were dispatched to
+const char *color_convert_isa();
+
+// Compares every kernel against cv::cvtColor on random, strided frames
+bool color_convert_self_test();
+
+#endif // COLORCONVERT_H
@@ -0,0 +1,55 @@
+#ifndef FRAMEEXPORT_H
+#define FRAMEEXPORT_H
+
+#include "inc/sharedframes.h"
+
+#include <QImage>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+struct FrameExportStats {
+    bool open = false;
+    std::string name;
+    uint64_t published = 0;
+    // Larger than a slot, or in a format readers cannot describe
+    uint64_t skipped = 0;
+};
+
+// Writer side of the shared-memory frame ring described in sharedframes.h.
+// publish() copies the frame into the next slot under its seqlock and never
+// waits for readers, whoever is too slow just gets lapped. open() and close()
+// must not run while the streaming thread publishes.
+class FrameExport {
+    public:
+        static constexpr int DEFAULT_SLOTS = 4;
+        // Room for 4K RGBX, untouched pages of the object cost no memory
+        static constexpr size_t DEFAULT_SLOT_BYTES = 3840 * 2160 * 4;
+
+        FrameExport();
+        ~FrameExport();
+
+        // Creates the shared-memory object name, replacing a stale one
+        bool open(const std::string &name, int slots = DEFAULT_SLOTS, size_t slot_bytes = DEFAULT_SLOT_BYTES);
+        // Marks the ring closed for its readers and unlinks it
+        void close();
+        bool is_open() const { return header != nullptr; }
+
+        // Streaming thread only
+        void publish(const QImage &image, int64_t capture_ns);
+
+        FrameExportStats stats() const;
+
+    private:
+        std::string name;
+        void *mapped;
+        size_t mapped_size;
+        SharedFrameHeader *header;
+        uint64_t frame;
+
+        std::atomic<uint64_t> published;
+        std::atomic<uint64_t> skipped;
+};
+
+#endif // FRAMEEXPORT_H
@@ -0,0 +1,38 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+
+#include <atomic>
+
+// Counters shared between a FramePool and its owner
+struct FramePoolCounters {
+    std::atomic<guint64> acquired{0};
+    std::atomic<guint64> exhausted{0};
+    std::atomic<guint64> buffer_size{0};
+    std::atomic<guint> buffers{0};
+};
+
+// Bounded video buffer pool handed to upstream elements through the
+// appsink allocation query, so videoconvert writes straight into buffers
+// we recycle. It starts at its minimum and grows up to its maximum on
+// demand. Buffers go back to the pool when their last reference (usually
+// the QImage shown by the GUI) is dropped. Whenever the pool runs dry the
+// acquire waits for a buffer and the exhaustion is counted.
+struct FramePool {
+    GstVideoBufferPool parent;
+    FramePoolCounters *counters;
+};
+
+struct FramePoolClass {
+    GstVideoBufferPoolClass parent_class;
+};
+
+#define FRAME_TYPE_POOL (frame_pool_get_type())
+
+GType frame_pool_get_type();
+GstBufferPool *frame_pool_new(FramePoolCounters *counters);
+
+#endif // FRAMEPOOL_H
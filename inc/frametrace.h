@@ -0,0 +1,74 @@
+#ifndef FRAMETRACE_H
+#define FRAMETRACE_H
+
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Points in a frame's life, all recorded on the monotonic clock. TRACE_PTS
+// is the buffer timestamp moved to the same clock (base time + PTS), which
+// for live sources is when the frame was captured.
+enum TraceStage {
+    TRACE_PTS,
+    TRACE_ARRIVAL,
+    TRACE_CONVERTED,
+    TRACE_PROCESSED,
+    TRACE_HANDED,
+    TRACE_PAINTED,
+    TRACE_STAGE_COUNT
+};
+
+// Latency between two trace points over the recent frames
+struct LatencyStats {
+    std::string name;
+    size_t samples = 0;
+    double p50_ms = 0;
+    double p95_ms = 0;
+    double p99_ms = 0;
+};
+
+// Per-frame latency records in a fixed ring indexed by frame sequence.
+// Every thread marks its own point with plain atomic stores, nothing on
+// the frame path takes a lock or allocates.
+class FrameTracer {
+    public:
+        static constexpr size_t CAPACITY = 1024;
+
+        FrameTracer();
+
+        // Claims the slot of a new frame, called by the streaming thread
+        void begin(quint64 sequence, int64_t pts_ns);
+        void mark(quint64 sequence, TraceStage stage);
+        void mark(quint64 sequence, TraceStage stage, int64_t time_ns);
+
+        // Rolling percentiles of each step and of the whole path, only over
+        // the frames after since when given
+        std::vector<LatencyStats> summarize(quint64 since = 0) const;
+
+        // Writes every complete record as CSV, one frame per line
+        bool dump(const std::string &path) const;
+
+        static int64_t now_ns();
+        static const char *stage_name(TraceStage stage);
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<quint64> sequence;
+            std::array<std::atomic<int64_t>, TRACE_STAGE_COUNT> times;
+        };
+
+        struct Record {
+            quint64 sequence;
+            int64_t times[TRACE_STAGE_COUNT];
+        };
+
+        std::vector<Record> snapshot() const;
+
+        Slot ring[CAPACITY];
+};
+
+#endif // FRAMETRACE_H
@@ -0,0 +1,51 @@
+#ifndef FRAMEWIDGET_H
+#define FRAMEWIDGET_H
+
+#include <QWidget>
+#include <QImage>
+#include <QString>
+#include <QRectF>
+#include <QPoint>
+
+// Paints the latest camera frame straight from the QImage that wraps the
+// mapped GstBuffer, so nothing is copied between the appsink and the screen.
+class FrameWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FrameWidget(QWidget *parent = nullptr);
+
+    void setFrame(const QImage &image, quint64 sequence = 0);
+    void clear(const QString &text = QString());
+
+    // Box drawn over the frame, normalised to the frame size
+    void setOverlay(const QRectF &box, bool locked);
+    void clearOverlay();
+
+signals:
+    // Emitted once per frame, after it has been drawn
+    void framePainted(quint64 sequence);
+    // Dragged out with the left button, normalised to the frame size
+    void regionSelected(QRectF region);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private:
+    QImage m_frame;
+    QString m_text;
+    quint64 m_sequence;
+    quint64 m_paintedSequence;
+
+    QRectF m_overlay;
+    bool m_overlayLocked;
+    bool m_selecting;
+    QPoint m_selectionStart;
+    QPoint m_selectionEnd;
+};
+
+#endif // FRAMEWIDGET_H
@@ -8,48 +8,366 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include "inc/capturesource.h"
+#include "inc/capturescheduler.h"
+#include "inc/triplebuffer.h"
+#include "inc/framepool.h"
+#include "inc/colorconvert.h"
+#include "inc/processing.h"
+#include "inc/frametrace.h"
+#include "inc/recorder.h"
+#include "inc/preevent.h"
+#include "inc/tracker.h"
+#include "inc/logger.h"
+#include "inc/healthmonitor.h"
+#include "inc/frameexport.h"
+#include "inc/backpressure.h"
+#include "inc/cameracontrols.h"
+#include "inc/presentscheduler.h"
 
 #include <QPixmap>
 #include <QImage>
-#include <QMutex>
+#include <QObject>
 
-#include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 using namespace cv;
 
-class GstreamerCameraCapture {
+// Frame handed from the streaming thread to the GUI
+struct CapturedFrame {
+    QImage image;
+    quint64 sequence = 0;
+    // Buffer timestamp on the monotonic clock, 0 when it had none
+    int64_t capture_ns = 0;
+};
+
+// Native mode of a capture device, "MJPG" stands for image/jpeg
+struct VideoMode {
+    std::string format;
+    int width = 0;
+    int height = 0;
+    int fps_n = 0;
+    int fps_d = 1;
+
+    bool is_compressed() const { return format == "MJPG"; }
+    GstCaps *to_caps() const;
+    std::string to_string() const;
+
+    bool operator<(const VideoMode &other) const;
+    bool operator==(const VideoMode &other) const;
+};
+
+// Where colour conversion to RGB happens: videoconvert inside the pipeline,
+// or our own SIMD kernels writing straight into the display buffer
+enum ConvertBackend {
+    VideoConvert,
+    NativeConvert
+};
+
+// Snapshot of the frame pool offered to upstream
+struct FramePoolStats {
+    guint buffers = 0;
+    guint64 buffer_size = 0;
+    guint64 acquired = 0;
+    guint64 exhausted = 0;
+};
+
+// Part of the source frame to show, normalized to 0..1
+struct CropRegion {
+    double x = 0;
+    double y = 0;
+    double width = 1;
+    double height = 1;
+};
+
+// What a stopped pipeline keeps running
+enum StandbyMode {
+    // Live sources keep streaming with every frame dropped at the source,
+    // others stay pre-rolled in PAUSED, so the next frame is one period away
+    StandbyHot,
+    // Device open and probed but not streaming
+    StandbyReady,
+    // Pipeline in NULL with the stream's device closed, only the
+    // descriptor for zoom and focus controls stays open
+    StandbyClosed
+};
+
+// Milliseconds, 0 until measured
+struct StartupStats {
+    StandbyMode standby = StandbyHot;
+    // Reached its standby state after prepare()
+    bool prepared = false;
+    // From prepare() to the pipeline sitting in its standby state
+    double prepare_ms = 0;
+    // From the last run() to the first frame handed to the GUI
+    double first_frame_ms = 0;
+    quint64 starts = 0;
+};
+
+// Buffers that reached the conversion element and frames handed out by
+// the appsink, the difference is what the leaky appsink queue dropped
+struct CaptureCounters {
+    quint64 received = 0;
+    quint64 delivered = 0;
+    // Pulled but not converted, the reason is logged once where it is known
+    quint64 refused = 0;
+};
+
+class GstreamerCameraCapture : public QObject {
+    Q_OBJECT
+
     private:
         GstElement* pipeline;
         GstElement* source;
         GstElement* convert;
         GstElement* scale;
         GstElement* sink;
+        GstElement* source_filter;
+        GstElement* decoder;
+        // Entry of the shared part of the pipeline, drops frames under backpressure
+        GstElement* rate;
+        // Digital zoom, so only the shown pixels get converted and scaled
+        GstElement* crop;
+
+        CaptureSource source_config;
+        ConvertBackend backend;
+        Size pushed_size;
 
-        Mat processedFrame;
+        VideoMode current_mode;
+        bool has_mode;
+        // Guards the mode against the backpressure controller's thread
+        mutable std::mutex mode_mutex;
 
-        std::atomic<bool> frame_ready;
+        // Derived from the negotiated caps, only touched by the streaming thread
+        GstCaps *negotiated_caps;
+        GstVideoInfo negotiated_info;
+        QImage::Format negotiated_format;
+        int negotiated_mat_type;
+
+        TripleBuffer<CapturedFrame> frames;
+        ProcessingEngine processing;
+        FrameTracer tracer;
+        Recorder recorder;
+        std::atomic<int> recording_source;
+        PreEventBuffer pre_event;
+        TrackingLoop tracking;
+        FrameExport frame_export;
+
+        // Most frames out of the pool at once: the triple buffer, the
+        // presenter's queue and the widget, the appsink queue and the frame
+        // being converted upstream, then for each consumer its deepest queue
+        // plus the frame it works on, processing, the recorder, the
+        // pre-event encoder and the tracker. Only FRAME_POOL_MIN buffers are
+        // allocated up front, the pool grows on demand, and running dry
+        // anyway shows up as exhausted in pool_stats()
+        static constexpr guint FRAME_POOL_SIZE = 3 + PresentScheduler::MAX_QUEUED + 1 + 1 + 1
+            + (ProcessingEngine::MAX_QUEUE_CAPACITY + 1)
+            + 2 * (Recorder::QUEUE_CAPACITY + 1)
+            + (TrackingLoop::QUEUE_CAPACITY + 1);
+        // The triple buffer, the widget, the appsink queue and the frame
+        // being converted, what capture and display alone keep busy
+        static constexpr guint FRAME_POOL_MIN = 6;
+        FramePoolCounters pool_counters;
+
+        // Destination buffers of the native conversion
+        GstBufferPool *convert_pool;
+        GstVideoInfo convert_info;
+        FramePoolCounters convert_pool_counters;
+
+        GSource *bus_watch;
+        HealthMonitor health;
+        BackpressureController backpressure;
+        std::atomic<int> degrade_level;
+        // Analysis gets one frame out of this many
+        std::atomic<int> analysis_stride;
+        // Counters at the previous backpressure tick, only touched by the scheduler thread
+        quint64 load_received;
+        quint64 load_dropped;
+        quint64 load_stage_dropped;
+        quint64 load_sequence;
+
+        // Hardware zoom and focus of V4L2 devices that have them
+        CameraControls controls;
+        // Set once prepare() opened them, they are not touched before
+        std::atomic<bool> controls_ready;
+        // Shared by the GUI and the streaming thread's caps probe
+        std::mutex crop_mutex;
+        CropRegion crop_region;
+        double digital_zoom;
+        int crop_input_width;
+        int crop_input_height;
+        std::atomic<bool> signal_pending;
+        std::atomic<quint64> frame_sequence;
+        std::atomic<quint64> frames_refused;
+
+        // Slow state changes, prepare(), mode switches and restarts, run
+        // one at a time on this thread, never on the GUI or scheduler thread
+        enum StateTask {
+            TaskPrepare = 1,
+            TaskMode = 2,
+            TaskRestart = 4
+        };
+        std::thread state_worker;
+        std::mutex worker_mutex;
+        std::condition_variable worker_wake;
+        // Guarded by worker_mutex, pending_tasks holds StateTask bits and
+        // pending_mode the newest mode asked for, nullopt for the default
+        bool worker_running;
+        unsigned pending_tasks;
+        std::optional<VideoMode> pending_mode;
+
+        // Serializes the short state changes of the GUI and the state worker
+        mutable std::mutex state_mutex;
+        // Guarded by state_mutex
+        bool capturing;
+        // The state worker owns the pipeline state, run() and stop() only record intent
+        bool busy;
+        // Neither the chosen nor the previous mode could be linked, the
+        // pipeline stays in NULL until a mode applies
+        bool failed;
+        StandbyMode standby;
+        // Sources that only produce in PLAYING, set by prepare() for uridecodebin
+        std::atomic<bool> live;
+        // Hot standby of a live source, every buffer is dropped at the source
+        std::atomic<bool> gated;
+        // Modes probed by prepare(), guarded by mode_mutex
+        std::vector<VideoMode> probed_modes;
+        int64_t prepare_start_ns;
+        int64_t run_start_ns;
+        std::atomic<bool> first_frame_pending;
+        std::atomic<double> prepare_ms;
+        std::atomic<double> first_frame_ms;
+        std::atomic<quint64> starts;
     
-        GstBuffer *mat_to_gst_buffer(const Mat &frame);
-        GstSample *mat_to_gst_sample(const Mat &frame, GstCaps *caps);
-        Mat process_frame(const Mat &input_frame);
-        Mat gst_sample_to_mat(GstSample* sample);
+        bool create_source();
+        bool link_source_branch();
+        void unlink_source_branch();
+        void apply_source_caps(const VideoMode *mode);
+        bool switch_mode(const VideoMode *mode);
+        void request_mode(const std::optional<VideoMode> &mode);
+        bool post_state_task(StateTask task);
+        void run_state_worker();
+        GstCaps *output_caps() const;
+        bool update_negotiated_caps(GstCaps *caps);
+        static void append_modes(const GstStructure *structure, std::vector<VideoMode> &modes);
+        QImage gst_sample_to_image(GstSample *sample);
+        QImage convert_sample(GstSample *sample);
+        bool ensure_convert_pool(int width, int height);
+        int64_t capture_time_ns(GstSample *sample) const;
+        void restart_pipeline();
+        LoadSample sample_load();
+        void apply_degrade(DegradeLevel level);
+        // Frame rate coming into the rate limiter, 30 while nothing is negotiated
+        int nominal_fps() const;
+        void apply_crop();
+        CropRegion shown_region() const;
         void new_frame(GstElement *sink);
+        void prepare_standby();
+        void start_pipeline();
+        bool enter_standby();
 
         friend GstFlowReturn new_sample_callback(GstElement *sink, gpointer data);
-
-        QMutex m_mutex;
+        friend GstPadProbeReturn allocation_query_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+        friend GstPadProbeReturn count_buffer_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+        friend GstPadProbeReturn crop_caps_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+        friend GstPadProbeReturn standby_gate_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
 
     public:
         
-        QPixmap pull_pixmap_from_frame();
-        GstreamerCameraCapture();
+        QImage pull_image_from_frame(quint64 *sequence = nullptr, int64_t *capture_ns = nullptr);
+        explicit GstreamerCameraCapture(const CaptureSource &source_config = CaptureSource(),
+                                        ConvertBackend backend = VideoConvert,
+                                        QObject *parent = nullptr);
         ~GstreamerCameraCapture();
 
         
+        // Leaves the pipeline in its standby state
         void stop();
         void run();
+
+        // Probes the device and brings the pipeline to its standby state on
+        // a thread of its own, prepared() tells when it is there
+        void prepare();
+        // Applied right away when stopped, otherwise on the next stop()
+        void set_standby_mode(StandbyMode mode);
+        StartupStats startup_stats() const;
+        static const char *standby_name(StandbyMode mode);
+
+        bool push_frame(const Mat &frame);
+
+        // Copies a frame into a new buffer/sample, the timestamp defaults to now
+        static GstBuffer *mat_to_gst_buffer(const Mat &frame);
+        static GstSample *mat_to_gst_sample(const Mat &frame, GstCaps *caps,
+                                            GstClockTime timestamp = GST_CLOCK_TIME_NONE);
+
+        // Recording runs on its own thread and never holds up the preview.
+        // RecordProcessed is refused while the processing engine is stopped
+        bool start_recording(const std::string &path, RecordingSource source, RecordingCodec codec);
+        void stop_recording();
+        RecordingStats recording_stats() const { return recorder.stats(); }
+
+        // Continuously encoded last seconds of the raw stream, for event clips
+        PreEventBuffer *pre_event_buffer() { return &pre_event; }
+
+        // Closed-loop target tracking on the raw frames
+        TrackingLoop *tracking_loop() { return &tracking; }
+
+        // Every frame copied to a shared-memory ring for other processes,
+        // open it before the pipeline runs
+        FrameExport *shared_frames() { return &frame_export; }
+
+        FramePoolStats pool_stats() const;
+        CaptureCounters counters() const;
+        HealthStats health_stats() const { return health.stats(); }
+        // Lowers frame rate, resolution and analysis rate when the frame path falls behind
+        BackpressureController *backpressure_controller() { return &backpressure; }
+        ProcessingEngine *processing_engine() { return &processing; }
+        FrameTracer *frame_tracer() { return &tracer; }
+
+        std::vector<VideoMode> enumerate_modes();
+        // What prepare() found, empty before that
+        std::vector<VideoMode> prepared_modes() const;
+        // Applied on the state worker, modeApplied() tells the outcome. A mode
+        // that cannot be linked leaves the previous one in place
+        void set_mode(const VideoMode &mode);
+        // Back to the caps the source started with, the same way
+        void reset_mode();
+
+        // Digital zoom is at most this factor
+        static constexpr double MAX_DIGITAL_ZOOM = 4.0;
+
+        // Level from 0 to 1, through the camera's zoom control when it has
+        // one, otherwise by cropping the region shown, live in either case
+        void set_zoom(double level);
+        // False when the camera has no focus control
+        bool set_focus(double level);
+        // Zoom stays centred on this region, the whole frame by default.
+        // The region is widened to the frame's aspect ratio, since the
+        // appsink size is fixed and anything else would be stretched
+        void set_crop_region(const CropRegion &region);
+        // Crops to a selection made on the frame as currently shown, widened
+        // the same way so all of it stays in view
+        void crop_to_shown(const CropRegion &selection);
+        CameraControlStats control_stats() const {
+            return controls_ready.load() ? controls.stats() : CameraControlStats();
+        }
+
+    signals:
+        // Emitted from the streaming thread, at most once until the frame is pulled
+        void frameReady(quint64 sequence);
+        // Emitted from the state worker once the standby state is reached
+        void prepared(bool ok);
+        // Emitted from the state worker after set_mode() or reset_mode()
+        void modeApplied(bool ok);
 };
 
 #endif // GSTREAMER_Hs
@@ -0,0 +1,142 @@
+#ifndef HEALTHMONITOR_H
+#define HEALTHMONITOR_H
+
+#include <gst/gst.h>
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+struct HealthStats {
+    std::string state;
+    quint64 buffers = 0;
+    quint64 pulled = 0;
+    // Replaced in the appsink before they were pulled
+    quint64 appsink_dropped = 0;
+    quint64 qos_messages = 0;
+    // Reported by the elements' QoS messages, summed over elements
+    quint64 qos_dropped = 0;
+    double qos_jitter_ms = 0;
+    quint64 latency_messages = 0;
+    quint64 pts_gaps = 0;
+    quint64 frames_missing = 0;
+    quint64 discontinuities = 0;
+    quint64 stalls = 0;
+    bool stalled = false;
+    quint64 errors = 0;
+    quint64 restarts = 0;
+    // Delay before the next restart attempt, 0 when none is pending
+    int restart_in_ms = 0;
+    std::string last_error;
+};
+
+// Watches one capture pipeline: counts what reaches the appsink and what
+// is pulled from it, looks for PTS gaps on the streaming thread, consumes
+// QoS, latency, state and error messages on the bus thread, and runs a
+// watchdog there that notices stalls. Errors and long stalls restart the
+// pipeline with an exponential backoff capped at MAX_BACKOFF_MS.
+class HealthMonitor {
+    public:
+        static constexpr int WATCHDOG_MS = 250;
+        static constexpr int STALL_MIN_MS = 1000;
+        static constexpr int RESTART_AFTER_STALL_MS = 3000;
+        static constexpr int MIN_BACKOFF_MS = 500;
+        static constexpr int MAX_BACKOFF_MS = 8000;
+        // Frames have to flow this long before the backoff starts over
+        static constexpr int HEALTHY_MS = 5000;
+
+        // Hands the restart to the owner's own thread, called on the bus
+        // thread so it must not block. False when it could not be scheduled.
+        // The owner checks under its own lock that the pipeline is still
+        // meant to run.
+        typedef std::function<bool()> RestartHandler;
+
+        explicit HealthMonitor(const std::string &name);
+        ~HealthMonitor();
+
+        void attach(GstElement *pipeline, RestartHandler restart);
+        void detach();
+
+        // Whether the pipeline is meant to be running, nothing is restarted otherwise
+        void set_active(bool active);
+        // The stream starts over, after a restart or a mode change
+        void reset_stream();
+        // Off for sources that may go quiet on purpose, pushed frames for one
+        void set_restart_on_stall(bool enabled) { restart_on_stall.store(enabled); }
+
+        // Streaming thread
+        void on_buffer(GstBuffer *buffer);
+        void on_sample();
+
+        // Bus thread
+        void handle_message(GstMessage *message);
+
+        HealthStats stats() const;
+
+    private:
+        static gboolean watchdog_callback(gpointer data);
+        void watchdog();
+        void schedule_restart(const std::string &reason);
+        void report();
+
+        std::string name;
+        // Both guarded by watchdog_mutex
+        GstElement *pipeline;
+        RestartHandler restart;
+        GSource *watchdog_source;
+        // Held by the watchdog, the bus messages and detach(), so nothing
+        // touches the pipeline once it is gone
+        std::mutex watchdog_mutex;
+
+        std::atomic<bool> active;
+        std::atomic<bool> restart_on_stall;
+        // End of stream reached, silence from then on is no stall
+        std::atomic<bool> ended;
+        std::atomic<int64_t> started_ns;
+        std::atomic<int64_t> last_buffer_ns;
+        std::atomic<bool> pts_reset;
+
+        // Only touched by the streaming thread
+        GstClockTime last_pts;
+        // Estimated from the PTS deltas, read by the watchdog
+        std::atomic<guint64> frame_period;
+
+        std::atomic<quint64> buffers;
+        std::atomic<quint64> pulled;
+        // Taken by reset_stream(), appsink drops only count within a stream
+        std::atomic<quint64> buffers_base;
+        std::atomic<quint64> pulled_base;
+        std::atomic<quint64> dropped_base;
+        std::atomic<quint64> pts_gaps;
+        std::atomic<quint64> frames_missing;
+        std::atomic<quint64> discontinuities;
+
+        // Only touched by the bus thread
+        std::map<std::string, quint64> qos_dropped_by_element;
+        int64_t restart_due_ns;
+        int backoff_ms;
+        int ticks;
+        quint64 reported_dropped;
+        quint64 reported_gaps;
+        quint64 reported_qos_dropped;
+
+        std::atomic<int> state;
+        std::atomic<quint64> qos_messages;
+        std::atomic<quint64> qos_dropped;
+        std::atomic<double> qos_jitter_ms;
+        std::atomic<quint64> latency_messages;
+        std::atomic<quint64> stalls;
+        std::atomic<bool> stalled;
+        std::atomic<quint64> errors;
+        std::atomic<quint64> restarts;
+        std::atomic<int> restart_in_ms;
+
+        mutable std::mutex error_mutex;
+        std::string last_error;
+};
+
+#endif // HEALTHMONITOR_H
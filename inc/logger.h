@@ -0,0 +1,147 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "inc/mpscqueue.h"
+
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum LogLevel {
+    LogDebug,
+    LogInfo,
+    LogWarning,
+    LogError
+};
+
+struct LoggerStats {
+    std::string path;
+    uint64_t written = 0;
+    // Refused by the rate limit, warnings and errors never are
+    uint64_t suppressed = 0;
+    // Lost because the queue was full
+    uint64_t dropped = 0;
+    uint64_t rotations = 0;
+};
+
+// Process-wide logger. Any thread hands fixed-size entries to a lock-free
+// queue without waiting, a background writer formats them in batches to
+// stderr, a size-rotated file and a bounded list of lines for the log view.
+// Debug and info messages go through a rate limit.
+class Logger {
+    public:
+        static constexpr size_t QUEUE_CAPACITY = 2048;
+        // Lines waiting for the view, older ones are dropped beyond this
+        static constexpr size_t VIEW_BACKLOG = 1000;
+
+        static Logger &instance();
+
+        // Also logs to path, rotated to path.1 .. path.<files> past max_bytes
+        bool open_file(const std::string &path, size_t max_bytes = 10 << 20, int files = 3);
+
+        void set_level(LogLevel level) { level_threshold.store(level); }
+        LogLevel level() const { return LogLevel(level_threshold.load()); }
+        bool accepts(LogLevel level) const { return level >= level_threshold.load(std::memory_order_relaxed); }
+
+        // Debug and info messages per second, 0 for no limit
+        void set_rate_limit(int messages_per_second);
+        void set_console(bool enabled) { console.store(enabled); }
+
+        // Never blocks
+        void write(LogLevel level, const char *source, const std::string &message);
+
+        // Formatted lines for the log view since the last call
+        std::vector<std::string> take_view_lines();
+
+        LoggerStats stats() const;
+
+        static const char *level_name(LogLevel level);
+
+    private:
+        struct LogEntry {
+            int64_t time_ns;
+            LogLevel level;
+            char source[16];
+            char text[232];
+        };
+
+        Logger();
+        ~Logger();
+
+        bool rate_allowed();
+        void run();
+        void drain();
+        void format(const LogEntry &entry, std::string &line) const;
+        void rotate();
+
+        MpscQueue<LogEntry, QUEUE_CAPACITY> queue;
+        std::thread writer;
+        std::atomic<bool> running;
+
+        std::atomic<int> level_threshold;
+        std::atomic<bool> console;
+        std::atomic<int64_t> rate_interval_ns;
+        // Theoretical arrival time of the next message, for the rate limit
+        std::atomic<int64_t> rate_next_ns;
+        std::atomic<uint64_t> suppressed;
+
+        // Shared between open_file() and the writer
+        mutable std::mutex file_mutex;
+        FILE *file;
+        std::string path;
+        size_t max_bytes;
+        int max_files;
+        size_t file_bytes;
+
+        mutable std::mutex view_mutex;
+        std::deque<std::string> view_lines;
+
+        // Only touched by the writer
+        uint64_t reported_suppressed;
+        uint64_t reported_dropped;
+
+        std::atomic<uint64_t> written;
+        std::atomic<uint64_t> rotations;
+};
+
+// One message, built with << and handed to the logger when it goes out of scope
+class LogLine {
+    public:
+        LogLine(LogLevel level, const char *source) : level(level), source(source) {}
+        ~LogLine() { Logger::instance().write(level, source, stream.str()); }
+
+        template <typename T>
+        LogLine &operator<<(const T &value) {
+            stream << value;
+            return *this;
+        }
+
+        LogLine &operator<<(const QString &value) {
+            stream << value.toStdString();
+            return *this;
+        }
+
+    private:
+        LogLevel level;
+        const char *source;
+        std::ostringstream stream;
+};
+
+// The message is not even built when its level is filtered out
+#define LOG_AT(level, source) \
+    if (!Logger::instance().accepts(level)) {} else LogLine(level, source)
+
+#define LOG_DEBUG(source) LOG_AT(LogDebug, source)
+#define LOG_INFO(source) LOG_AT(LogInfo, source)
+#define LOG_WARNING(source) LOG_AT(LogWarning, source)
+#define LOG_ERROR(source) LOG_AT(LogError, source)
+
+#endif // LOGGER_H
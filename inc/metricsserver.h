@@ -0,0 +1,82 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum MetricType {
+    MetricCounter,
+    MetricGauge
+};
+
+// One exported sample. set() is a relaxed atomic store from any thread,
+// the server reads whatever value is current when it is scraped.
+class Metric {
+    public:
+        Metric(const std::string &name, MetricType type, const std::string &help, const std::string &labels);
+
+        void set(double value) { current.store(value, std::memory_order_relaxed); }
+        double value() const { return current.load(std::memory_order_relaxed); }
+
+        const std::string name;
+        const MetricType type;
+        const std::string help;
+        // Prometheus label pairs without the braces, e.g. camera="0"
+        const std::string labels;
+
+    private:
+        std::atomic<double> current;
+};
+
+// Serves the registered metrics in the Prometheus text format on
+// http://127.0.0.1:<port>/metrics from its own thread. Registration and
+// the start of a scrape take a lock, updates through a Metric pointer never
+// do, so callers resolve their metrics once and keep the pointers.
+class MetricsServer {
+    public:
+        MetricsServer();
+        ~MetricsServer();
+
+        // Loopback only, port 0 picks a free one
+        bool start(uint16_t port);
+        void stop();
+        bool is_running() const { return running.load(); }
+        uint16_t port() const { return bound_port; }
+        uint64_t scrapes() const { return scrape_count.load(); }
+
+        // The same name and labels give back the same metric, it lives as long
+        // as the server. Meant for setup, not for every update.
+        Metric *metric(const std::string &name, MetricType type, const std::string &help,
+                       const std::string &labels = std::string());
+
+        std::string render() const;
+
+        // Resident set size of this process, 0 when unknown
+        static uint64_t resident_memory_bytes();
+        // Time since the kernel started this process, 0 when unknown
+        static double process_age_ms();
+
+    private:
+        void run();
+        void serve(int client);
+
+        mutable std::mutex registry_mutex;
+        std::vector<std::unique_ptr<Metric>> metrics;
+        // Keyed by name and labels
+        std::map<std::pair<std::string, std::string>, Metric*> index;
+
+        int listen_fd;
+        int wake_fd;
+        uint16_t bound_port;
+        std::thread worker;
+        std::atomic<bool> running;
+        std::atomic<uint64_t> scrape_count;
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,91 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free multi producer / single consumer queue.
+//
+// Every slot carries a sequence number that tells producers whether it is
+// free and the consumer whether it is filled, producers claim slots with a
+// single compare-and-swap on the tail. Neither side ever blocks, a full
+// queue refuses the item and counts it.
+template <typename T, size_t Capacity>
+class MpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+    public:
+        MpscQueue() :
+            m_tail(0),
+            m_head(0),
+            m_dropped(0)
+        {
+            for (size_t i = 0; i < Capacity; i++)
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue &operator=(const MpscQueue&) = delete;
+
+        // Any thread, returns false when the queue is full
+        bool try_push(const T &item) {
+            size_t position = m_tail.load(std::memory_order_relaxed);
+
+            for (;;) {
+                Slot &slot = m_slots[position & MASK];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+                if (difference == 0) {
+                    if (m_tail.compare_exchange_weak(position, position + 1,
+                                                     std::memory_order_relaxed))
+                        break;
+                } else if (difference < 0) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    position = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            Slot &slot = m_slots[position & MASK];
+            slot.value = item;
+            slot.sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer thread only, returns false when empty
+        bool try_pop(T &item) {
+            Slot &slot = m_slots[m_head & MASK];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+            if (intptr_t(sequence) - intptr_t(m_head + 1) < 0)
+                return false;
+
+            item = slot.value;
+            slot.sequence.store(m_head + Capacity, std::memory_order_release);
+            m_head++;
+            return true;
+        }
+
+        size_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr size_t MASK = Capacity - 1;
+
+        struct alignas(64) Slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        Slot m_slots[Capacity];
+        alignas(64) std::atomic<size_t> m_tail;
+        alignas(64) size_t m_head;
+        std::atomic<size_t> m_dropped;
+};
+
+#endif // MPSCQUEUE_H
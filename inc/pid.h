@@ -0,0 +1,29 @@
+#ifndef PID_H
+#define PID_H
+
+// Textbook PID with a clamped output. The integral stops growing while the
+// output is saturated, so it does not wind up when an axis hits its limit.
+class Pid {
+    public:
+        Pid(double kp = 0, double ki = 0, double kd = 0, double limit = 0);
+
+        void set_gains(double kp, double ki, double kd);
+        // 0 leaves the output unclamped
+        void set_output_limit(double limit);
+
+        // dt in seconds, the derivative is skipped on the first update
+        double update(double error, double dt);
+        void reset();
+
+    private:
+        double kp;
+        double ki;
+        double kd;
+        double limit;
+
+        double integral;
+        double previous_error;
+        bool has_previous;
+};
+
+#endif // PID_H
@@ -0,0 +1,76 @@
+#ifndef PREEVENT_H
+#define PREEVENT_H
+
+#include <gst/gst.h>
+
+#include "inc/recorder.h"
+
+#include <QImage>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct PreEventStats {
+    bool running = false;
+    bool exporting = false;
+    size_t frames = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+// Keeps the last seconds of the camera stream as encoded frames, so a clip
+// of what led up to an event can be written out without re-encoding.
+// The ring always starts on a keyframe and is bounded both by its time
+// window and by a byte budget, whichever is hit first.
+class PreEventBuffer {
+    public:
+        // A keyframe per second at the usual rates, the ring's time granularity
+        static constexpr int KEYFRAME_INTERVAL = 30;
+
+        PreEventBuffer();
+        ~PreEventBuffer();
+
+        bool start(RecordingCodec codec, double window_seconds, size_t max_bytes);
+        void stop();
+        bool is_running() const { return encoder.is_recording(); }
+
+        // Never blocks, frames the encoder cannot keep up with are dropped
+        bool submit(const QImage &image, int64_t capture_ns) { return encoder.submit(image, capture_ns); }
+
+        // Writes the ring and the following post_seconds to path, returns at once
+        bool export_clip(const std::string &path, double post_seconds);
+        // What the ring holds and a clip is written in
+        RecordingCodec clip_codec() const;
+
+        PreEventStats stats() const;
+
+    private:
+        void on_encoded(GstSample *sample);
+        void trim();
+        void push_to_export(GstBuffer *buffer);
+        void wait_for_export(GstClockTime tail_timeout);
+
+        RecordingCodec codec;
+
+        mutable std::mutex mutex;
+        std::deque<GstSample*> ring;
+        size_t ring_bytes;
+        GstClockTime window;
+        size_t max_bytes;
+
+        // The clip being written, one at a time
+        GstElement *export_pipeline;
+        GstElement *export_source;
+        GstClockTime export_base;
+        GstClockTime export_end;
+        std::string export_path;
+        std::thread export_worker;
+        std::atomic<bool> exporting;
+
+        Recorder encoder;
+};
+
+#endif // PREEVENT_H
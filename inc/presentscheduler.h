@@ -0,0 +1,96 @@
+#ifndef PRESENTSCHEDULER_H
+#define PRESENTSCHEDULER_H
+
+#include <QImage>
+#include <QtGlobal>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+enum PresentMode {
+    // The newest frame at every refresh, however unevenly it arrived
+    PresentLowestLatency,
+    // Every frame held to the same delay after capture, so the display
+    // follows the capture timing at the cost of that delay
+    PresentSmoothest
+};
+
+struct PresentStats {
+    PresentMode mode = PresentLowestLatency;
+    double refresh_hz = 0;
+    quint64 shown = 0;
+    // Superseded by a newer frame before their refresh came
+    quint64 dropped = 0;
+    // Shown more than a refresh after they were due
+    quint64 late = 0;
+    // Capture to the refresh that showed the frame, over the last LATENCY_SAMPLES frames
+    double latency_p50_ms = 0;
+    double latency_p95_ms = 0;
+    // Smoothed difference between the display and capture intervals of consecutive frames
+    double judder_ms = 0;
+    // Delay after capture the smoothest mode shows frames at
+    double playout_delay_ms = 0;
+};
+
+struct PresentedFrame {
+    QImage image;
+    quint64 sequence = 0;
+    int64_t capture_ns = 0;
+};
+
+// Picks the frame to show at each display refresh from the buffer
+// timestamps, which are on the monotonic clock like FrameTracer::now_ns().
+// Frames wait in a short queue until due and whatever a newer due frame
+// overtakes is dropped there, so a stale frame is never painted late.
+// GUI thread only.
+class PresentScheduler {
+    public:
+        static constexpr size_t MAX_QUEUED = 8;
+        static constexpr size_t LATENCY_SAMPLES = 256;
+        static constexpr double DEFAULT_REFRESH_HZ = 60;
+
+        PresentScheduler();
+
+        void set_mode(PresentMode mode);
+        PresentMode mode() const { return present_mode; }
+        void set_refresh_rate(double hz);
+        int64_t refresh_period_ns() const { return period_ns; }
+
+        // Forgets queued frames and timing, counters are kept
+        void reset();
+
+        // capture_ns is 0 when the buffer had no timestamp
+        void push(const QImage &image, quint64 sequence, int64_t capture_ns, int64_t arrival_ns);
+        // Frame for the refresh at now_ns, false when the one on screen stays
+        bool present(int64_t now_ns, PresentedFrame &frame);
+
+        PresentStats stats() const;
+
+    private:
+        struct Pending {
+            QImage image;
+            quint64 sequence;
+            int64_t capture_ns;
+            int64_t due_ns;
+        };
+
+        PresentMode present_mode;
+        int64_t period_ns;
+        std::deque<Pending> queue;
+
+        // Delay after capture in the smoothest mode, follows the slowest recent arrivals
+        int64_t playout_ns;
+        int64_t last_present_ns;
+        int64_t last_capture_ns;
+        double judder_ns;
+
+        quint64 shown;
+        quint64 dropped;
+        quint64 late;
+        std::array<int64_t, LATENCY_SAMPLES> latencies;
+        size_t latency_count;
+};
+
+#endif // PRESENTSCHEDULER_H
@@ -0,0 +1,133 @@
+#ifndef PROCESSING_H
+#define PROCESSING_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "inc/boundedqueue.h"
+#include "inc/triplebuffer.h"
+#include "inc/frametrace.h"
+
+#include <QObject>
+#include <QImage>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cv;
+
+// Frame travelling through the processing chain. The captured image is
+// only referenced until the first stage takes its working copy.
+struct ProcessingFrame {
+    QImage source;
+    Mat image;
+    Mat edges;
+    std::vector<std::vector<Point>> contours;
+    quint64 sequence = 0;
+    // Buffer timestamp on the monotonic clock, 0 when it had none
+    int64_t capture_ns = 0;
+};
+
+// Output of the last stage, handed to the GUI
+struct ProcessedFrame {
+    QImage image;
+    quint64 sequence = 0;
+    size_t contours = 0;
+};
+
+struct StageStats {
+    std::string name;
+    quint64 processed = 0;
+    quint64 dropped = 0;
+    size_t queued = 0;
+    double last_ms = 0;
+    double average_ms = 0;
+    double max_ms = 0;
+};
+
+// Runs a chain of OpenCV stages on frames taken from the capture path.
+// Every stage has its own worker thread fed by a bounded queue, so neither
+// capture nor display ever waits for analysis: when a stage falls behind,
+// its queue drops frames according to the configured policy.
+class ProcessingEngine : public QObject {
+    Q_OBJECT
+
+    public:
+        typedef std::function<void(ProcessingFrame &)> StageFunction;
+
+        explicit ProcessingEngine(QObject *parent = nullptr);
+        ~ProcessingEngine();
+
+        // Stages can only be registered while the engine is stopped
+        bool add_stage(const std::string &name, StageFunction function);
+        void clear_stages();
+
+        // Deepest queue a stage may have, each queued frame holds a capture buffer
+        static constexpr size_t MAX_QUEUE_CAPACITY = 4;
+
+        void set_drop_policy(DropPolicy policy);
+        // Clamped to 1..MAX_QUEUE_CAPACITY
+        void set_queue_capacity(size_t capacity);
+
+        // Finished frames are marked TRACE_PROCESSED, set before start()
+        void set_tracer(FrameTracer *tracer) { this->tracer = tracer; }
+
+        // Sees every finished frame with its capture time on the last
+        // worker, must not block
+        typedef std::function<void(const QImage &, quint64, int64_t)> ResultSink;
+        void set_result_sink(ResultSink sink) { result_sink = sink; }
+
+        void start();
+        void stop();
+        bool is_running() const { return running.load(); }
+
+        // Never blocks, called from the streaming thread
+        bool submit(const QImage &image, quint64 sequence, int64_t capture_ns);
+
+        ProcessedFrame pull_result();
+        std::vector<StageStats> stage_stats() const;
+
+    signals:
+        // Coalesced like GstreamerCameraCapture::frameReady
+        void resultReady(quint64 sequence);
+
+    private:
+        struct Stage {
+            std::string name;
+            StageFunction function;
+            BoundedQueue<std::unique_ptr<ProcessingFrame>> input;
+            std::thread worker;
+
+            std::atomic<quint64> processed{0};
+            std::atomic<double> last_ms{0};
+            std::atomic<double> average_ms{0};
+            std::atomic<double> max_ms{0};
+
+            Stage(const std::string &name, StageFunction function) :
+                name(name),
+                function(function)
+            {}
+        };
+
+        void run_stage(size_t index);
+        void publish(std::unique_ptr<ProcessingFrame> frame);
+
+        std::vector<std::unique_ptr<Stage>> stages;
+        DropPolicy drop_policy;
+        size_t queue_capacity;
+
+        std::atomic<bool> running;
+        std::atomic<bool> signal_pending;
+        TripleBuffer<ProcessedFrame> results;
+        FrameTracer *tracer;
+        ResultSink result_sink;
+};
+
+// The analysis chain that used to live in GstreamerCameraCapture::process_frame
+void register_default_stages(ProcessingEngine &engine);
+
+#endif // PROCESSING_H
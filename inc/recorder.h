@@ -0,0 +1,103 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <gst/gst.h>
+
+#include "inc/boundedqueue.h"
+
+#include <QImage>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Which frames end up in the file
+enum RecordingSource {
+    RecordRaw,          // the camera stream as displayed
+    RecordProcessed     // output of the processing engine
+};
+
+enum RecordingCodec {
+    RecordH264Mp4,      // x264enc ! mp4mux
+    RecordMjpegAvi      // jpegenc ! avimux
+};
+
+struct RecordingStats {
+    bool active = false;
+    std::string path;
+    quint64 submitted = 0;
+    quint64 written = 0;
+    quint64 dropped = 0;
+};
+
+// Encodes frames into a file on its own thread through
+// appsrc ! videoconvert ! videoscale ! capsfilter ! encoder ! mux ! filesink.
+// submit() only queues a reference, when the encoder falls behind the
+// queue drops frames instead of ever holding up the caller.
+class Recorder {
+    public:
+        // Frames queued for encoding, each one may hold a capture pool buffer
+        static constexpr size_t QUEUE_CAPACITY = 2;
+
+        // Receives every encoded frame on the encoder's streaming thread
+        typedef std::function<void(GstSample *sample)> EncodedSink;
+
+        Recorder();
+        ~Recorder();
+
+        bool start(const std::string &path, RecordingCodec codec);
+        // Same encoder, but frames go to the sink instead of a muxer. H.264
+        // samples are AVC access units with a keyframe every keyframe_interval.
+        bool start_encoded(RecordingCodec codec, int keyframe_interval, EncodedSink sink);
+        // Returns at once, the file is finalised by the worker
+        void stop();
+        // Blocks until a stopped recorder's worker has finished
+        void wait();
+        bool is_recording() const { return recording.load(); }
+
+        // capture_ns is the frame's buffer timestamp on the monotonic clock,
+        // the time of submission stands in when it is 0
+        bool submit(const QImage &image, int64_t capture_ns);
+
+        RecordingStats stats() const;
+
+    private:
+        struct RecordFrame {
+            QImage image;
+            int64_t time_ns = 0;
+        };
+
+        bool start_worker();
+        void run();
+        bool create_pipeline(const QImage &first);
+        bool check_bus();
+        void finish_pipeline();
+
+        RecordingCodec codec;
+        std::string path;
+        EncodedSink encoded_sink;
+        int keyframe_interval;
+
+        BoundedQueue<RecordFrame> queue;
+        std::thread worker;
+        std::atomic<bool> recording;
+
+        // Only touched by the worker
+        GstElement *pipeline;
+        GstElement *source;
+        GstCaps *caps;
+        int caps_width;
+        int caps_height;
+        int64_t first_time_ns;
+
+        std::atomic<quint64> submitted;
+        std::atomic<quint64> written;
+        std::atomic<quint64> skipped;
+        quint64 dropped_base;
+
+        friend GstFlowReturn encoded_sample_callback(GstElement *sink, gpointer data);
+};
+
+#endif // RECORDER_H
@@ -0,0 +1,226 @@
+#ifndef SHAREDFRAMES_H
+#define SHAREDFRAMES_H
+
+// Layout of the shared-memory frame ring and a header-only reader for it.
+// Needs nothing but C++17 and POSIX, so analysis processes can include it
+// as is and link with -lrt where shm_open lives in librt.
+//
+// The ring is one POSIX shared-memory object: a SharedFrameHeader followed
+// by slot_count slots of slot_stride bytes, each a SharedFrameSlot and its
+// pixels. The single writer fills slot (frame % slot_count) under a
+// per-slot seqlock, odd while it writes and even once the frame is
+// complete, then stores the frame number in latest. Readers map the pixels
+// in place and check afterwards that the slot was not rewritten meanwhile,
+// nobody ever waits for anybody.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t SHARED_FRAMES_MAGIC = 0x52464351; // "QCFR"
+static const uint32_t SHARED_FRAMES_VERSION = 1;
+
+// Byte order of the pixels in memory
+enum SharedFrameFormat {
+    SHARED_FRAME_UNKNOWN = 0,
+    SHARED_FRAME_RGB = 1,
+    SHARED_FRAME_BGR = 2,
+    SHARED_FRAME_RGBX = 3,
+    SHARED_FRAME_RGBA = 4,
+    SHARED_FRAME_BGRX = 5,
+    SHARED_FRAME_BGRA = 6,
+    SHARED_FRAME_GRAY8 = 7
+};
+
+struct alignas(64) SharedFrameHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_stride;
+    // Pixel bytes a slot can hold
+    uint64_t slot_capacity;
+    // Newest complete frame, 0 before the first one
+    std::atomic<uint64_t> latest;
+    // Set when the writer is done with the ring, a new one has to be opened
+    std::atomic<uint64_t> closed;
+};
+
+struct alignas(64) SharedFrameSlot {
+    // Seqlock word, odd while the writer fills the slot
+    std::atomic<uint64_t> lock;
+    uint64_t frame;
+    // Capture time on CLOCK_MONOTONIC, 0 when unknown
+    int64_t capture_ns;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint64_t size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the ring needs address-free 64-bit atomics");
+
+// Offset of the pixels inside a slot
+static const size_t SHARED_FRAME_DATA_OFFSET = sizeof(SharedFrameSlot);
+
+// One frame mapped in place. The pixels stay readable after the writer
+// moves on, only their content may change, so check still_valid() once
+// done with them.
+struct SharedFrameView {
+    uint64_t frame = 0;
+    int64_t capture_ns = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;
+    SharedFrameFormat format = SHARED_FRAME_UNKNOWN;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    // Frames that were overwritten before this reader got to them
+    uint64_t lapped = 0;
+
+    // The slot's seqlock word when the view was taken
+    const SharedFrameSlot *slot = nullptr;
+    uint64_t lock = 0;
+};
+
+class SharedFrameReader {
+    public:
+        SharedFrameReader() : header(nullptr), mapped(nullptr), mapped_size(0), last_frame(0) {}
+        ~SharedFrameReader() { this->close(); }
+
+        SharedFrameReader(const SharedFrameReader&) = delete;
+        SharedFrameReader &operator=(const SharedFrameReader&) = delete;
+
+        // The name given to the writer, e.g. "/qt-cam-capture"
+        bool open(const std::string &name) {
+            this->close();
+
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0) {
+                return false;
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(SharedFrameHeader)) {
+                ::close(fd);
+                return false;
+            }
+
+            void *memory = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (memory == MAP_FAILED) {
+                return false;
+            }
+
+            const SharedFrameHeader *candidate = static_cast<const SharedFrameHeader*>(memory);
+            if (candidate->magic != SHARED_FRAMES_MAGIC || candidate->version != SHARED_FRAMES_VERSION ||
+                candidate->slot_count == 0 ||
+                sizeof(SharedFrameHeader) + size_t(candidate->slot_count) * candidate->slot_stride > size_t(info.st_size)) {
+                munmap(memory, size_t(info.st_size));
+                return false;
+            }
+
+            mapped = memory;
+            mapped_size = size_t(info.st_size);
+            header = candidate;
+            last_frame = 0;
+            return true;
+        }
+
+        void close() {
+            if (mapped) {
+                munmap(mapped, mapped_size);
+            }
+            mapped = nullptr;
+            mapped_size = 0;
+            header = nullptr;
+        }
+
+        bool is_open() const { return header != nullptr; }
+        uint64_t latest() const { return header ? header->latest.load(std::memory_order_acquire) : 0; }
+        // The writer stopped or restarted, reopen by name to follow it
+        bool writer_closed() const { return header && header->closed.load(std::memory_order_acquire) != 0; }
+
+        // Newest frame, false when there is none newer than the last one read
+        bool acquire_latest(SharedFrameView &view) {
+            return header && this->acquire(header->latest.load(std::memory_order_acquire), view);
+        }
+
+        // The frame after the last one read, or the oldest one still in the
+        // ring when this reader was lapped, with view.lapped saying how many
+        // were lost. False when the reader is already at the newest frame.
+        bool acquire_next(SharedFrameView &view) {
+            if (!header) {
+                return false;
+            }
+
+            uint64_t newest = header->latest.load(std::memory_order_acquire);
+            uint64_t next = last_frame + 1;
+            // The slot of the oldest frame may be the one being rewritten
+            uint64_t oldest = (newest > header->slot_count) ? newest - header->slot_count + 2 : 1;
+            if (next < oldest) {
+                next = oldest;
+            }
+
+            return next <= newest && this->acquire(next, view);
+        }
+
+        // Whether the writer left the view's slot alone since it was taken
+        bool still_valid(const SharedFrameView &view) const {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return view.slot && view.slot->lock.load(std::memory_order_relaxed) == view.lock;
+        }
+
+    private:
+        bool acquire(uint64_t frame, SharedFrameView &view) {
+            if (frame == 0 || frame <= last_frame) {
+                return false;
+            }
+
+            const SharedFrameSlot *slot = reinterpret_cast<const SharedFrameSlot*>(
+                reinterpret_cast<const uint8_t*>(header) + sizeof(SharedFrameHeader) +
+                size_t(frame % header->slot_count) * header->slot_stride);
+
+            uint64_t lock = slot->lock.load(std::memory_order_acquire);
+            if (lock & 1) {
+                return false;
+            }
+
+            SharedFrameView candidate;
+            candidate.frame = slot->frame;
+            candidate.capture_ns = slot->capture_ns;
+            candidate.width = slot->width;
+            candidate.height = slot->height;
+            candidate.stride = slot->stride;
+            candidate.format = SharedFrameFormat(slot->format);
+            candidate.size = size_t(slot->size);
+            candidate.data = reinterpret_cast<const uint8_t*>(slot) + SHARED_FRAME_DATA_OFFSET;
+            candidate.slot = slot;
+            candidate.lock = lock;
+
+            // Rewritten while the fields were read, or already holding a later frame
+            if (!this->still_valid(candidate) || candidate.frame != frame ||
+                candidate.size > header->slot_capacity) {
+                return false;
+            }
+
+            candidate.lapped = (frame > last_frame + 1 && last_frame != 0) ? frame - last_frame - 1 : 0;
+            last_frame = frame;
+            view = candidate;
+            return true;
+        }
+
+        const SharedFrameHeader *header;
+        void *mapped;
+        size_t mapped_size;
+        uint64_t last_frame;
+};
+
+#endif // SHAREDFRAMES_H
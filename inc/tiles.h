@@ -0,0 +1,33 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "inc/workstealingpool.h"
+
+#include <functional>
+
+using namespace cv;
+
+// Applies a neighbourhood operation band by band across the pool.
+// Each band is handed to op with `halo` extra rows above and below (less
+// at the image edges), and only its own rows are kept, so as long as the
+// halo covers the kernel radius the result is bit-identical to running
+// op on the whole frame. dst must already have its final size and type.
+typedef std::function<void(const Mat &src, Mat &dst)> BandOperation;
+
+void parallel_bands(WorkStealingPool &pool, const Mat &src, Mat &dst,
+                    int halo, const BandOperation &op);
+
+// Tiled versions of the local operations used by the processing stages.
+// Global ones (Canny hysteresis, findContours) cannot be split this way.
+void tiled_gaussian_blur(WorkStealingPool &pool, const Mat &src, Mat &dst,
+                         Size ksize, double sigma);
+void tiled_cvt_color(WorkStealingPool &pool, const Mat &src, Mat &dst, int code);
+
+// Times the tiled blur from 1 to N threads at 720p and 1080p against the
+// plain single-threaded OpenCV call, prints a table, false on any mismatch
+bool run_tile_benchmark(unsigned max_threads, int iterations);
+
+#endif // TILES_H
@@ -0,0 +1,134 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "inc/boundedqueue.h"
+#include "inc/pid.h"
+
+#include <QObject>
+#include <QImage>
+#include <QRectF>
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+using namespace cv;
+
+// Normalised cross-correlation tracker. The template and the search window
+// around the last position are both downscaled so the template's longest
+// side is TEMPLATE_SIZE pixels, whatever the frame resolution.
+class TemplateTracker {
+    public:
+        static constexpr int TEMPLATE_SIZE = 48;
+        // Below this the target is considered lost
+        static constexpr double MIN_SCORE = 0.5;
+
+        TemplateTracker();
+
+        // frame is RGB, target in its pixel coordinates
+        bool init(const Mat &frame, const Rect &target);
+        bool update(const Mat &frame, Rect2f &target, double &score);
+
+        bool is_initialized() const { return !templ.empty(); }
+        void reset();
+
+    private:
+        Mat prepare(const Mat &frame, const Rect &area) const;
+
+        Mat templ;
+        double scale;
+        Rect2f box;
+};
+
+struct TrackingStats {
+    bool running = false;
+    bool locked = false;
+    double score = 0;
+    quint64 frames = 0;
+    quint64 late = 0;
+    // Superseded in the queue by a newer frame before the worker took them
+    quint64 replaced = 0;
+    double last_ms = 0;
+    double average_ms = 0;
+    double max_ms = 0;
+    // Between frame arrivals, whether or not the worker kept up
+    double frame_period_ms = 0;
+};
+
+// Follows an operator-selected target and turns its offset from the image
+// centre into axis positions through one PID per axis. Runs on its own
+// thread fed with the newest frame only, and measures the time from frame
+// arrival to the axis command against the observed frame period.
+class TrackingLoop : public QObject {
+    Q_OBJECT
+
+    public:
+        // Only the newest frame waits for the worker
+        static constexpr size_t QUEUE_CAPACITY = 1;
+
+        explicit TrackingLoop(QObject *parent = nullptr);
+        ~TrackingLoop();
+
+        // Starts from the current axis positions
+        void start(double x, double y);
+        void stop();
+        bool is_running() const { return running.load(); }
+
+        // Normalised to the frame, picked up with the next frame
+        void select_target(const QRectF &target);
+        void clear_target();
+
+        // Never blocks, called from the streaming thread
+        bool submit(const QImage &image, quint64 sequence);
+
+        TrackingStats stats() const;
+
+    signals:
+        void axesCommanded(double x, double y);
+        void targetUpdated(QRectF target, bool locked);
+
+    private:
+        struct TrackingFrame {
+            QImage image;
+            quint64 sequence = 0;
+            int64_t time_ns = 0;
+        };
+
+        void run();
+        void track(TrackingFrame &frame, double dt);
+
+        BoundedQueue<TrackingFrame> queue;
+        std::thread worker;
+        std::atomic<bool> running;
+
+        std::mutex target_mutex;
+        std::optional<QRectF> pending_target;
+        bool target_cleared;
+
+        // Only touched by the worker
+        TemplateTracker tracker;
+        Pid x_pid;
+        Pid y_pid;
+        double x_position;
+        double y_position;
+        int64_t last_frame_ns;
+
+        // Only touched by the streaming thread
+        int64_t last_submit_ns;
+
+        std::atomic<bool> locked;
+        std::atomic<double> score;
+        std::atomic<quint64> frames;
+        std::atomic<quint64> late;
+        std::atomic<quint64> replaced;
+        std::atomic<double> last_ms;
+        std::atomic<double> average_ms;
+        std::atomic<double> max_ms;
+        std::atomic<double> frame_period_ms;
+};
+
+#endif // TRACKER_H
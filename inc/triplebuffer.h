@@ -0,0 +1,73 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Wait-free single producer / single consumer triple buffer.
+//
+// The producer fills write_slot() and publishes it, the consumer calls
+// update() and reads read_slot(). Each side owns one slot, the third one
+// is exchanged through a single atomic word, so neither side ever waits
+// for the other and the consumer always sees the newest published value.
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() :
+            m_state(1),
+            m_back(0),
+            m_front(2)
+        {}
+
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer &operator=(const TripleBuffer&) = delete;
+
+        // Producer side
+        T &write_slot() {
+            return m_slots[m_back].value;
+        }
+
+        void publish() {
+            unsigned previous = m_state.exchange(m_back | DIRTY, std::memory_order_acq_rel);
+            m_back = previous & INDEX_MASK;
+        }
+
+        // Consumer side, returns true when a newer slot was picked up
+        bool update() {
+            if (!(m_state.load(std::memory_order_relaxed) & DIRTY))
+                return false;
+
+            unsigned previous = m_state.exchange(m_front, std::memory_order_acq_rel);
+            m_front = previous & INDEX_MASK;
+            return true;
+        }
+
+        T &read_slot() {
+            return m_slots[m_front].value;
+        }
+
+        // Consumer side, resets the consumer's slot and the one waiting in
+        // the middle, anything published there is dropped. The producer's
+        // slot is only ever touched by the producer.
+        void drain() {
+            m_slots[m_front].value = T();
+            unsigned previous = m_state.exchange(m_front, std::memory_order_acq_rel);
+            m_front = previous & INDEX_MASK;
+            m_slots[m_front].value = T();
+        }
+
+    private:
+        static constexpr unsigned INDEX_MASK = 0x3;
+        static constexpr unsigned DIRTY = 0x4;
+
+        // Keep every slot and the index word on their own cache lines
+        struct alignas(64) Slot {
+            T value;
+        };
+
+        Slot m_slots[3];
+        alignas(64) std::atomic<unsigned> m_state;
+        alignas(64) unsigned m_back;
+        alignas(64) unsigned m_front;
+};
+
+#endif // TRIPLEBUFFER_H
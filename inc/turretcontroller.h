@@ -0,0 +1,118 @@
+#ifndef TURRETCONTROLLER_H
+#define TURRETCONTROLLER_H
+
+#include "inc/mpscqueue.h"
+#include "inc/triplebuffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+enum TurretCommandType {
+    TurretJog,              // x, y are directions in -1, 0, 1
+    TurretMoveTo,           // x, y are absolute positions
+    TurretHalt,             // decelerate to a standstill
+    TurretSetSpeed,         // x is the top speed, units per second
+    TurretSetAcceleration,  // x is the acceleration, units per second squared
+    TurretSetRate           // x is the loop rate in Hz
+};
+
+struct TurretCommand {
+    TurretCommandType type = TurretHalt;
+    double x = 0;
+    double y = 0;
+};
+
+// Published by the control thread after every tick
+struct TurretState {
+    double x = 0;
+    double y = 0;
+    double x_velocity = 0;
+    double y_velocity = 0;
+    bool moving = false;
+
+    int rate_hz = 0;
+    uint64_t ticks = 0;
+    // Wake-up lateness against the deadline, over the last second
+    double jitter_average_us = 0;
+    double jitter_max_us = 0;
+    // Since start
+    double jitter_peak_us = 0;
+    uint64_t overruns = 0;
+    uint64_t commands_dropped = 0;
+};
+
+// Runs the turret axes on a dedicated thread paced by absolute deadlines on
+// the monotonic clock. Commands from any thread go through a lock-free
+// queue, the axes follow them with limited acceleration and speed, and the
+// resulting state is published for display without ever waiting.
+class TurretController {
+    public:
+        // Axis travel, the range of the turret position bars
+        static constexpr double AXIS_LIMIT = 100.0;
+        static constexpr int DEFAULT_RATE_HZ = 500;
+
+        explicit TurretController(int rate_hz = DEFAULT_RATE_HZ);
+        ~TurretController();
+
+        // Receives the axis positions after every tick on the control
+        // thread, must not block. Set before start()
+        typedef std::function<void(double, double)> OutputSink;
+        void set_output_sink(OutputSink sink) { output_sink = sink; }
+
+        void start();
+        void stop();
+        bool is_running() const { return running.load(); }
+
+        // Any thread, never blocks, false when the command queue is full
+        bool submit(const TurretCommand &command);
+        bool jog(int x_direction, int y_direction);
+        bool move_to(double x, double y);
+        bool halt();
+        bool set_speed(double units_per_second);
+        bool set_acceleration(double units_per_second2);
+        bool set_rate(int hz);
+
+        // Single reader, the GUI thread
+        const TurretState &state();
+
+    private:
+        struct Axis {
+            double position = 0;
+            double velocity = 0;
+            double target = 0;
+            int direction = 0;
+        };
+
+        void run();
+        void apply(const TurretCommand &command);
+        void step(Axis &axis, double dt);
+        void publish(double lateness_us);
+
+        MpscQueue<TurretCommand, 256> commands;
+        TripleBuffer<TurretState> states;
+        std::thread worker;
+        std::atomic<bool> running;
+        OutputSink output_sink;
+
+        // Only touched by the control thread once started
+        Axis x_axis;
+        Axis y_axis;
+        bool position_mode;
+        double max_speed;
+        double acceleration;
+        int rate_hz;
+        int64_t period_ns;
+
+        uint64_t ticks;
+        uint64_t overruns;
+        double jitter_sum_us;
+        double jitter_window_max_us;
+        double jitter_peak_us;
+        int jitter_samples;
+        double jitter_average_us;
+        double jitter_max_us;
+};
+
+#endif // TURRETCONTROLLER_H
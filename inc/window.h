@@ -2,6 +2,12 @@
 #define WINDOW_H
 
 #include "inc/gstreamer.h"
+#include "inc/framewidget.h"
+#include "inc/turretcontroller.h"
+#include "inc/actuatorlink.h"
+#include "inc/logger.h"
+#include "inc/metricsserver.h"
+#include "inc/presentscheduler.h"
 
 #include <QMainWindow>
 #include <QCamera>
@@ -14,13 +20,18 @@
 #include <QTabWidget>
 #include <QBoxLayout>
 #include <QGroupBox>
-#include <QMutex>
 #include <QSlider>
 #include <QLabel>
 #include <QPixmap>
 #include <QImage>
+#include <QElapsedTimer>
 
+#include <array>
+#include <map>
+
+class QComboBox;
 class QPushButton;
+class QTimer;
 class QKeyEvent;
 
 class Window : public QMainWindow
@@ -28,7 +39,18 @@ class Window : public QMainWindow
     Q_OBJECT
 
 public:
-    explicit Window(QWidget *parent = nullptr);
+    // One capture per source, the first is the primary camera that settings,
+    // analysis and recording apply to, all of them are shown in a grid
+    // The axis setpoints are streamed to actuatorPath when one is given,
+    // the counters served on 127.0.0.1:metricsPort when it is not 0, and
+    // the frames exported to the shared-memory ring exportName when set
+    explicit Window(const std::vector<CaptureSource> &sources = { CaptureSource() },
+                    ConvertBackend backend = VideoConvert,
+                    const QString &actuatorPath = QString(),
+                    quint16 metricsPort = 0,
+                    const QString &exportName = QString(),
+                    QWidget *parent = nullptr);
+    ~Window();
 
 signals:
 
@@ -38,6 +60,23 @@ private slots:
     void setZoom(int val);
     void setCameraFocus(int val);
     void updateFrame();
+    void presentFrame();
+    void updateCameraFrame(size_t index);
+    void updateProcessedFrame();
+    void updateProcessingStats();
+    void updateLatencyStats();
+    void dumpLatencyTrace();
+    void setRecording(bool checked);
+    void updateRecordingStats();
+    void exportEventClip();
+    void updateTrackingStats();
+    void updateTurretStats();
+    void flushLogView();
+    void updateLoggerStats();
+    void publishMetrics();
+    void updateBackpressureStats();
+    void applyCameraControls();
+    void cameraPrepared(size_t index, bool ok);
 
 protected:
     void keyPressEvent(QKeyEvent *event) override;
@@ -46,6 +85,7 @@ protected:
 private:
     // UI setup methods
     void setupUI();
+    void setupMetrics();
     void setupMainTab();
     void setupLogTab();
     void setupSettingsTab();
@@ -56,13 +96,22 @@ private:
     void setupZoomAndFocusControl(QSlider *zoomSlider, QSlider *foucsSlider);
     void setupSettingsBoxes(QBoxLayout *mainLayout);
     void setupTurretSettingsBox(QGroupBox *settingsBox);
+    void setupCameraSettingsBox(QGroupBox *settingsBox);
+    void setupProcessingSettingsBox(QGroupBox *settingsBox);
+    void setupLoggerSettingsBox(QGroupBox *settingsBox);
+    void setupAppSettingsBox(QGroupBox *settingsBox);
     void setupConnections();
 
     // Help methods
     void getCameraFeatures();
+    void sendJog();
 
     // Setters
     void setSpeed(int val);
+    void setCameraMode(int index);
+    void setProcessingEnabled(bool enabled);
+    void setPreEventEnabled(bool enabled);
+    void setTrackingEnabled(bool enabled);
 
     // UI components
     QTabWidget* m_tabWidget;
@@ -71,15 +120,117 @@ private:
     QWidget* m_settingsTab;
     
     QPushButton* m_captureButton;
+    QPushButton* m_recordButton;
     QProgressBar* m_xProgressBar;
     QProgressBar* m_yProgressBar;
     QPlainTextEdit* m_logTextEdit;
     
     // Camera components
+    std::vector<GstreamerCameraCapture*> m_cameras;
+    std::vector<FrameWidget*> m_frameDisplays;
+    std::vector<quint64> m_cameraSequences;
+    std::vector<quint64> m_cameraDelivered;
+    QLabel *m_cameraStatsLabel;
     GstreamerCameraCapture *camera;
-    QPixmap frame;
-    QLabel *frameDisplayLabel;
-    QTimer *frameTimer;
+    FrameWidget *frameDisplay;
+    quint64 m_lastFrameSequence;
+    // The primary camera's frames are shown by refresh, paced by their timestamps
+    PresentScheduler m_presenter;
+    // Single shot, re-armed for the next refresh deadline on the monotonic clock
+    QTimer *m_presentTimer;
+    int64_t m_nextRefreshNs;
+    quint64 m_lastProcessedSequence;
+    bool m_showProcessed;
+    QLabel *m_processingStatsLabel;
+    QLabel *m_latencyStatsLabel;
+    std::vector<VideoMode> m_cameraModes;
+    // Filled once the primary camera has been probed
+    QComboBox *m_modeSelect;
+    RecordingSource m_recordingSource;
+    RecordingCodec m_recordingCodec;
+    bool m_preEventEnabled;
+    int m_preEventSeconds;
+    int m_postEventSeconds;
+    int m_preEventBudgetMb;
+    QLabel *m_preEventStatsLabel;
+    QLabel *m_backpressureStatsLabel;
+    // Slider moves are collected and applied together a few times a second
+    QTimer *m_controlTimer;
+    int m_pendingZoom;
+    int m_pendingFocus;
+    bool m_trackingEnabled;
+    QLabel *m_trackingStatsLabel;
+    QLabel *m_turretStatsLabel;
+    QLabel *m_loggerStatsLabel;
+
+    // Sampled from the same counters as the labels, whether or not anyone looks at them
+    MetricsServer m_metrics;
+    QElapsedTimer m_metricsClock;
+    std::vector<quint64> m_metricsDelivered;
+
+    // Resolved by setupMetrics(), a tick only sets values. Those of
+    // optional features are resolved when the feature first shows up.
+    struct CameraMetrics {
+        Metric *fps;
+        Metric *received;
+        Metric *delivered;
+        Metric *refused;
+        Metric *appsinkDropped;
+        Metric *qosDropped;
+        Metric *ptsGaps;
+        Metric *framesMissing;
+        Metric *stalls;
+        Metric *stalled;
+        Metric *errors;
+        Metric *restarts;
+        Metric *poolExhausted;
+        Metric *prepareMs;
+        Metric *firstFrameMs;
+        Metric *standbyMode;
+        Metric *degradeLevel;
+        Metric *controlsApplied;
+        Metric *controlsCoalesced;
+        Metric *exportFrames;
+        Metric *exportSkipped;
+    };
+    std::vector<CameraMetrics> m_cameraMetrics;
+    // p50, p95 and p99 of each trace step, processed, dropped and average of each stage
+    std::map<std::string, std::array<Metric*, 3>> m_latencyMetrics;
+    std::map<std::string, std::array<Metric*, 3>> m_stageMetrics;
+    struct {
+        Metric *recordingDropped;
+        Metric *trackingLocked;
+        Metric *trackingLatency;
+        Metric *turretTicks;
+        Metric *turretJitterAverage;
+        Metric *turretJitterMax;
+        Metric *turretOverruns;
+        Metric *turretCommandsDropped;
+        Metric *actuatorTimeouts;
+        Metric *actuatorRtt;
+        Metric *displayShown;
+        Metric *displayDropped;
+        Metric *displayLate;
+        Metric *displayLatencyP50;
+        Metric *displayLatencyP95;
+        Metric *displayJudder;
+        Metric *displayPlayout;
+        Metric *startupWindow;
+        Metric *startupCameras;
+        Metric *logSuppressed;
+        Metric *logDropped;
+        Metric *residentMemory;
+    } m_appMetrics;
+
+    // Since process start, 0 until reached
+    double m_windowShownMs;
+    double m_camerasReadyMs;
+    size_t m_camerasPrepared;
+
+    // Fed by the controller, so it has to outlive it
+    ActuatorLink m_actuator;
+    // Moves the axes on its own thread, the GUI only sends input and shows the state
+    TurretController m_turret;
 
     // State variables
     int m_buttonPressCounter;
@@ -93,9 +244,6 @@ private:
         bool up;
         bool down;
     } m_keyStates;
-
-    // Synchronization primitives
-    mutable QMutex m_logMutex;
 };
 
 #endif // WINDOW_H
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. Owners pop
+// from the back of their deque, idle workers steal from the front of the
+// others. run() spreads a batch over the deques and the calling thread
+// helps until the batch is done, so batches can be issued from several
+// threads (e.g. processing stages) at once.
+class WorkStealingPool {
+    public:
+        // threads is the total parallelism including the calling thread
+        explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency());
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool &operator=(const WorkStealingPool&) = delete;
+
+        unsigned size() const { return unsigned(workers.size()) + 1; }
+
+        // Calls task(i) for every i in [0, count) and returns once all are done
+        void run(size_t count, const std::function<void(size_t)> &task);
+
+        // Pool shared by the processing stages, sized to the machine
+        static WorkStealingPool &shared();
+
+    private:
+        struct Batch {
+            const std::function<void(size_t)> *task;
+            std::atomic<size_t> remaining;
+        };
+
+        struct Task {
+            Batch *batch;
+            size_t index;
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            std::thread thread;
+        };
+
+        void worker_loop(size_t self);
+        bool pop_local(size_t self, Task &task);
+        bool steal(size_t thief, Task &task);
+        void execute(const Task &task);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::atomic<size_t> pending;
+        bool stopping;
+};
+
+#endif // WORKSTEALINGPOOL_H
@@ -1,16 +1,8 @@
-QT += core gui multimedia multimediawidgets
+include(common.pri)
 
-CONFIG += c++17
-CONFIG += link_pkgconfig
-PKGCONFIG += opencv4
-PKGCONFIG += gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0
+QT += multimedia multimediawidgets
 
 TARGET = prog
 TEMPLATE = app
-SOURCES += ../src/*
-HEADERS += ../inc/*
-
-OBJECTS_DIR = obj
-MOC_DIR = moc
-UI_DIR = ui
-RCC_DIR = rcc
+SOURCES += $$GUI_SOURCES
+HEADERS += $$GUI_HEADERS
@@ -0,0 +1,385 @@
+#include "inc/actuatorlink.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const uint8_t FRAME_START = 0xA5;
+// Start, type, sequence, length, CRC
+static const size_t FRAME_OVERHEAD = 6;
+
+static int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint8_t crc8(const uint8_t *data, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? uint8_t((crc << 1) ^ 0x07) : uint8_t(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static bool make_raw(int fd) {
+    struct termios options;
+    if (tcgetattr(fd, &options) != 0) {
+        return false;
+    }
+
+    cfmakeraw(&options);
+    cfsetispeed(&options, B115200);
+    cfsetospeed(&options, B115200);
+    return tcsetattr(fd, TCSANOW, &options) == 0;
+}
+
+ActuatorLink::ActuatorLink() :
+    fd(-1),
+    slave_fd(-1),
+    wake_fd(-1),
+    running(false),
+    setpoint(0),
+    setpoint_generation(0),
+    sent_generation(0),
+    last_sent_setpoint(0),
+    have_sent(false),
+    next_sequence(0),
+    tx_sequence(0),
+    tx_offset(0)
+{
+}
+
+ActuatorLink::~ActuatorLink() {
+    this->close();
+}
+
+bool ActuatorLink::open(const std::string &path) {
+    if (running.load()) {
+        return false;
+    }
+
+    std::string device = path;
+
+    if (path == "pty") {
+        fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+            LOG_ERROR("actuator") << "Failed to create actuator pty: " << strerror(errno);
+            this->close();
+            return false;
+        }
+
+        device = ptsname(fd);
+        slave_fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        // No echo or line editing of the binary frames on the device side
+        if (slave_fd < 0 || !make_raw(slave_fd)) {
+            LOG_ERROR("actuator") << "Failed to open actuator pty " << device;
+            this->close();
+            return false;
+        }
+
+        LOG_INFO("actuator") << "Actuator pty: " << device;
+    } else {
+        fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0) {
+            LOG_ERROR("actuator") << "Failed to open actuator " << path << ": " << strerror(errno);
+            return false;
+        }
+        if (isatty(fd) && !make_raw(fd)) {
+            LOG_WARNING("actuator") << "Failed to configure actuator " << path;
+        }
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        this->close();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        counters = ActuatorStats();
+        counters.path = device;
+        counters.connected = true;
+    }
+
+    setpoint_generation = 0;
+    sent_generation = 0;
+    have_sent = false;
+    tx.clear();
+    tx_offset = 0;
+    rx.clear();
+    in_flight.clear();
+
+    running.store(true);
+    worker = std::thread(&ActuatorLink::run, this);
+
+    return true;
+}
+
+void ActuatorLink::close() {
+    if (running.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The thread still sees the flag on its next poll timeout
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    for (int *descriptor : { &fd, &slave_fd, &wake_fd }) {
+        if (*descriptor >= 0) {
+            ::close(*descriptor);
+            *descriptor = -1;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.connected = false;
+}
+
+void ActuatorLink::submit(double x, double y) {
+    if (!running.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    int16_t x_value = int16_t(std::clamp(std::lround(x * 100.0), -32768L, 32767L));
+    int16_t y_value = int16_t(std::clamp(std::lround(y * 100.0), -32768L, 32767L));
+    uint64_t packed = uint64_t(uint16_t(x_value)) | (uint64_t(uint16_t(y_value)) << 32);
+
+    if (setpoint_generation.load(std::memory_order_relaxed) != 0 &&
+        setpoint.load(std::memory_order_relaxed) == packed) {
+        return;
+    }
+
+    setpoint.store(packed, std::memory_order_relaxed);
+    setpoint_generation.fetch_add(1, std::memory_order_release);
+
+    // An eventfd write never blocks, a saturated counter just fails
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // Already signalled
+    }
+}
+
+bool ActuatorLink::fill_frame() {
+    uint64_t generation = setpoint_generation.load(std::memory_order_acquire);
+    if (generation == 0 || (generation == sent_generation && have_sent) ||
+        int(in_flight.size()) >= MAX_IN_FLIGHT) {
+        return false;
+    }
+
+    uint64_t value = setpoint.load(std::memory_order_relaxed);
+    uint64_t skipped = (generation > sent_generation + 1) ? generation - sent_generation - 1 : 0;
+    sent_generation = generation;
+
+    if (have_sent && value == last_sent_setpoint) {
+        return false;
+    }
+
+    uint16_t x_value = uint16_t(value & 0xFFFF);
+    uint16_t y_value = uint16_t((value >> 32) & 0xFFFF);
+    tx_sequence = next_sequence++;
+
+    tx = {
+        FRAME_START,
+        uint8_t(ACTUATOR_SETPOINT),
+        uint8_t(tx_sequence & 0xFF), uint8_t(tx_sequence >> 8),
+        4,
+        uint8_t(x_value & 0xFF), uint8_t(x_value >> 8),
+        uint8_t(y_value & 0xFF), uint8_t(y_value >> 8)
+    };
+    tx.push_back(crc8(tx.data() + 1, tx.size() - 1));
+    tx_offset = 0;
+
+    last_sent_setpoint = value;
+    have_sent = true;
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.coalesced += skipped;
+
+    return true;
+}
+
+bool ActuatorLink::flush() {
+    while (tx_offset < tx.size()) {
+        ssize_t written = write(fd, tx.data() + tx_offset, tx.size() - tx_offset);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            counters.io_errors++;
+            return false;
+        }
+        tx_offset += size_t(written);
+    }
+
+    // Fully handed to the device, the round trip starts now
+    in_flight.push_back({ tx_sequence, monotonic_ns() });
+    tx.clear();
+    tx_offset = 0;
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.sent++;
+    counters.in_flight = int(in_flight.size());
+
+    return true;
+}
+
+void ActuatorLink::read_acks() {
+    uint8_t buffer[256];
+
+    for (;;) {
+        ssize_t received = read(fd, buffer, sizeof(buffer));
+        if (received <= 0) {
+            break;
+        }
+        rx.insert(rx.end(), buffer, buffer + received);
+    }
+
+    int64_t now = monotonic_ns();
+    size_t position = 0;
+
+    while (position < rx.size()) {
+        if (rx[position] != FRAME_START) {
+            position++;
+            continue;
+        }
+
+        if (rx.size() - position < FRAME_OVERHEAD) {
+            break;
+        }
+
+        size_t length = rx[position + 4];
+        size_t total = FRAME_OVERHEAD + length;
+        if (rx.size() - position < total) {
+            break;
+        }
+
+        // A bad checksum is a false start byte, resynchronise on the next one
+        const uint8_t *frame = rx.data() + position;
+        if (crc8(frame + 1, total - 2) != frame[total - 1]) {
+            position++;
+            continue;
+        }
+
+        if (frame[1] == ACTUATOR_ACK) {
+            this->acknowledge(uint16_t(frame[2] | (frame[3] << 8)), now);
+        }
+        position += total;
+    }
+
+    rx.erase(rx.begin(), rx.begin() + position);
+}
+
+void ActuatorLink::acknowledge(uint16_t sequence, int64_t now) {
+    auto it = std::find_if(in_flight.begin(), in_flight.end(),
+                           [sequence](const InFlight &frame) { return frame.sequence == sequence; });
+
+    // Late acks of expired frames are ignored
+    if (it == in_flight.end()) {
+        return;
+    }
+
+    double rtt = double(now - it->sent_ns) / 1e6;
+    in_flight.erase(it);
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.acked++;
+    counters.in_flight = int(in_flight.size());
+    counters.rtt_last_ms = rtt;
+    counters.rtt_average_ms = (counters.acked == 1) ? rtt
+        : counters.rtt_average_ms + (rtt - counters.rtt_average_ms) / 16.0;
+    counters.rtt_max_ms = std::max(counters.rtt_max_ms, rtt);
+}
+
+void ActuatorLink::expire(int64_t now) {
+    int64_t timeout = int64_t(ACK_TIMEOUT_MS) * 1000000;
+    size_t before = in_flight.size();
+
+    in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(),
+                                   [now, timeout](const InFlight &frame) {
+                                       return now - frame.sent_ns > timeout;
+                                   }),
+                    in_flight.end());
+
+    size_t expired = before - in_flight.size();
+    if (expired == 0) {
+        return;
+    }
+
+    // Whatever the device holds is unknown now, send the newest setpoint again
+    have_sent = false;
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.timeouts += expired;
+    counters.in_flight = int(in_flight.size());
+}
+
+void ActuatorLink::run() {
+    bool device_down = false;
+
+    while (running.load()) {
+        this->expire(monotonic_ns());
+
+        if (tx.empty()) {
+            this->fill_frame();
+        }
+        if (!tx.empty() && !device_down) {
+            this->flush();
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        // A hung up device is left out for one round instead of spinning on it
+        fds[1].fd = device_down ? -1 : fd;
+        fds[1].events = POLLIN | (tx.empty() ? 0 : POLLOUT);
+        fds[1].revents = 0;
+
+        int timeout = in_flight.empty() ? 100 : ACK_TIMEOUT_MS / 4;
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            LOG_ERROR("actuator") << "Actuator poll failed: " << strerror(errno);
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0) {
+                // Nothing pending
+            }
+        }
+
+        device_down = false;
+        if (fds[1].revents & POLLIN) {
+            this->read_acks();
+        }
+        if (fds[1].revents & (POLLERR | POLLHUP)) {
+            device_down = true;
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            counters.io_errors++;
+        }
+    }
+}
+
+ActuatorStats ActuatorLink::stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    ActuatorStats stats = counters;
+    stats.submitted = setpoint_generation.load(std::memory_order_relaxed);
+    return stats;
+}
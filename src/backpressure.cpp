@@ -0,0 +1,175 @@
+#include "inc/backpressure.h"
+#include "inc/capturescheduler.h"
+#include "inc/logger.h"
+
+#include <cstdio>
+
+BackpressureController::BackpressureController(const std::string &name) :
+    name(name),
+    tick_source(nullptr),
+    enabled(false),
+    ceiling_ms(DEFAULT_CEILING_MS),
+    saturated_ticks(0),
+    headroom_ticks(0),
+    settle_ticks(0),
+    level(DegradeNone),
+    degrades(0),
+    restores(0)
+{
+}
+
+BackpressureController::~BackpressureController() {
+    this->detach();
+}
+
+const char *BackpressureController::level_name(DegradeLevel level) {
+    switch (level) {
+    case DegradeNone: return "full quality";
+    case DegradeFramerate: return "half frame rate";
+    case DegradeResolution: return "half resolution";
+    case DegradeAnalysis: return "analysis on every other frame";
+    case DEGRADE_LEVEL_COUNT: break;
+    }
+    return "?";
+}
+
+void BackpressureController::attach(Sampler sampler, Applier applier) {
+    this->sampler = sampler;
+    this->applier = applier;
+    tick_source = CaptureScheduler::instance().add_timeout(TICK_MS, tick_callback, this);
+}
+
+void BackpressureController::detach() {
+    CaptureScheduler::instance().remove_source(tick_source);
+    tick_source = nullptr;
+
+    // Wait out a tick that was already running
+    std::lock_guard<std::mutex> lock(tick_mutex);
+    sampler = nullptr;
+    applier = nullptr;
+}
+
+void BackpressureController::set_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(tick_mutex);
+
+    if (this->enabled.exchange(enabled) == enabled) {
+        return;
+    }
+
+    saturated_ticks = 0;
+    headroom_ticks = 0;
+    settle_ticks = SETTLE_TICKS;
+
+    LOG_INFO("backpressure") << name << ": adaptive quality " << (enabled ? "on" : "off")
+        << ", latency ceiling " << ceiling_ms.load() << " ms";
+
+    if (!enabled) {
+        this->change(DegradeNone, "adaptive quality off");
+    }
+}
+
+void BackpressureController::set_latency_ceiling(double ms) {
+    ceiling_ms.store(ms > 0 ? ms : DEFAULT_CEILING_MS);
+}
+
+gboolean BackpressureController::tick_callback(gpointer data) {
+    static_cast<BackpressureController*>(data)->tick();
+    return G_SOURCE_CONTINUE;
+}
+
+// Called with tick_mutex held
+void BackpressureController::change(DegradeLevel next, const char *reason) {
+    DegradeLevel previous;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        previous = level;
+        if (next == previous) {
+            return;
+        }
+
+        level = next;
+        if (next > previous) {
+            degrades++;
+        } else {
+            restores++;
+        }
+    }
+
+    if (next > previous) {
+        LOG_WARNING("backpressure") << name << ": " << reason << ", down to " << level_name(next);
+    } else {
+        LOG_INFO("backpressure") << name << ": " << reason << ", back to " << level_name(next);
+    }
+
+    if (applier) {
+        applier(next);
+    }
+}
+
+void BackpressureController::tick() {
+    std::lock_guard<std::mutex> lock(tick_mutex);
+    if (!sampler) {
+        return;
+    }
+
+    LoadSample sample = sampler();
+    DegradeLevel current;
+    {
+        std::lock_guard<std::mutex> stats_lock(stats_mutex);
+        last = sample;
+        current = level;
+    }
+
+    // Nothing flowed, there is no load to judge
+    if (!enabled.load() || sample.frames == 0) {
+        return;
+    }
+
+    if (settle_ticks > 0) {
+        settle_ticks--;
+        return;
+    }
+
+    double ceiling = ceiling_ms.load();
+    bool saturated = sample.drop_ratio > MAX_DROP_RATIO ||
+                     sample.stage_dropped > 0 ||
+                     sample.latency_p95_ms > ceiling;
+    bool headroom = sample.drop_ratio < HEADROOM_DROP_RATIO &&
+                    sample.stage_dropped == 0 &&
+                    sample.queue_depth <= 1 &&
+                    sample.latency_p95_ms < ceiling * HEADROOM_LATENCY;
+
+    saturated_ticks = saturated ? saturated_ticks + 1 : 0;
+    headroom_ticks = headroom ? headroom_ticks + 1 : 0;
+
+    char reason[128];
+    snprintf(reason, sizeof(reason), "%.1f%% dropped, %llu dropped by analysis, p95 %.1f ms",
+             sample.drop_ratio * 100, (unsigned long long)sample.stage_dropped, sample.latency_p95_ms);
+
+    if (saturated_ticks >= SATURATED_TICKS && current + 1 < DEGRADE_LEVEL_COUNT) {
+        this->change(DegradeLevel(current + 1), reason);
+        saturated_ticks = 0;
+        headroom_ticks = 0;
+        settle_ticks = SETTLE_TICKS;
+    } else if (headroom_ticks >= HEADROOM_TICKS && current > DegradeNone) {
+        this->change(DegradeLevel(current - 1), reason);
+        saturated_ticks = 0;
+        headroom_ticks = 0;
+        settle_ticks = SETTLE_TICKS;
+    }
+}
+
+BackpressureStats BackpressureController::stats() const {
+    BackpressureStats stats;
+
+    stats.enabled = enabled.load();
+    stats.latency_ceiling_ms = ceiling_ms.load();
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats.level = level;
+    stats.last = last;
+    stats.degrades = degrades;
+    stats.restores = restores;
+
+    return stats;
+}
@@ -0,0 +1,191 @@
+#include "inc/cameracontrols.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// ioctl restarted when a signal interrupts it
+static int xioctl(int fd, unsigned long request, void *argument) {
+    int result;
+    do {
+        result = ioctl(fd, request, argument);
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+
+CameraControls::CameraControls() :
+    fd(-1),
+    has_autofocus(false),
+    autofocus_off(false),
+    running(false),
+    requested(0),
+    applied(0),
+    coalesced(0),
+    errors(0)
+{
+    for (int i = 0; i < CAMERA_CONTROL_COUNT; i++) {
+        pending[i] = 0;
+        dirty[i] = false;
+    }
+}
+
+CameraControls::~CameraControls() {
+    this->close();
+}
+
+bool CameraControls::query(CameraControl control, uint32_t id) {
+    struct v4l2_queryctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = id;
+
+    if (xioctl(fd, VIDIOC_QUERYCTRL, &query) < 0 || (query.flags & V4L2_CTRL_FLAG_DISABLED) ||
+        query.maximum <= query.minimum) {
+        return false;
+    }
+
+    Range &range = ranges[control];
+    range.available = true;
+    range.id = id;
+    range.minimum = query.minimum;
+    range.maximum = query.maximum;
+    range.step = std::max(1, query.step);
+    return true;
+}
+
+bool CameraControls::open(const std::string &device) {
+    this->close();
+
+    fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARNING("controls") << "Cannot open " << device << " for controls: " << strerror(errno);
+        return false;
+    }
+
+    bool zoom = this->query(ControlZoom, V4L2_CID_ZOOM_ABSOLUTE);
+    bool focus = this->query(ControlFocus, V4L2_CID_FOCUS_ABSOLUTE);
+
+    struct v4l2_queryctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = V4L2_CID_FOCUS_AUTO;
+    has_autofocus = xioctl(fd, VIDIOC_QUERYCTRL, &query) == 0 && !(query.flags & V4L2_CTRL_FLAG_DISABLED);
+    autofocus_off = false;
+
+    LOG_INFO("controls") << device << ": hardware zoom " << (zoom ? "yes" : "no")
+        << ", focus " << (focus ? "yes" : "no");
+
+    if (!zoom && !focus) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    running = true;
+    worker = std::thread(&CameraControls::run, this);
+    return true;
+}
+
+void CameraControls::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+
+    for (Range &range : ranges) {
+        range = Range();
+    }
+}
+
+void CameraControls::set(CameraControl control, double level) {
+    if (!ranges[control].available) {
+        return;
+    }
+
+    requested.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dirty[control]) {
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        pending[control] = std::clamp(level, 0.0, 1.0);
+        dirty[control] = true;
+    }
+    wake.notify_one();
+}
+
+bool CameraControls::apply(uint32_t id, int32_t value) {
+    struct v4l2_control control;
+    control.id = id;
+    control.value = value;
+
+    if (xioctl(fd, VIDIOC_S_CTRL, &control) < 0) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARNING("controls") << "Setting control " << id << " to " << value << " failed: " << strerror(errno);
+        return false;
+    }
+
+    applied.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void CameraControls::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running) {
+        wake.wait(lock, [this]() {
+            return !running || std::any_of(dirty, dirty + CAMERA_CONTROL_COUNT, [](bool value) { return value; });
+        });
+
+        for (int i = 0; i < CAMERA_CONTROL_COUNT && running; i++) {
+            if (!dirty[i]) {
+                continue;
+            }
+
+            const Range &range = ranges[i];
+            double level = pending[i];
+            dirty[i] = false;
+
+            // The ioctl may take a USB round trip, newer values queue up meanwhile
+            lock.unlock();
+
+            if (i == ControlFocus && has_autofocus && !autofocus_off) {
+                autofocus_off = this->apply(V4L2_CID_FOCUS_AUTO, 0);
+            }
+
+            int32_t steps = int32_t(std::lround(level * double(range.maximum - range.minimum) / range.step));
+            this->apply(range.id, std::min(range.maximum, range.minimum + steps * range.step));
+
+            lock.lock();
+        }
+    }
+}
+
+CameraControlStats CameraControls::stats() const {
+    CameraControlStats stats;
+
+    stats.open = fd >= 0;
+    stats.zoom = ranges[ControlZoom].available;
+    stats.focus = ranges[ControlFocus].available;
+    stats.requested = requested.load();
+    stats.applied = applied.load();
+    stats.coalesced = coalesced.load();
+    stats.errors = errors.load();
+
+    return stats;
+}
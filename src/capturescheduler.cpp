@@ -0,0 +1,104 @@
+#include "inc/capturescheduler.h"
+
+#include <condition_variable>
+#include <mutex>
+
+CaptureScheduler &CaptureScheduler::instance() {
+    static CaptureScheduler scheduler;
+    return scheduler;
+}
+
+CaptureScheduler::CaptureScheduler() {
+    gst_init(NULL, NULL);
+
+    context = g_main_context_new();
+    loop = g_main_loop_new(context, FALSE);
+
+    bus_thread = std::thread([this]() {
+        g_main_context_push_thread_default(context);
+        g_main_loop_run(loop);
+        g_main_context_pop_thread_default(context);
+    });
+}
+
+static gboolean quit_loop(gpointer data) {
+    g_main_loop_quit(static_cast<GMainLoop*>(data));
+    return G_SOURCE_REMOVE;
+}
+
+CaptureScheduler::~CaptureScheduler() {
+    // Quit from inside the loop, so it cannot be missed if the loop has not started yet
+    GSource *idle = g_idle_source_new();
+    g_source_set_callback(idle, quit_loop, loop, NULL);
+    g_source_attach(idle, context);
+    g_source_unref(idle);
+
+    if (bus_thread.joinable()) {
+        bus_thread.join();
+    }
+
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+}
+
+GSource *CaptureScheduler::add_bus_watch(GstBus *bus, GstBusFunc callback, gpointer data) {
+    GSource *watch = gst_bus_create_watch(bus);
+    g_source_set_callback(watch, reinterpret_cast<GSourceFunc>(callback), data, NULL);
+    g_source_attach(watch, context);
+
+    return watch;
+}
+
+GSource *CaptureScheduler::add_timeout(guint interval_ms, GSourceFunc callback, gpointer data) {
+    GSource *timeout = g_timeout_source_new(interval_ms);
+    g_source_set_callback(timeout, callback, data, NULL);
+    g_source_attach(timeout, context);
+
+    return timeout;
+}
+
+// Removal handed to the bus thread, which only runs it between two dispatches
+struct PendingRemoval {
+    GSource *source;
+    std::mutex mutex;
+    std::condition_variable done_changed;
+    bool done = false;
+};
+
+static gboolean remove_on_bus_thread(gpointer data) {
+    PendingRemoval *removal = static_cast<PendingRemoval*>(data);
+    g_source_destroy(removal->source);
+
+    std::lock_guard<std::mutex> lock(removal->mutex);
+    removal->done = true;
+    removal->done_changed.notify_one();
+    return G_SOURCE_REMOVE;
+}
+
+void CaptureScheduler::remove_source(GSource *source) {
+    if (!source) {
+        return;
+    }
+
+    // On the bus thread itself, or with the loop gone, nothing can be running
+    if (g_main_context_is_owner(context) || !g_main_loop_is_running(loop)) {
+        g_source_destroy(source);
+        g_source_unref(source);
+        return;
+    }
+
+    PendingRemoval removal;
+    removal.source = source;
+
+    GSource *idle = g_idle_source_new();
+    g_source_set_priority(idle, G_PRIORITY_HIGH);
+    g_source_set_callback(idle, remove_on_bus_thread, &removal, NULL);
+    g_source_attach(idle, context);
+    g_source_unref(idle);
+
+    std::unique_lock<std::mutex> lock(removal.mutex);
+    removal.done_changed.wait(lock, [&removal]() { return removal.done; });
+    lock.unlock();
+
+    g_source_unref(source);
+}
@@ -0,0 +1,46 @@
+#include "inc/capturesource.h"
+
+bool CaptureSource::from_string(const std::string &spec, CaptureSource &source) {
+    std::string kind = spec;
+    std::string location;
+
+    size_t separator = spec.find(':');
+    if (separator != std::string::npos) {
+        kind = spec.substr(0, separator);
+        location = spec.substr(separator + 1);
+    }
+
+    if (kind == "v4l2") {
+        source = CaptureSource(V4L2, location);
+    } else if (kind == "test") {
+        source = CaptureSource(TestPattern, location.empty() ? "smpte" : location);
+    } else if (kind == "file") {
+        if (location.empty())
+            return false;
+        source = CaptureSource(Uri, location);
+    } else if (kind == "uri") {
+        if (location.empty())
+            return false;
+        source = CaptureSource(Uri, location);
+    } else if (kind == "appsrc") {
+        source = CaptureSource(AppSrc);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+std::string CaptureSource::to_string() const {
+    switch (kind) {
+        case V4L2:
+            return location.empty() ? "v4l2" : "v4l2:" + location;
+        case TestPattern:
+            return "test:" + location;
+        case Uri:
+            return "uri:" + location;
+        case AppSrc:
+            return "appsrc";
+    }
+    return std::string();
+}
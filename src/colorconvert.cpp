@@ -0,0 +1,446 @@
+#include "inc/colorconvert.h"
+#include "inc/logger.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLORCONVERT_X86 1
+#endif
+
+// BT.601 limited range, same fixed-point constants as OpenCV
+static const int YUV_SHIFT = 20;
+static const int YUV_CY = 1220542;
+static const int YUV_CUB = 2116026;
+static const int YUV_CUG = -409993;
+static const int YUV_CVG = -852492;
+static const int YUV_CVR = 1673527;
+
+enum ConvertIsa {
+    ISA_SCALAR,
+    ISA_SSE41,
+    ISA_AVX2
+};
+
+// Row kernels convert pixels [0, width) of a single row
+typedef void (*Yuy2RowFn)(const uint8_t *src, uint8_t *dst, int width);
+typedef void (*Nv12RowFn)(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width);
+typedef void (*SwapRowFn)(const uint8_t *src, uint8_t *dst, int width);
+
+static inline uint8_t clamp_u8(int value) {
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline void yuv_to_rgb_pixel(int y, int u, int v, uint8_t *rgb) {
+    const int half = 1 << (YUV_SHIFT - 1);
+    u -= 128;
+    v -= 128;
+
+    int yy = std::max(0, y - 16) * YUV_CY;
+    rgb[0] = clamp_u8((yy + half + YUV_CVR * v) >> YUV_SHIFT);
+    rgb[1] = clamp_u8((yy + half + YUV_CVG * v + YUV_CUG * u) >> YUV_SHIFT);
+    rgb[2] = clamp_u8((yy + half + YUV_CUB * u) >> YUV_SHIFT);
+}
+
+// Scalar kernels, also used for the tails of the vector ones
+
+static void yuy2_row_scalar_from(const uint8_t *src, uint8_t *dst, int x, int width) {
+    for (; x < width; ++x) {
+        const uint8_t *pair = src + (x & ~1) * 2;
+        yuv_to_rgb_pixel(src[x * 2], pair[1], pair[3], dst + x * 3);
+    }
+}
+
+static void nv12_row_scalar_from(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int x, int width) {
+    for (; x < width; ++x) {
+        const uint8_t *chroma = uv + (x & ~1);
+        yuv_to_rgb_pixel(y[x], chroma[0], chroma[1], dst + x * 3);
+    }
+}
+
+static void swap_row_scalar_from(const uint8_t *src, uint8_t *dst, int x, int width) {
+    for (; x < width; ++x) {
+        uint8_t first = src[x * 3];
+        dst[x * 3 + 1] = src[x * 3 + 1];
+        dst[x * 3] = src[x * 3 + 2];
+        dst[x * 3 + 2] = first;
+    }
+}
+
+static void yuy2_row_scalar(const uint8_t *src, uint8_t *dst, int width) {
+    yuy2_row_scalar_from(src, dst, 0, width);
+}
+
+static void nv12_row_scalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    nv12_row_scalar_from(y, uv, dst, 0, width);
+}
+
+static void swap_row_scalar(const uint8_t *src, uint8_t *dst, int width) {
+    swap_row_scalar_from(src, dst, 0, width);
+}
+
+#ifdef COLORCONVERT_X86
+
+// Interleaves 8 R, G and B bytes (low halves) into 24 bytes of RGB888
+__attribute__((target("sse4.1")))
+static inline void store_rgb8_sse(__m128i r, __m128i g, __m128i b, uint8_t *dst) {
+    const __m128i lo_rg = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+    const __m128i lo_b = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i hi_rg = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i hi_b = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    __m128i rg = _mm_unpacklo_epi8(r, g);
+    __m128i lo = _mm_or_si128(_mm_shuffle_epi8(rg, lo_rg), _mm_shuffle_epi8(b, lo_b));
+    __m128i hi = _mm_or_si128(_mm_shuffle_epi8(rg, hi_rg), _mm_shuffle_epi8(b, hi_b));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), lo);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 16), hi);
+}
+
+// 4 pixels worth of the fixed-point YUV math, inputs and outputs are int32 lanes
+__attribute__((target("sse4.1")))
+static inline void yuv4_sse(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b) {
+    const __m128i half = _mm_set1_epi32(1 << (YUV_SHIFT - 1));
+
+    y = _mm_max_epi32(_mm_sub_epi32(y, _mm_set1_epi32(16)), _mm_setzero_si128());
+    y = _mm_mullo_epi32(y, _mm_set1_epi32(YUV_CY));
+    u = _mm_sub_epi32(u, _mm_set1_epi32(128));
+    v = _mm_sub_epi32(v, _mm_set1_epi32(128));
+
+    __m128i ruv = _mm_add_epi32(half, _mm_mullo_epi32(v, _mm_set1_epi32(YUV_CVR)));
+    __m128i guv = _mm_add_epi32(half, _mm_add_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(YUV_CVG)),
+                                                    _mm_mullo_epi32(u, _mm_set1_epi32(YUV_CUG))));
+    __m128i buv = _mm_add_epi32(half, _mm_mullo_epi32(u, _mm_set1_epi32(YUV_CUB)));
+
+    r = _mm_srai_epi32(_mm_add_epi32(y, ruv), YUV_SHIFT);
+    g = _mm_srai_epi32(_mm_add_epi32(y, guv), YUV_SHIFT);
+    b = _mm_srai_epi32(_mm_add_epi32(y, buv), YUV_SHIFT);
+}
+
+// Converts 8 pixels given as 8 Y, U and V bytes (chroma already upsampled)
+__attribute__((target("sse4.1")))
+static inline void yuv8_to_rgb_sse(__m128i y8, __m128i u8, __m128i v8, uint8_t *dst) {
+    __m128i r0, g0, b0, r1, g1, b1;
+
+    yuv4_sse(_mm_cvtepu8_epi32(y8), _mm_cvtepu8_epi32(u8), _mm_cvtepu8_epi32(v8), r0, g0, b0);
+    yuv4_sse(_mm_cvtepu8_epi32(_mm_srli_si128(y8, 4)),
+             _mm_cvtepu8_epi32(_mm_srli_si128(u8, 4)),
+             _mm_cvtepu8_epi32(_mm_srli_si128(v8, 4)), r1, g1, b1);
+
+    const __m128i zero = _mm_setzero_si128();
+    store_rgb8_sse(_mm_packus_epi16(_mm_packs_epi32(r0, r1), zero),
+                   _mm_packus_epi16(_mm_packs_epi32(g0, g1), zero),
+                   _mm_packus_epi16(_mm_packs_epi32(b0, b1), zero),
+                   dst);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i pack_u8_avx2(__m256i value) {
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+    return _mm_packus_epi16(packed, _mm_setzero_si128());
+}
+
+// Same as yuv8_to_rgb_sse with all 8 pixels in one set of 256-bit lanes
+__attribute__((target("avx2")))
+static inline void yuv8_to_rgb_avx2(__m128i y8, __m128i u8, __m128i v8, uint8_t *dst) {
+    const __m256i half = _mm256_set1_epi32(1 << (YUV_SHIFT - 1));
+
+    __m256i y = _mm256_cvtepu8_epi32(y8);
+    __m256i u = _mm256_sub_epi32(_mm256_cvtepu8_epi32(u8), _mm256_set1_epi32(128));
+    __m256i v = _mm256_sub_epi32(_mm256_cvtepu8_epi32(v8), _mm256_set1_epi32(128));
+
+    y = _mm256_max_epi32(_mm256_sub_epi32(y, _mm256_set1_epi32(16)), _mm256_setzero_si256());
+    y = _mm256_mullo_epi32(y, _mm256_set1_epi32(YUV_CY));
+
+    __m256i ruv = _mm256_add_epi32(half, _mm256_mullo_epi32(v, _mm256_set1_epi32(YUV_CVR)));
+    __m256i guv = _mm256_add_epi32(half, _mm256_add_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(YUV_CVG)),
+                                                          _mm256_mullo_epi32(u, _mm256_set1_epi32(YUV_CUG))));
+    __m256i buv = _mm256_add_epi32(half, _mm256_mullo_epi32(u, _mm256_set1_epi32(YUV_CUB)));
+
+    store_rgb8_sse(pack_u8_avx2(_mm256_srai_epi32(_mm256_add_epi32(y, ruv), YUV_SHIFT)),
+                   pack_u8_avx2(_mm256_srai_epi32(_mm256_add_epi32(y, guv), YUV_SHIFT)),
+                   pack_u8_avx2(_mm256_srai_epi32(_mm256_add_epi32(y, buv), YUV_SHIFT)),
+                   dst);
+}
+
+// Splits 16 bytes of YUY2 (8 pixels) into 8 Y bytes and upsampled U and V
+__attribute__((target("sse4.1")))
+static inline void split_yuy2_sse(__m128i in, __m128i &y8, __m128i &u8, __m128i &v8) {
+    const __m128i y_mask = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i u_mask = _mm_setr_epi8(1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i v_mask = _mm_setr_epi8(3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    y8 = _mm_shuffle_epi8(in, y_mask);
+    u8 = _mm_shuffle_epi8(in, u_mask);
+    v8 = _mm_shuffle_epi8(in, v_mask);
+}
+
+// Upsamples 4 interleaved UV pairs into 8 U and 8 V bytes
+__attribute__((target("sse4.1")))
+static inline void split_nv12_sse(__m128i uv, __m128i &u8, __m128i &v8) {
+    const __m128i u_mask = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i v_mask = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    u8 = _mm_shuffle_epi8(uv, u_mask);
+    v8 = _mm_shuffle_epi8(uv, v_mask);
+}
+
+__attribute__((target("sse4.1")))
+static void yuy2_row_sse41(const uint8_t *src, uint8_t *dst, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i y8, u8, v8;
+        split_yuy2_sse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2)), y8, u8, v8);
+        yuv8_to_rgb_sse(y8, u8, v8, dst + x * 3);
+    }
+    yuy2_row_scalar_from(src, dst, x, width);
+}
+
+__attribute__((target("avx2")))
+static void yuy2_row_avx2(const uint8_t *src, uint8_t *dst, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i y8, u8, v8;
+        split_yuy2_sse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2)), y8, u8, v8);
+        yuv8_to_rgb_avx2(y8, u8, v8, dst + x * 3);
+    }
+    yuy2_row_scalar_from(src, dst, x, width);
+}
+
+__attribute__((target("sse4.1")))
+static void nv12_row_sse41(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i u8, v8;
+        split_nv12_sse(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(uv + x)), u8, v8);
+        yuv8_to_rgb_sse(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), u8, v8, dst + x * 3);
+    }
+    nv12_row_scalar_from(y, uv, dst, x, width);
+}
+
+__attribute__((target("avx2")))
+static void nv12_row_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i u8, v8;
+        split_nv12_sse(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(uv + x)), u8, v8);
+        yuv8_to_rgb_avx2(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), u8, v8, dst + x * 3);
+    }
+    nv12_row_scalar_from(y, uv, dst, x, width);
+}
+
+// 16-byte loads and stores move 4 pixels at a time, the 4 trailing bytes are
+// copied unchanged and rewritten by the next step, so stay 16 bytes inside the row
+__attribute__((target("sse4.1")))
+static void swap_row_sse41(const uint8_t *src, uint8_t *dst, int width) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    const int bytes = width * 3;
+
+    int x = 0;
+    for (; x * 3 + 16 <= bytes; x += 4) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm_shuffle_epi8(in, mask));
+    }
+    swap_row_scalar_from(src, dst, x, width);
+}
+
+// 8 pixels per step as two 12-byte groups, one per 128-bit lane
+__attribute__((target("avx2")))
+static void swap_row_avx2(const uint8_t *src, uint8_t *dst, int width) {
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15,
+                                          2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    const int bytes = width * 3;
+
+    int x = 0;
+    for (; x * 3 + 28 <= bytes; x += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3 + 12));
+        __m256i out = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), mask);
+
+        // The upper lane overwrites the 4 unswapped bytes of the lower one
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm256_castsi256_si128(out));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3 + 12), _mm256_extracti128_si256(out, 1));
+    }
+    swap_row_sse41(src + x * 3, dst + x * 3, width - x);
+}
+
+#endif // COLORCONVERT_X86
+
+static ConvertIsa detect_isa() {
+#ifdef COLORCONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return ISA_SSE41;
+#endif
+    return ISA_SCALAR;
+}
+
+static const ConvertIsa active_isa = detect_isa();
+
+static Yuy2RowFn yuy2_row(ConvertIsa isa) {
+    switch (isa) {
+#ifdef COLORCONVERT_X86
+        case ISA_AVX2:
+            return yuy2_row_avx2;
+        case ISA_SSE41:
+            return yuy2_row_sse41;
+#endif
+        default:
+            return yuy2_row_scalar;
+    }
+}
+
+static Nv12RowFn nv12_row(ConvertIsa isa) {
+    switch (isa) {
+#ifdef COLORCONVERT_X86
+        case ISA_AVX2:
+            return nv12_row_avx2;
+        case ISA_SSE41:
+            return nv12_row_sse41;
+#endif
+        default:
+            return nv12_row_scalar;
+    }
+}
+
+static SwapRowFn swap_row(ConvertIsa isa) {
+    switch (isa) {
+#ifdef COLORCONVERT_X86
+        case ISA_AVX2:
+            return swap_row_avx2;
+        case ISA_SSE41:
+            return swap_row_sse41;
+#endif
+        default:
+            return swap_row_scalar;
+    }
+}
+
+static void yuy2_to_rgb(ConvertIsa isa, const uint8_t *src, int src_stride,
+                        uint8_t *dst, int dst_stride, int width, int height) {
+    Yuy2RowFn row = yuy2_row(isa);
+    for (int i = 0; i < height; ++i) {
+        row(src + i * src_stride, dst + i * dst_stride, width);
+    }
+}
+
+static void nv12_to_rgb(ConvertIsa isa, const uint8_t *src_y, int y_stride,
+                        const uint8_t *src_uv, int uv_stride,
+                        uint8_t *dst, int dst_stride, int width, int height) {
+    Nv12RowFn row = nv12_row(isa);
+    for (int i = 0; i < height; ++i) {
+        row(src_y + i * y_stride, src_uv + (i / 2) * uv_stride, dst + i * dst_stride, width);
+    }
+}
+
+static void swap_rb(ConvertIsa isa, const uint8_t *src, int src_stride,
+                    uint8_t *dst, int dst_stride, int width, int height) {
+    SwapRowFn row = swap_row(isa);
+    for (int i = 0; i < height; ++i) {
+        row(src + i * src_stride, dst + i * dst_stride, width);
+    }
+}
+
+void convert_yuy2_to_rgb(const uint8_t *src, int src_stride,
+                         uint8_t *dst, int dst_stride,
+                         int width, int height) {
+    yuy2_to_rgb(active_isa, src, src_stride, dst, dst_stride, width, height);
+}
+
+void convert_nv12_to_rgb(const uint8_t *src_y, int y_stride,
+                         const uint8_t *src_uv, int uv_stride,
+                         uint8_t *dst, int dst_stride,
+                         int width, int height) {
+    nv12_to_rgb(active_isa, src_y, y_stride, src_uv, uv_stride, dst, dst_stride, width, height);
+}
+
+void convert_swap_rb(const uint8_t *src, int src_stride,
+                     uint8_t *dst, int dst_stride,
+                     int width, int height) {
+    swap_rb(active_isa, src, src_stride, dst, dst_stride, width, height);
+}
+
+static const char *isa_name(ConvertIsa isa) {
+    switch (isa) {
+        case ISA_AVX2:
+            return "avx2";
+        case ISA_SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
+
+const char *color_convert_isa() {
+    return isa_name(active_isa);
+}
+
+// Largest per-channel difference between a kernel result and the reference
+static double max_difference(const cv::Mat &result, const cv::Mat &reference) {
+    return cv::norm(result, reference, cv::NORM_INF);
+}
+
+bool color_convert_self_test() {
+    // Odd sizes exercise the vector tails, the padding exercises the strides
+    const int sizes[][2] = { {2, 2}, {8, 2}, {34, 6}, {66, 34}, {642, 18} };
+    const int padding = 13;
+
+    cv::RNG rng(0x5eed);
+    bool ok = true;
+
+    for (ConvertIsa isa : { ISA_SCALAR, ISA_SSE41, ISA_AVX2 }) {
+        if (isa > active_isa)
+            continue;
+
+        for (const auto &size : sizes) {
+            const int width = size[0];
+            const int height = size[1];
+
+            cv::Mat yuy2_full(height, width + padding, CV_8UC2);
+            cv::Mat y_full(height, width + padding, CV_8UC1);
+            cv::Mat uv_full(height / 2, width / 2 + padding, CV_8UC2);
+            cv::Mat bgr_full(height, width + padding, CV_8UC3);
+            rng.fill(yuy2_full, cv::RNG::UNIFORM, 0, 256);
+            rng.fill(y_full, cv::RNG::UNIFORM, 0, 256);
+            rng.fill(uv_full, cv::RNG::UNIFORM, 0, 256);
+            rng.fill(bgr_full, cv::RNG::UNIFORM, 0, 256);
+
+            cv::Mat yuy2 = yuy2_full.colRange(0, width);
+            cv::Mat y = y_full.colRange(0, width);
+            cv::Mat uv = uv_full.colRange(0, width / 2);
+            cv::Mat bgr = bgr_full.colRange(0, width);
+
+            cv::Mat result_full(height, width + padding, CV_8UC3);
+            cv::Mat result = result_full.colRange(0, width);
+            cv::Mat reference;
+
+            cv::cvtColor(yuy2, reference, cv::COLOR_YUV2RGB_YUY2);
+            yuy2_to_rgb(isa, yuy2.data, int(yuy2.step), result.data, int(result.step), width, height);
+            double yuy2_diff = max_difference(result, reference);
+
+            cv::cvtColorTwoPlane(y, uv, reference, cv::COLOR_YUV2RGB_NV12);
+            nv12_to_rgb(isa, y.data, int(y.step), uv.data, int(uv.step),
+                        result.data, int(result.step), width, height);
+            double nv12_diff = max_difference(result, reference);
+
+            cv::cvtColor(bgr, reference, cv::COLOR_BGR2RGB);
+            swap_rb(isa, bgr.data, int(bgr.step), result.data, int(result.step), width, height);
+            double swap_diff = max_difference(result, reference);
+
+            // The YUV math is the same fixed-point formula, allow one step for rounding
+            if (yuy2_diff > 1 || nv12_diff > 1 || swap_diff > 0) {
+                LOG_ERROR("convert") << "Colour conversion mismatch (" << isa_name(isa) << ", "
+                    << width << "x" << height << "): yuy2 " << yuy2_diff
+                    << ", nv12 " << nv12_diff << ", swap " << swap_diff;
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
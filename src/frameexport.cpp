@@ -0,0 +1,166 @@
+#include "inc/frameexport.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+static SharedFrameFormat shared_format(QImage::Format format) {
+    switch (format) {
+        case QImage::Format_RGB888:
+            return SHARED_FRAME_RGB;
+        case QImage::Format_BGR888:
+            return SHARED_FRAME_BGR;
+        case QImage::Format_RGBX8888:
+            return SHARED_FRAME_RGBX;
+        case QImage::Format_RGBA8888:
+            return SHARED_FRAME_RGBA;
+        // 0xffRRGGBB words, little endian in memory
+        case QImage::Format_RGB32:
+            return SHARED_FRAME_BGRX;
+        case QImage::Format_ARGB32:
+            return SHARED_FRAME_BGRA;
+        case QImage::Format_Grayscale8:
+            return SHARED_FRAME_GRAY8;
+        default:
+            return SHARED_FRAME_UNKNOWN;
+    }
+}
+
+FrameExport::FrameExport() :
+    mapped(nullptr),
+    mapped_size(0),
+    header(nullptr),
+    frame(0),
+    published(0),
+    skipped(0)
+{
+}
+
+FrameExport::~FrameExport() {
+    this->close();
+}
+
+bool FrameExport::open(const std::string &name, int slots, size_t slot_bytes) {
+    this->close();
+
+    // POSIX names start with a single slash
+    std::string object = (!name.empty() && name[0] == '/') ? name : "/" + name;
+
+    // Readers of a previous object keep their mapping, new ones find this one
+    shm_unlink(object.c_str());
+
+    int fd = shm_open(object.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        LOG_ERROR("export") << "Failed to create shared memory " << object << ": " << strerror(errno);
+        return false;
+    }
+
+    size_t count = size_t(std::max(1, slots));
+    // Slots start on cache lines, so do the pixels after each slot header
+    size_t stride = (SHARED_FRAME_DATA_OFFSET + slot_bytes + 63) & ~size_t(63);
+    size_t size = sizeof(SharedFrameHeader) + count * stride;
+
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (memory == MAP_FAILED) {
+        LOG_ERROR("export") << "Failed to map shared memory " << object << ": " << strerror(errno);
+        shm_unlink(object.c_str());
+        return false;
+    }
+
+    // A fresh object reads as zeros, only the header and slot words need constructing
+    header = new (memory) SharedFrameHeader();
+    header->magic = SHARED_FRAMES_MAGIC;
+    header->version = SHARED_FRAMES_VERSION;
+    header->slot_count = uint32_t(count);
+    header->slot_stride = uint32_t(stride);
+    header->slot_capacity = slot_bytes;
+    header->latest.store(0, std::memory_order_relaxed);
+    header->closed.store(0, std::memory_order_relaxed);
+
+    uint8_t *slot_base = static_cast<uint8_t*>(memory) + sizeof(SharedFrameHeader);
+    for (size_t i = 0; i < count; i++) {
+        SharedFrameSlot *slot = new (slot_base + i * stride) SharedFrameSlot();
+        slot->lock.store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    this->name = object;
+    mapped = memory;
+    mapped_size = size;
+    frame = 0;
+    published.store(0);
+    skipped.store(0);
+
+    LOG_INFO("export") << "Exporting frames to shared memory " << object << ", "
+        << count << " slots of " << slot_bytes / 1024 << " KiB";
+    return true;
+}
+
+void FrameExport::close() {
+    if (!mapped) {
+        return;
+    }
+
+    header->closed.store(1, std::memory_order_release);
+    munmap(mapped, mapped_size);
+    shm_unlink(name.c_str());
+
+    mapped = nullptr;
+    mapped_size = 0;
+    header = nullptr;
+}
+
+void FrameExport::publish(const QImage &image, int64_t capture_ns) {
+    if (!header) {
+        return;
+    }
+
+    SharedFrameFormat format = shared_format(image.format());
+    size_t size = size_t(image.bytesPerLine()) * size_t(image.height());
+    if (format == SHARED_FRAME_UNKNOWN || size > header->slot_capacity) {
+        skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint64_t number = ++frame;
+    SharedFrameSlot *slot = reinterpret_cast<SharedFrameSlot*>(
+        reinterpret_cast<uint8_t*>(header) + sizeof(SharedFrameHeader) +
+        size_t(number % header->slot_count) * header->slot_stride);
+
+    // Odd while writing, readers that saw the old even value notice the change
+    uint64_t lock = slot->lock.load(std::memory_order_relaxed);
+    slot->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frame = number;
+    slot->capture_ns = capture_ns;
+    slot->width = uint32_t(image.width());
+    slot->height = uint32_t(image.height());
+    slot->stride = uint32_t(image.bytesPerLine());
+    slot->format = uint32_t(format);
+    slot->size = size;
+    memcpy(reinterpret_cast<uint8_t*>(slot) + SHARED_FRAME_DATA_OFFSET, image.constBits(), size);
+
+    slot->lock.store(lock + 2, std::memory_order_release);
+    header->latest.store(number, std::memory_order_release);
+
+    published.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameExportStats FrameExport::stats() const {
+    FrameExportStats stats;
+
+    stats.open = header != nullptr;
+    stats.name = name;
+    stats.published = published.load();
+    stats.skipped = skipped.load();
+
+    return stats;
+}
@@ -0,0 +1,73 @@
+#include "inc/framepool.h"
+#include "inc/logger.h"
+
+G_DEFINE_TYPE(FramePool, frame_pool, GST_TYPE_VIDEO_BUFFER_POOL)
+
+static GstFlowReturn frame_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
+                                               GstBufferPoolAcquireParams *params) {
+    FramePool *self = reinterpret_cast<FramePool*>(pool);
+    GstBufferPoolClass *parent = GST_BUFFER_POOL_CLASS(frame_pool_parent_class);
+
+    // First try without waiting to find out whether the pool is exhausted
+    GstBufferPoolAcquireParams try_params = {};
+    if (params) {
+        try_params = *params;
+    }
+    try_params.flags = static_cast<GstBufferPoolAcquireFlags>(
+        try_params.flags | GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT);
+
+    GstFlowReturn ret = parent->acquire_buffer(pool, buffer, &try_params);
+
+    bool may_wait = !params || !(params->flags & GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT);
+    if (ret == GST_FLOW_EOS && may_wait) {
+        // Counted every time, reported the first time only
+        if (self->counters->exhausted++ == 0) {
+            LOG_WARNING("capture") << "Frame pool exhausted, upstream waits for a buffer to come back";
+        }
+        ret = parent->acquire_buffer(pool, buffer, params);
+    }
+
+    if (ret == GST_FLOW_OK) {
+        self->counters->acquired++;
+    }
+
+    return ret;
+}
+
+static gboolean frame_pool_set_config(GstBufferPool *pool, GstStructure *config) {
+    FramePool *self = reinterpret_cast<FramePool*>(pool);
+    GstBufferPoolClass *parent = GST_BUFFER_POOL_CLASS(frame_pool_parent_class);
+
+    if (!parent->set_config(pool, config)) {
+        return FALSE;
+    }
+
+    guint size = 0, min_buffers = 0, max_buffers = 0;
+    if (gst_buffer_pool_config_get_params(config, NULL, &size, &min_buffers, &max_buffers)) {
+        self->counters->buffer_size = size;
+        self->counters->buffers = max_buffers;
+    }
+
+    return TRUE;
+}
+
+static void frame_pool_class_init(FramePoolClass *klass) {
+    GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    pool_class->acquire_buffer = frame_pool_acquire_buffer;
+    pool_class->set_config = frame_pool_set_config;
+}
+
+static void frame_pool_init(FramePool *self) {
+    self->counters = nullptr;
+}
+
+GstBufferPool *frame_pool_new(FramePoolCounters *counters) {
+    FramePool *pool = static_cast<FramePool*>(g_object_new(FRAME_TYPE_POOL, NULL));
+    pool->counters = counters;
+
+    // Pools are GstObjects, take ownership of the floating reference
+    gst_object_ref_sink(pool);
+
+    return GST_BUFFER_POOL(pool);
+}
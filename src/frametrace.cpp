@@ -0,0 +1,179 @@
+#include "inc/frametrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+FrameTracer::FrameTracer() {
+    for (Slot &slot : ring) {
+        slot.sequence.store(0, std::memory_order_relaxed);
+        for (auto &time : slot.times) {
+            time.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+int64_t FrameTracer::now_ns() {
+    // steady_clock is CLOCK_MONOTONIC, the same clock GStreamer's system clock uses
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *FrameTracer::stage_name(TraceStage stage) {
+    switch (stage) {
+        case TRACE_PTS:
+            return "pts";
+        case TRACE_ARRIVAL:
+            return "arrival";
+        case TRACE_CONVERTED:
+            return "converted";
+        case TRACE_PROCESSED:
+            return "processed";
+        case TRACE_HANDED:
+            return "handed";
+        case TRACE_PAINTED:
+            return "painted";
+        default:
+            return "unknown";
+    }
+}
+
+void FrameTracer::begin(quint64 sequence, int64_t pts_ns) {
+    Slot &slot = ring[sequence % CAPACITY];
+
+    // Invalidate first so readers never mix two frames in one record
+    slot.sequence.store(0, std::memory_order_release);
+    for (auto &time : slot.times) {
+        time.store(0, std::memory_order_relaxed);
+    }
+    slot.times[TRACE_PTS].store(pts_ns, std::memory_order_relaxed);
+    slot.times[TRACE_ARRIVAL].store(now_ns(), std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_release);
+}
+
+void FrameTracer::mark(quint64 sequence, TraceStage stage) {
+    mark(sequence, stage, now_ns());
+}
+
+void FrameTracer::mark(quint64 sequence, TraceStage stage, int64_t time_ns) {
+    Slot &slot = ring[sequence % CAPACITY];
+
+    // Frames that have already been lapped are ignored
+    if (slot.sequence.load(std::memory_order_acquire) != sequence) {
+        return;
+    }
+
+    slot.times[stage].store(time_ns, std::memory_order_relaxed);
+}
+
+std::vector<FrameTracer::Record> FrameTracer::snapshot() const {
+    std::vector<Record> records;
+    records.reserve(CAPACITY);
+
+    for (const Slot &slot : ring) {
+        Record record;
+        record.sequence = slot.sequence.load(std::memory_order_acquire);
+        if (record.sequence == 0) {
+            continue;
+        }
+
+        for (int i = 0; i < TRACE_STAGE_COUNT; ++i) {
+            record.times[i] = slot.times[i].load(std::memory_order_relaxed);
+        }
+
+        // Dropped if the slot was reused while being read
+        if (slot.sequence.load(std::memory_order_acquire) == record.sequence) {
+            records.push_back(record);
+        }
+    }
+
+    std::sort(records.begin(), records.end(), [](const Record &a, const Record &b) {
+        return a.sequence < b.sequence;
+    });
+
+    return records;
+}
+
+static LatencyStats percentiles(const std::string &name, std::vector<double> &values) {
+    LatencyStats stats;
+    stats.name = name;
+    stats.samples = values.size();
+
+    if (values.empty()) {
+        return stats;
+    }
+
+    std::sort(values.begin(), values.end());
+    auto at = [&values](double fraction) {
+        return values[std::min(values.size() - 1, size_t(fraction * double(values.size())))];
+    };
+
+    stats.p50_ms = at(0.50);
+    stats.p95_ms = at(0.95);
+    stats.p99_ms = at(0.99);
+
+    return stats;
+}
+
+std::vector<LatencyStats> FrameTracer::summarize(quint64 since) const {
+    // Steps of the frame path, the last one covers the whole of it
+    static const struct {
+        const char *name;
+        TraceStage from;
+        TraceStage to;
+    } steps[] = {
+        { "capture -> appsink", TRACE_PTS, TRACE_ARRIVAL },
+        { "appsink -> converted", TRACE_ARRIVAL, TRACE_CONVERTED },
+        { "converted -> processed", TRACE_CONVERTED, TRACE_PROCESSED },
+        { "converted -> GUI", TRACE_CONVERTED, TRACE_HANDED },
+        { "GUI -> painted", TRACE_HANDED, TRACE_PAINTED },
+        { "capture -> painted", TRACE_PTS, TRACE_PAINTED },
+    };
+
+    std::vector<Record> records = snapshot();
+    std::vector<LatencyStats> stats;
+
+    for (const auto &step : steps) {
+        std::vector<double> values;
+        values.reserve(records.size());
+
+        for (const Record &record : records) {
+            if (record.sequence <= since) {
+                continue;
+            }
+
+            int64_t from = record.times[step.from];
+            int64_t to = record.times[step.to];
+            if (from > 0 && to >= from) {
+                values.push_back(double(to - from) / 1e6);
+            }
+        }
+
+        stats.push_back(percentiles(step.name, values));
+    }
+
+    return stats;
+}
+
+bool FrameTracer::dump(const std::string &path) const {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    file << "sequence";
+    for (int i = 0; i < TRACE_STAGE_COUNT; ++i) {
+        file << "," << stage_name(static_cast<TraceStage>(i)) << "_ns";
+    }
+    file << "\n";
+
+    for (const Record &record : snapshot()) {
+        file << record.sequence;
+        for (int i = 0; i < TRACE_STAGE_COUNT; ++i) {
+            file << "," << record.times[i];
+        }
+        file << "\n";
+    }
+
+    return bool(file);
+}
@@ -0,0 +1,118 @@
+#include "inc/framewidget.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+
+FrameWidget::FrameWidget(QWidget *parent) :
+    QWidget(parent),
+    m_sequence(0),
+    m_paintedSequence(0),
+    m_overlayLocked(false),
+    m_selecting(false)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setMinimumSize(640, 480);
+}
+
+void FrameWidget::setFrame(const QImage &image, quint64 sequence) {
+    // Shares the image data, the previous frame is released here
+    m_frame = image;
+    m_sequence = sequence;
+    m_text.clear();
+    update();
+}
+
+void FrameWidget::clear(const QString &text) {
+    m_frame = QImage();
+    m_sequence = 0;
+    m_text = text;
+    update();
+}
+
+void FrameWidget::setOverlay(const QRectF &box, bool locked) {
+    m_overlay = box;
+    m_overlayLocked = locked;
+    update();
+}
+
+void FrameWidget::clearOverlay() {
+    m_overlay = QRectF();
+    update();
+}
+
+void FrameWidget::paintEvent(QPaintEvent *event) {
+    Q_UNUSED(event)
+
+    QPainter painter(this);
+
+    if (m_frame.isNull()) {
+        painter.fillRect(rect(), Qt::black);
+        painter.setPen(Qt::white);
+        painter.drawText(rect(), Qt::AlignCenter, m_text);
+        return;
+    }
+
+    // Scaled on the fly by the paint engine, no intermediate pixmap
+    painter.drawImage(rect(), m_frame);
+
+    // The frame fills the widget, so normalised boxes map straight onto it
+    if (!m_overlay.isEmpty()) {
+        QRectF box(m_overlay.x() * width(), m_overlay.y() * height(),
+                   m_overlay.width() * width(), m_overlay.height() * height());
+        painter.setPen(QPen(m_overlayLocked ? Qt::green : Qt::red, 2));
+        painter.drawRect(box);
+    }
+
+    if (m_selecting) {
+        painter.setPen(QPen(Qt::yellow, 1, Qt::DashLine));
+        painter.drawRect(QRect(m_selectionStart, m_selectionEnd).normalized());
+    }
+
+    // Repaints of the same frame (resize, expose) are not reported again
+    if (m_sequence != 0 && m_sequence != m_paintedSequence) {
+        m_paintedSequence = m_sequence;
+        emit framePainted(m_sequence);
+    }
+}
+
+void FrameWidget::mousePressEvent(QMouseEvent *event) {
+    if (event->button() != Qt::LeftButton || m_frame.isNull()) {
+        QWidget::mousePressEvent(event);
+        return;
+    }
+
+    m_selecting = true;
+    m_selectionStart = event->position().toPoint();
+    m_selectionEnd = m_selectionStart;
+    update();
+}
+
+void FrameWidget::mouseMoveEvent(QMouseEvent *event) {
+    if (!m_selecting) {
+        QWidget::mouseMoveEvent(event);
+        return;
+    }
+
+    m_selectionEnd = event->position().toPoint();
+    update();
+}
+
+void FrameWidget::mouseReleaseEvent(QMouseEvent *event) {
+    if (!m_selecting || event->button() != Qt::LeftButton) {
+        QWidget::mouseReleaseEvent(event);
+        return;
+    }
+
+    m_selecting = false;
+    m_selectionEnd = event->position().toPoint();
+    update();
+
+    QRect selection = QRect(m_selectionStart, m_selectionEnd).normalized() & rect();
+    if (selection.width() < 4 || selection.height() < 4) {
+        return;
+    }
+
+    emit regionSelected(QRectF(double(selection.x()) / width(), double(selection.y()) / height(),
+                               double(selection.width()) / width(), double(selection.height()) / height()));
+}
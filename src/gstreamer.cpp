@@ -4,119 +4,1333 @@ using namespace cv;
 
 static gboolean bus_callback(GstBus *bus, GstMessage *message, gpointer data);
 GstFlowReturn new_sample_callback(GstElement *sink, gpointer data);
+GstPadProbeReturn allocation_query_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+GstPadProbeReturn count_buffer_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+GstPadProbeReturn crop_caps_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+GstPadProbeReturn standby_gate_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
 
-GstreamerCameraCapture::GstreamerCameraCapture() :
+static void pad_added_callback(GstElement *element, GstPad *pad, gpointer data);
+
+static QImage::Format qimage_format(GstVideoFormat format) {
+    switch (format) {
+        case GST_VIDEO_FORMAT_RGB:
+            return QImage::Format_RGB888;
+        case GST_VIDEO_FORMAT_BGR:
+            return QImage::Format_BGR888;
+        case GST_VIDEO_FORMAT_RGBx:
+            return QImage::Format_RGBX8888;
+        case GST_VIDEO_FORMAT_RGBA:
+            return QImage::Format_RGBA8888;
+        case GST_VIDEO_FORMAT_BGRx:
+            return QImage::Format_RGB32;
+        case GST_VIDEO_FORMAT_BGRA:
+            return QImage::Format_ARGB32;
+        case GST_VIDEO_FORMAT_GRAY8:
+            return QImage::Format_Grayscale8;
+        default:
+            return QImage::Format_Invalid;
+    }
+}
+
+// What convert_sample handles, offered to upstream in this order
+static const GstVideoFormat NATIVE_FORMATS[] = {
+    GST_VIDEO_FORMAT_RGB, GST_VIDEO_FORMAT_BGR, GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_NV12
+};
+
+static bool is_native_format(GstVideoFormat format) {
+    for (GstVideoFormat native : NATIVE_FORMATS) {
+        if (native == format)
+            return true;
+    }
+    return false;
+}
+
+// Source caps until a mode is chosen. Files and pushed frames keep their
+// own rate, only live sources are pinned, to 30 fps
+static GstCaps *default_source_caps() {
+    return gst_caps_new_simple("video/x-raw", "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+}
+
+GstCaps *VideoMode::to_caps() const {
+    GstCaps *caps = is_compressed()
+        ? gst_caps_new_empty_simple("image/jpeg")
+        : gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, format.c_str(), NULL);
+
+    gst_caps_set_simple(caps,
+                        "width", G_TYPE_INT, width,
+                        "height", G_TYPE_INT, height,
+                        "framerate", GST_TYPE_FRACTION, fps_n, fps_d,
+                        NULL);
+    return caps;
+}
+
+std::string VideoMode::to_string() const {
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.4g", fps_d ? double(fps_n) / fps_d : 0.0);
+
+    return format + " " + std::to_string(width) + "x" + std::to_string(height) +
+           " @ " + rate + " fps";
+}
+
+bool VideoMode::operator<(const VideoMode &other) const {
+    // Largest and fastest modes first
+    if (width * height != other.width * other.height)
+        return width * height > other.width * other.height;
+    if (int64_t(fps_n) * other.fps_d != int64_t(other.fps_n) * fps_d)
+        return int64_t(fps_n) * other.fps_d > int64_t(other.fps_n) * fps_d;
+    return format < other.format;
+}
+
+bool VideoMode::operator==(const VideoMode &other) const {
+    return format == other.format && width == other.width && height == other.height &&
+           fps_n == other.fps_n && fps_d == other.fps_d;
+}
+
+GstreamerCameraCapture::GstreamerCameraCapture(const CaptureSource &source_config,
+                                               ConvertBackend backend, QObject *parent) :
+    QObject(parent),
     pipeline(nullptr),
     source(nullptr),
     convert(nullptr),
     scale(nullptr),
     sink(nullptr),
-    frame_ready(false)
+    source_filter(nullptr),
+    decoder(nullptr),
+    rate(nullptr),
+    crop(nullptr),
+    source_config(source_config),
+    backend(backend),
+    has_mode(false),
+    negotiated_caps(nullptr),
+    negotiated_format(QImage::Format_Invalid),
+    negotiated_mat_type(-1),
+    recording_source(RecordRaw),
+    convert_pool(nullptr),
+    bus_watch(nullptr),
+    health(source_config.to_string()),
+    backpressure(source_config.to_string()),
+    degrade_level(DegradeNone),
+    analysis_stride(1),
+    load_received(0),
+    load_dropped(0),
+    load_stage_dropped(0),
+    load_sequence(0),
+    controls_ready(false),
+    digital_zoom(1.0),
+    crop_input_width(0),
+    crop_input_height(0),
+    signal_pending(false),
+    frame_sequence(0),
+    frames_refused(0),
+    worker_running(false),
+    pending_tasks(0),
+    capturing(false),
+    busy(false),
+    failed(false),
+    standby(StandbyHot),
+    live(source_config.kind != CaptureSource::Uri),
+    gated(false),
+    prepare_start_ns(0),
+    run_start_ns(0),
+    first_frame_pending(false),
+    prepare_ms(0),
+    first_frame_ms(0),
+    starts(0)
 {
-    gst_init(NULL, NULL);
+    CaptureScheduler &scheduler = CaptureScheduler::instance();
+
+    register_default_stages(this->processing);
+    this->processing.set_tracer(&this->tracer);
+    this->processing.set_result_sink([this](const QImage &image, quint64 sequence, int64_t capture_ns) {
+        Q_UNUSED(sequence)
+        if (recording_source.load() == RecordProcessed) {
+            this->recorder.submit(image, capture_ns);
+        }
+    });
+
+    // Create source pipeline
+    this->pipeline = gst_pipeline_new("src_pipeline");
+    // The native backend converts in new_frame, the pipeline only passes frames through
+    if (this->backend == NativeConvert && !color_convert_self_test()) {
+        LOG_WARNING("capture") << "Native colour conversion failed its self test, using videoconvert";
+        this->backend = VideoConvert;
+    }
+
+    if (this->backend == NativeConvert) {
+        LOG_INFO("capture") << "Native colour conversion (" << color_convert_isa() << ")";
+        this->convert = gst_element_factory_make("identity", "src_convert");
+    } else {
+        this->convert = gst_element_factory_make("videoconvert", "src_convert");
+    }
+    this->scale = gst_element_factory_make("videoscale", "src_scale");
+    this->sink = gst_element_factory_make("appsink", "src_sink");
+    this->rate = gst_element_factory_make("videorate", "src_rate");
+    this->crop = gst_element_factory_make("videocrop", "src_crop");
+    
+    // Check src pipeline elements
+    if (!this->pipeline || !this->convert || !this->scale || !this->sink || !this->rate || !this->crop) {
+        LOG_ERROR("capture") << "Failed to create src pipeline elements!";
+
+        GstElement *elements[] = { this->convert, this->scale, this->sink, this->rate, this->crop };
+        for (GstElement *element : elements) {
+            if (element) {
+                gst_object_unref(gst_object_ref_sink(element));
+            }
+        }
+        if (this->pipeline) {
+            gst_object_unref(this->pipeline);
+            this->pipeline = nullptr;
+        }
+        return;
+    }
+
+    // Owned by the bin from here on, dropping the pipeline on a failure
+    // below releases them with it
+    gst_bin_add_many(GST_BIN(this->pipeline), this->rate, this->crop, this->convert, this->scale,
+                     this->sink, NULL);
+
+    if (!this->create_source()) {
+        LOG_ERROR("capture") << "Failed to create source: " << source_config.to_string();
+        gst_object_unref(this->pipeline);
+        this->pipeline = nullptr;
+        return;
+    }
+    
+    // Configure appsink to receive frames
+    g_object_set(G_OBJECT(this->sink), "emit-signals", TRUE, NULL);
+    g_object_set(G_OBJECT(this->sink), "max-buffers", 1, NULL);
+    g_object_set(G_OBJECT(this->sink), "drop", TRUE, NULL);
+    // Late buffers dropped by the sink are reported on the bus
+    g_object_set(G_OBJECT(this->sink), "qos", TRUE, NULL);
+    
+    // Set video format
+    GstCaps *caps = this->output_caps();
+    
+    // Set caps for appsink and appsrc
+    gst_app_sink_set_caps(GST_APP_SINK(this->sink), caps);
+    g_signal_connect(this->sink, "new-sample", G_CALLBACK(new_sample_callback), this);
+
+    // Offer our own buffer pool to the elements feeding the appsink
+    GstPad *sink_pad = gst_element_get_static_pad(this->sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+                      allocation_query_probe, this, NULL);
+    gst_object_unref(sink_pad);
+
+    // Only ever drops, and only when backpressure caps the rate
+    g_object_set(G_OBJECT(this->rate), "drop-only", TRUE, NULL);
+
+    // The crop is given in pixels, it follows the size coming in
+    GstPad *crop_pad = gst_element_get_static_pad(this->crop, "sink");
+    gst_pad_add_probe(crop_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, crop_caps_probe, this, NULL);
+    gst_object_unref(crop_pad);
+
+    // Counts what reaches conversion, past the rate limiter and the crop
+    GstPad *convert_pad = gst_element_get_static_pad(this->convert, "sink");
+    gst_pad_add_probe(convert_pad, GST_PAD_PROBE_TYPE_BUFFER, count_buffer_probe, this, NULL);
+    gst_object_unref(convert_pad);
+
+    // Hot standby drops frames before anything decodes or converts them
+    GstPad *gate_pad = this->source_filter
+        ? gst_element_get_static_pad(this->source_filter, "src")
+        : gst_element_get_static_pad(this->rate, "sink");
+    gst_pad_add_probe(gate_pad, GST_PAD_PROBE_TYPE_BUFFER, standby_gate_probe, this, NULL);
+    gst_object_unref(gate_pad);
+    
+    // Link src pipeline elements, decodebin sources are linked once their pad shows up
+    bool linked = gst_element_link_many(this->rate, this->crop, this->convert, this->scale,
+                                        this->sink, NULL);
+    if (linked && this->source_filter) {
+        linked = gst_element_link(this->source, this->source_filter) &&
+                 this->link_source_branch();
+    } else if (linked && source_config.kind == CaptureSource::AppSrc) {
+        linked = gst_element_link(this->source, this->rate);
+    }
+
+    if (!linked) {
+        LOG_ERROR("capture") << "Src pipeline elements cannot be linked!";
+        gst_caps_unref(caps);
+        gst_object_unref(this->pipeline);
+        this->pipeline = nullptr;
+        return;
+    }
+     
+    GstBus *src_bus = gst_element_get_bus(this->pipeline);
+    this->bus_watch = scheduler.add_bus_watch(src_bus, bus_callback, &this->health);
+    gst_object_unref(src_bus);
+
+    // The watchdog only schedules the restart, the state worker carries it out
+    this->health.attach(this->pipeline, [this]() {
+        return this->post_state_task(TaskRestart);
+    });
+    // Pushed frames stop whenever the caller stops pushing
+    this->health.set_restart_on_stall(source_config.kind != CaptureSource::AppSrc);
+    this->backpressure.attach([this]() {
+        return this->sample_load();
+    }, [this](DegradeLevel level) {
+        this->apply_degrade(level);
+    });
+
+    gst_caps_unref(caps);
+
+    this->worker_running = true;
+    this->state_worker = std::thread(&GstreamerCameraCapture::run_state_worker, this);
+
+    LOG_INFO("capture") << "Pipeline initialized (" << source_config.to_string() << ")";
+}
+
+// Creates the source element described by source_config and adds it to the pipeline
+bool GstreamerCameraCapture::create_source() {
+    switch (source_config.kind) {
+        case CaptureSource::V4L2:
+            this->source = gst_element_factory_make("v4l2src", "src_source");
+            if (this->source && !source_config.location.empty()) {
+                g_object_set(G_OBJECT(this->source), "device", source_config.location.c_str(), NULL);
+            }
+            break;
+
+        case CaptureSource::TestPattern:
+            this->source = gst_element_factory_make("videotestsrc", "src_source");
+            if (this->source) {
+                g_object_set(G_OBJECT(this->source), "is-live", TRUE, NULL);
+                gst_util_set_object_arg(G_OBJECT(this->source), "pattern", source_config.location.c_str());
+            }
+            break;
+
+        case CaptureSource::Uri: {
+            this->source = gst_element_factory_make("uridecodebin", "src_source");
+            if (!this->source)
+                break;
+
+            std::string uri = source_config.location;
+            if (!gst_uri_is_valid(uri.c_str())) {
+                gchar *file_uri = gst_filename_to_uri(uri.c_str(), NULL);
+                if (!file_uri) {
+                    gst_object_unref(this->source);
+                    this->source = nullptr;
+                    break;
+                }
+                uri = file_uri;
+                g_free(file_uri);
+            }
+
+            g_object_set(G_OBJECT(this->source), "uri", uri.c_str(), NULL);
+            g_signal_connect(this->source, "pad-added", G_CALLBACK(pad_added_callback), this->rate);
+            break;
+        }
+
+        case CaptureSource::AppSrc:
+            this->source = gst_element_factory_make("appsrc", "src_source");
+            if (this->source) {
+                g_object_set(G_OBJECT(this->source),
+                             "is-live", TRUE,
+                             "do-timestamp", TRUE,
+                             "format", GST_FORMAT_TIME,
+                             NULL);
+            }
+            break;
+    }
+
+    if (!this->source)
+        return false;
+
+    gst_bin_add(GST_BIN(this->pipeline), this->source);
+
+    // Camera modes are selected with a capsfilter right behind the source
+    if (source_config.kind == CaptureSource::V4L2 ||
+        source_config.kind == CaptureSource::TestPattern) {
+        this->source_filter = gst_element_factory_make("capsfilter", "src_filter");
+        if (!this->source_filter)
+            return false;
+        gst_bin_add(GST_BIN(this->pipeline), this->source_filter);
+
+        GstCaps *rate_caps = default_source_caps();
+        g_object_set(G_OBJECT(this->source_filter), "caps", rate_caps, NULL);
+        gst_caps_unref(rate_caps);
+    }
+
+    return true;
+}
+
+// Caps requested by the appsink. The output format is fixed here, once,
+// so the frame path never has to inspect format strings.
+GstCaps *GstreamerCameraCapture::output_caps() const {
+    int width = has_mode ? current_mode.width : 640;
+    int height = has_mode ? current_mode.height : 480;
+
+    // Scaled down by videoscale under backpressure, kept even for the 4:2:0 formats
+    if (degrade_level.load() >= DegradeResolution) {
+        width = (width / 2) & ~1;
+        height = (height / 2) & ~1;
+    }
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                       "format", G_TYPE_STRING, "RGB",
+                                       "width", G_TYPE_INT, width,
+                                       "height", G_TYPE_INT, height,
+                                       NULL);
+
+    // The native kernels take the camera formats as they are, RGB stays preferred
+    if (this->backend == NativeConvert) {
+        GValue list = G_VALUE_INIT;
+        gst_value_list_init(&list, G_N_ELEMENTS(NATIVE_FORMATS));
+
+        for (GstVideoFormat format : NATIVE_FORMATS) {
+            GValue value = G_VALUE_INIT;
+            g_value_init(&value, G_TYPE_STRING);
+            g_value_set_static_string(&value, gst_video_format_to_string(format));
+            gst_value_list_append_and_take_value(&list, &value);
+        }
+
+        gst_caps_set_value(caps, "format", &list);
+        g_value_unset(&list);
+    }
+
+    // No framerate here, the source capsfilter pins it and videorate may
+    // lower it under backpressure
+    return caps;
+}
+
+// Links the capsfilter to the rate limiter, through jpegdec for compressed modes
+bool GstreamerCameraCapture::link_source_branch() {
+    bool compressed = has_mode && current_mode.is_compressed();
+
+    if (compressed && !this->decoder) {
+        this->decoder = gst_element_factory_make("jpegdec", "src_decoder");
+        if (!this->decoder) {
+            LOG_WARNING("capture") << "jpegdec is not available for " << current_mode.to_string();
+            return false;
+        }
+        gst_bin_add(GST_BIN(this->pipeline), this->decoder);
+    }
+
+    if (compressed) {
+        return gst_element_link_many(this->source_filter, this->decoder, this->rate, NULL);
+    }
+
+    return gst_element_link(this->source_filter, this->rate);
+}
+
+// Lists the modes the source can produce natively
+std::vector<VideoMode> GstreamerCameraCapture::enumerate_modes() {
+    std::vector<VideoMode> modes;
+
+    if (!this->pipeline) {
+        return modes;
+    }
+
+    if (source_config.kind == CaptureSource::TestPattern) {
+        // videotestsrc produces anything, offer what our cameras do
+        const char *formats[] = { "YUY2", "NV12", "RGB" };
+        const int sizes[][2] = { {640, 480}, {1280, 720}, {1920, 1080} };
+        const int rates[] = { 30, 60 };
+
+        for (const char *format : formats) {
+            for (const auto &size : sizes) {
+                for (int rate : rates) {
+                    modes.push_back(VideoMode{format, size[0], size[1], rate, 1});
+                }
+            }
+        }
+        return modes;
+    }
+
+    if (source_config.kind != CaptureSource::V4L2) {
+        return modes;
+    }
+
+    // The device is only probed once v4l2src has opened it
+    GstState state = GST_STATE_NULL;
+    gst_element_get_state(this->source, &state, NULL, 0);
+    if (state < GST_STATE_READY) {
+        gst_element_set_state(this->source, GST_STATE_READY);
+    }
+
+    GstPad *src_pad = gst_element_get_static_pad(this->source, "src");
+    GstCaps *caps = gst_pad_query_caps(src_pad, NULL);
+    gst_object_unref(src_pad);
+
+    for (guint i = 0; caps && i < gst_caps_get_size(caps); ++i) {
+        append_modes(gst_caps_get_structure(caps, i), modes);
+    }
+
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+
+    if (state < GST_STATE_READY) {
+        gst_element_set_state(this->source, state);
+    }
+
+    std::sort(modes.begin(), modes.end());
+    modes.erase(std::unique(modes.begin(), modes.end()), modes.end());
+
+    return modes;
+}
+
+// Expands one caps structure into fixed modes, framerate lists become one
+// mode per rate and ranges use their upper bound
+void GstreamerCameraCapture::append_modes(const GstStructure *structure, std::vector<VideoMode> &modes) {
+    VideoMode mode;
+    const gchar *name = gst_structure_get_name(structure);
+
+    if (g_str_equal(name, "image/jpeg")) {
+        mode.format = "MJPG";
+    } else if (g_str_equal(name, "video/x-raw")) {
+        const gchar *format = gst_structure_get_string(structure, "format");
+        if (!format)
+            return;
+        mode.format = format;
+    } else {
+        return;
+    }
+
+    if (!gst_structure_get_int(structure, "width", &mode.width) ||
+        !gst_structure_get_int(structure, "height", &mode.height)) {
+        return;
+    }
+
+    const GValue *framerate = gst_structure_get_value(structure, "framerate");
+    if (!framerate) {
+        return;
+    }
+
+    if (GST_VALUE_HOLDS_FRACTION(framerate)) {
+        mode.fps_n = gst_value_get_fraction_numerator(framerate);
+        mode.fps_d = gst_value_get_fraction_denominator(framerate);
+        modes.push_back(mode);
+    } else if (GST_VALUE_HOLDS_LIST(framerate)) {
+        for (guint i = 0; i < gst_value_list_get_size(framerate); ++i) {
+            const GValue *rate = gst_value_list_get_value(framerate, i);
+            if (!GST_VALUE_HOLDS_FRACTION(rate))
+                continue;
+            mode.fps_n = gst_value_get_fraction_numerator(rate);
+            mode.fps_d = gst_value_get_fraction_denominator(rate);
+            modes.push_back(mode);
+        }
+    } else if (GST_VALUE_HOLDS_FRACTION_RANGE(framerate)) {
+        const GValue *max = gst_value_get_fraction_range_max(framerate);
+        mode.fps_n = gst_value_get_fraction_numerator(max);
+        mode.fps_d = gst_value_get_fraction_denominator(max);
+        modes.push_back(mode);
+    }
+}
+
+void GstreamerCameraCapture::set_mode(const VideoMode &mode) {
+    this->request_mode(mode);
+}
+
+void GstreamerCameraCapture::reset_mode() {
+    this->request_mode(std::nullopt);
+}
+
+// The newest request wins when several arrive before the worker gets to them
+void GstreamerCameraCapture::request_mode(const std::optional<VideoMode> &mode) {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        this->pending_mode = mode;
+    }
+
+    if (!this->post_state_task(TaskMode)) {
+        emit modeApplied(false);
+    }
+}
+
+// Runs on the state worker. Switches the source to a native mode, or back
+// to the default caps for nullptr. The pipeline goes down to READY for the
+// relink without state_mutex, then to whatever run() and stop() asked for
+// meanwhile. When the new mode cannot be linked the previous one is put
+// back, and when that fails too the camera is marked failed.
+bool GstreamerCameraCapture::switch_mode(const VideoMode *mode) {
+    if (!this->pipeline || !this->source_filter) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> state_lock(state_mutex);
+        this->busy = true;
+        this->gated.store(false);
+    }
+
+    std::string name = mode ? mode->to_string() : "default";
+
+    VideoMode previous_mode;
+    bool had_mode = false;
+    {
+        std::lock_guard<std::mutex> lock(mode_mutex);
+        previous_mode = this->current_mode;
+        had_mode = this->has_mode;
+    }
+
+    gst_element_set_state(this->pipeline, GST_STATE_READY);
+
+    this->unlink_source_branch();
+    this->apply_source_caps(mode);
+    bool linked = this->link_source_branch();
+    bool restored = false;
+
+    if (!linked) {
+        LOG_ERROR("capture") << "Cannot link source for mode " << name << ", keeping the previous one";
+
+        this->unlink_source_branch();
+        this->apply_source_caps(had_mode ? &previous_mode : nullptr);
+        linked = this->link_source_branch();
+        restored = true;
+    }
+
+    if (!linked) {
+        LOG_ERROR("capture") << "Cannot relink the previous source mode either, "
+            << source_config.to_string() << " stays closed until a mode applies";
+        gst_element_set_state(this->pipeline, GST_STATE_NULL);
+    } else if (this->decoder) {
+        gst_element_sync_state_with_parent(this->decoder);
+    }
+
+    {
+        std::lock_guard<std::mutex> state_lock(state_mutex);
+        this->busy = false;
+        this->failed = !linked;
+
+        if (this->failed) {
+            this->health.set_active(false);
+        } else if (this->capturing) {
+            this->start_pipeline();
+        } else {
+            this->enter_standby();
+        }
+    }
+
+    this->health.reset_stream();
+    if (!linked || restored) {
+        return false;
+    }
+
+    LOG_INFO("capture") << "Capture mode set to " << name;
+    return true;
+}
+
+// Takes the capsfilter to rate limiter branch apart, the decoder goes with it
+void GstreamerCameraCapture::unlink_source_branch() {
+    if (this->decoder) {
+        gst_element_unlink_many(this->source_filter, this->decoder, this->rate, NULL);
+        gst_element_set_state(this->decoder, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(this->pipeline), this->decoder);
+        this->decoder = nullptr;
+    } else {
+        gst_element_unlink(this->source_filter, this->rate);
+    }
+}
+
+// Source and appsink caps for a mode, or the defaults for nullptr
+void GstreamerCameraCapture::apply_source_caps(const VideoMode *mode) {
+    std::lock_guard<std::mutex> lock(mode_mutex);
+
+    if (mode) {
+        this->current_mode = *mode;
+    }
+    this->has_mode = (mode != nullptr);
+
+    GstCaps *source_caps = mode ? mode->to_caps() : default_source_caps();
+    g_object_set(G_OBJECT(this->source_filter), "caps", source_caps, NULL);
+    gst_caps_unref(source_caps);
+
+    GstCaps *caps = this->output_caps();
+    gst_app_sink_set_caps(GST_APP_SINK(this->sink), caps);
+    gst_caps_unref(caps);
+}
+
+// Caches everything derived from the negotiated caps, called per sample
+// but only does work when the caps object actually changes
+bool GstreamerCameraCapture::update_negotiated_caps(GstCaps *caps) {
+    if (caps == this->negotiated_caps) {
+        return negotiated_mat_type >= 0;
+    }
+
+    gst_caps_replace(&this->negotiated_caps, caps);
+    negotiated_format = QImage::Format_Invalid;
+    negotiated_mat_type = -1;
+
+    if (!caps || !gst_video_info_from_caps(&negotiated_info, caps)) {
+        LOG_ERROR("capture") << "Cannot get video info from caps";
+        return false;
+    }
+
+    GstVideoFormat format = GST_VIDEO_INFO_FORMAT(&negotiated_info);
+    int mat_type = -1;
+    switch (format) {
+        case GST_VIDEO_FORMAT_GRAY8:
+        case GST_VIDEO_FORMAT_NV12:
+            // Luma plane only for NV12
+            mat_type = CV_8UC1;
+            break;
+        case GST_VIDEO_FORMAT_YUY2:
+            mat_type = CV_8UC2;
+            break;
+        case GST_VIDEO_FORMAT_RGB:
+        case GST_VIDEO_FORMAT_BGR:
+            mat_type = CV_8UC3;
+            break;
+        case GST_VIDEO_FORMAT_RGBx:
+        case GST_VIDEO_FORMAT_RGBA:
+        case GST_VIDEO_FORMAT_BGRx:
+        case GST_VIDEO_FORMAT_BGRA:
+            mat_type = CV_8UC4;
+            break;
+        default:
+            break;
+    }
+
+    // The output caps only offer what the backend handles, this catches
+    // anything that still gets through, once per caps change
+    bool usable = (this->backend == NativeConvert)
+        ? is_native_format(format)
+        : qimage_format(format) != QImage::Format_Invalid;
+    if (mat_type < 0 || !usable) {
+        LOG_ERROR("capture") << "Unsupported sample format " << GST_VIDEO_INFO_NAME(&negotiated_info)
+            << ", its frames are dropped";
+        return false;
+    }
+
+    negotiated_format = qimage_format(format);
+    negotiated_mat_type = mat_type;
+
+    LOG_INFO("capture") << "Negotiated " << GST_VIDEO_INFO_NAME(&negotiated_info) << " "
+        << GST_VIDEO_INFO_WIDTH(&negotiated_info) << "x"
+        << GST_VIDEO_INFO_HEIGHT(&negotiated_info);
+    return true;
+}
+
+// Pushes a BGR frame into the pipeline when running with an appsrc source
+bool GstreamerCameraCapture::push_frame(const Mat &frame) {
+    if (source_config.kind != CaptureSource::AppSrc || !this->pipeline) {
+        return false;
+    }
+
+    if (frame.empty() || frame.type() != CV_8UC3) {
+        LOG_ERROR("capture") << "push_frame expects a non-empty BGR frame";
+        return false;
+    }
+
+    // Caps only need to be updated when the frame size changes
+    if (frame.size() != pushed_size) {
+        GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                           "format", G_TYPE_STRING, "BGR",
+                                           "width", G_TYPE_INT, frame.cols,
+                                           "height", G_TYPE_INT, frame.rows,
+                                           "framerate", GST_TYPE_FRACTION, 0, 1,
+                                           NULL);
+        gst_app_src_set_caps(GST_APP_SRC(this->source), caps);
+        gst_caps_unref(caps);
+        pushed_size = frame.size();
+    }
+
+    GstBuffer *buffer = this->mat_to_gst_buffer(frame);
+    if (!buffer) {
+        return false;
+    }
+
+    // appsrc takes ownership of the buffer
+    return gst_app_src_push_buffer(GST_APP_SRC(this->source), buffer) == GST_FLOW_OK;
+}
+
+GstreamerCameraCapture::~GstreamerCameraCapture() {
+    // The watch holds the bus, and with it the pipeline's, until removed
+    CaptureScheduler::instance().remove_source(this->bus_watch);
+    this->health.detach();
+    this->backpressure.detach();
+
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        this->worker_running = false;
+    }
+    this->worker_wake.notify_all();
+    if (this->state_worker.joinable()) {
+        this->state_worker.join();
+    }
+
+    if (this->pipeline) {
+        gst_element_set_state(this->pipeline, GST_STATE_NULL);
+        gst_object_unref(GST_OBJECT(this->pipeline));
+    }
+
+    // The last processing worker feeds the recorder, stop it while both exist
+    this->processing.stop();
+    this->tracking.stop();
+
+    if (this->negotiated_caps) {
+        gst_caps_unref(this->negotiated_caps);
+    }
+
+    if (this->convert_pool) {
+        gst_buffer_pool_set_active(this->convert_pool, FALSE);
+        gst_object_unref(this->convert_pool);
+    }
+}
+
+void GstreamerCameraCapture::run() {
+    if (!this->pipeline) {
+        LOG_ERROR("capture") << "Pipeline is not initialized!";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    this->capturing = true;
+    this->starts.fetch_add(1);
+
+    signal_pending.store(false);
+    this->run_start_ns = FrameTracer::now_ns();
+    this->first_frame_pending.store(true);
+
+    // The state worker owns the pipeline until it is done, and starts it then
+    if (this->busy) {
+        LOG_INFO("capture") << "Starting once " << source_config.to_string() << " is set up";
+        return;
+    }
+
+    if (this->failed) {
+        LOG_ERROR("capture") << source_config.to_string() << " has no working mode, choose another one";
+        return;
+    }
+
+    this->start_pipeline();
+}
+
+// Called with state_mutex held, once capturing is set
+void GstreamerCameraCapture::start_pipeline() {
+    this->health.set_active(true);
+
+    // A live source in hot standby is already streaming, opening the gate is all it takes
+    if (this->gated.exchange(false)) {
+        LOG_INFO("capture") << "Pipeline started from hot standby, capturing video...";
+        return;
+    }
+
+    // Start pipeline
+    GstStateChangeReturn src_ret = gst_element_set_state(this->pipeline, GST_STATE_PLAYING);
+    
+    if (src_ret == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("capture") << "Failed to start pipeline!";
+        return;
+    }
+    
+    LOG_INFO("capture") << "Pipeline started, capturing video...";
+}
+
+void GstreamerCameraCapture::prepare() {
+    if (!this->pipeline || this->prepare_start_ns != 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        this->busy = true;
+    }
+
+    this->prepare_start_ns = FrameTracer::now_ns();
+    this->post_state_task(TaskPrepare);
+}
+
+// False once the worker is gone, the task is dropped then
+bool GstreamerCameraCapture::post_state_task(StateTask task) {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        if (!this->worker_running) {
+            return false;
+        }
+        this->pending_tasks |= task;
+    }
+
+    this->worker_wake.notify_one();
+    return true;
+}
+
+// Every slow state change of the pipeline runs here, one at a time, so
+// neither the GUI nor the shared scheduler thread ever waits on a device
+void GstreamerCameraCapture::run_state_worker() {
+    std::unique_lock<std::mutex> lock(worker_mutex);
+
+    while (true) {
+        worker_wake.wait(lock, [this]() { return !worker_running || pending_tasks != 0; });
+        if (!worker_running) {
+            break;
+        }
+
+        unsigned tasks = pending_tasks;
+        std::optional<VideoMode> mode = pending_mode;
+        pending_tasks = 0;
+        lock.unlock();
+
+        if (tasks & TaskPrepare) {
+            this->prepare_standby();
+        }
+        if (tasks & TaskMode) {
+            bool applied = this->switch_mode(mode ? &*mode : nullptr);
+            emit modeApplied(applied);
+        }
+        if (tasks & TaskRestart) {
+            this->restart_pipeline();
+        }
+
+        lock.lock();
+    }
+}
+
+// Runs on the state worker, the device is opened once for probing and
+// standby. Nothing else touches the pipeline's state while busy is set,
+// so the slow part runs without state_mutex.
+void GstreamerCameraCapture::prepare_standby() {
+    if (source_config.kind == CaptureSource::V4L2) {
+        this->controls.open(source_config.location.empty() ? "/dev/video0" : source_config.location);
+    }
+    this->controls_ready.store(true);
+
+    bool ok = gst_element_set_state(this->pipeline, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE;
+    if (!ok) {
+        LOG_ERROR("capture") << "Cannot open " << source_config.to_string();
+    }
+
+    std::vector<VideoMode> modes = this->enumerate_modes();
+    {
+        std::lock_guard<std::mutex> mode_lock(mode_mutex);
+        this->probed_modes = modes;
+    }
+
+    StandbyMode mode;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        this->busy = false;
+        mode = this->standby;
+
+        // Start was pressed meanwhile
+        if (this->capturing) {
+            this->start_pipeline();
+        } else if (ok) {
+            ok = this->enter_standby();
+        }
+    }
+
+    if (ok) {
+        this->prepare_ms.store((FrameTracer::now_ns() - this->prepare_start_ns) / 1e6);
+        LOG_INFO("capture") << source_config.to_string() << " prepared in "
+            << this->prepare_ms.load() << " ms, " << standby_name(mode)
+            << (this->live.load() ? "" : ", pre-rolled");
+    }
+
+    emit prepared(ok);
+}
+
+// Takes the stopped pipeline to the standby state, called with state_mutex
+// held. Never waits for the state change to complete.
+bool GstreamerCameraCapture::enter_standby() {
+    GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+
+    switch (this->standby) {
+    case StandbyHot: {
+        // A live source that is streaming already only needs the gate closed
+        GstState state = GST_STATE_NULL;
+        gst_element_get_state(this->pipeline, &state, NULL, 0);
+        if (this->live.load() && state == GST_STATE_PLAYING) {
+            this->gated.store(true);
+            break;
+        }
+
+        // A file pre-rolls its first frame into the appsink in the background,
+        // a live source says right away that it cannot
+        ret = gst_element_set_state(this->pipeline, GST_STATE_PAUSED);
+        if (ret == GST_STATE_CHANGE_NO_PREROLL) {
+            this->live.store(true);
+        }
+
+        // Live sources produce nothing until PLAYING, keep them streaming behind the gate
+        if (ret != GST_STATE_CHANGE_FAILURE && this->live.load()) {
+            this->gated.store(true);
+            ret = gst_element_set_state(this->pipeline, GST_STATE_PLAYING);
+        }
+        break;
+    }
+
+    case StandbyReady:
+        this->gated.store(false);
+        ret = gst_element_set_state(this->pipeline, GST_STATE_READY);
+        break;
+
+    case StandbyClosed:
+        this->gated.store(false);
+        ret = gst_element_set_state(this->pipeline, GST_STATE_NULL);
+        break;
+    }
+
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("capture") << "Failed to bring " << source_config.to_string() << " to standby";
+        return false;
+    }
+
+    return true;
+}
+
+const char *GstreamerCameraCapture::standby_name(StandbyMode mode) {
+    switch (mode) {
+    case StandbyHot: return "hot standby";
+    case StandbyReady: return "device open";
+    case StandbyClosed: return "device closed";
+    }
+    return "?";
+}
+
+void GstreamerCameraCapture::set_standby_mode(StandbyMode mode) {
+    if (!this->pipeline) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (this->standby == mode) {
+        return;
+    }
 
-    // Create source pipeline
-    this->pipeline = gst_pipeline_new("src_pipeline");
-    this->source = gst_element_factory_make("v4l2src", "src_source");
-    this->convert = gst_element_factory_make("videoconvert", "src_convert");
-    this->scale = gst_element_factory_make("videoscale", "src_scale");
-    this->sink = gst_element_factory_make("appsink", "src_sink");
-    
-    // Check src pipeline elements
-    if (!this->pipeline || !this->source || !this->convert || 
-        !this->scale || !this->sink) {
-        std::cerr << "Failed to create src pipeline elements!" << std::endl;
+    this->standby = mode;
+    if (!this->capturing && !this->busy && !this->failed) {
+        this->enter_standby();
+    }
+}
+
+StartupStats GstreamerCameraCapture::startup_stats() const {
+    StartupStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stats.standby = this->standby;
+    }
+    stats.prepared = this->prepare_ms.load() > 0;
+    stats.prepare_ms = this->prepare_ms.load();
+    stats.first_frame_ms = this->first_frame_ms.load();
+    stats.starts = this->starts.load();
+
+    return stats;
+}
+
+std::vector<VideoMode> GstreamerCameraCapture::prepared_modes() const {
+    std::lock_guard<std::mutex> lock(mode_mutex);
+    return this->probed_modes;
+}
+
+FramePoolStats GstreamerCameraCapture::pool_stats() const {
+    FramePoolStats stats;
+
+    stats.buffers = pool_counters.buffers.load();
+    stats.buffer_size = pool_counters.buffer_size.load();
+    stats.acquired = pool_counters.acquired.load() + convert_pool_counters.acquired.load();
+    stats.exhausted = pool_counters.exhausted.load() + convert_pool_counters.exhausted.load();
+
+    return stats;
+}
+
+bool GstreamerCameraCapture::start_recording(const std::string &path, RecordingSource source,
+                                             RecordingCodec codec) {
+    // Analysed frames only exist while the processing engine runs
+    if (source == RecordProcessed && !this->processing.is_running()) {
+        LOG_WARNING("capture") << "Recording analysed frames needs processing enabled";
+        return false;
+    }
+
+    recording_source.store(source);
+    return this->recorder.start(path, codec);
+}
+
+void GstreamerCameraCapture::stop_recording() {
+    this->recorder.stop();
+}
+
+CaptureCounters GstreamerCameraCapture::counters() const {
+    CaptureCounters counters;
+
+    counters.received = health.stats().buffers;
+    counters.delivered = frame_sequence.load();
+    counters.refused = frames_refused.load();
+
+    return counters;
+}
+
+void GstreamerCameraCapture::stop() {
+    if (!this->pipeline) {
         return;
     }
-    
-    // Configure appsink to receive frames
-    g_object_set(G_OBJECT(this->sink), "emit-signals", TRUE, NULL);
-    g_object_set(G_OBJECT(this->sink), "max-buffers", 1, NULL);
-    g_object_set(G_OBJECT(this->sink), "drop", TRUE, NULL);
-    
-    // Set video format
-    GstCaps *caps = gst_caps_new_simple("video/x-raw",
-                                       "format", G_TYPE_STRING, "RGB",
-                                       "width", G_TYPE_INT, 640,
-                                       "height", G_TYPE_INT, 480,
-                                       "framerate", GST_TYPE_FRACTION, 30, 1,
-                                       NULL);
-    
-    // Set caps for appsink and appsrc
-    gst_app_sink_set_caps(GST_APP_SINK(this->sink), caps);
-    g_signal_connect(this->sink, "new-sample", G_CALLBACK(new_sample_callback), this);
-    
-    // Add elements to pipelines
-    gst_bin_add_many(GST_BIN(this->pipeline), this->source, this->convert, this->scale, this->sink, NULL);
-    
-    // Link src pipeline elements
-    if (!gst_element_link_many(this->source, this->convert, this->scale, this->sink, NULL)) {
-        std::cerr << "Src pipeline elements cannot be linked!" << std::endl;
-        gst_object_unref(this->pipeline);
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    this->capturing = false;
+    this->first_frame_pending.store(false);
+
+    // Stopped on purpose, the health monitor must not bring it back
+    this->health.set_active(false);
+
+    // The state worker goes to standby by itself once it is done, a failed
+    // camera is closed already
+    if (this->busy || this->failed) {
         return;
     }
-     
-    GstBus *src_bus = gst_element_get_bus(this->pipeline);
-    gst_bus_add_watch(src_bus, bus_callback, NULL);
-    gst_object_unref(src_bus);
 
-    gst_caps_unref(caps);
+    if (!this->enter_standby()) {
+        LOG_ERROR("capture") << "Failed to stop pipeline!";
+        return;
+    }
+
+    // Give the buffers held on the GUI side back to the pool, the streaming
+    // thread already released its own slot after the last publish
+    this->frames.drain();
 
-    std::cout << "Pipeline initialized" << std::endl;
+    FramePoolStats stats = this->pool_stats();
+    LOG_INFO("capture") << "Pipeline stoped... (frame pool: " << stats.acquired << " acquired, "
+        << stats.exhausted << " exhausted)";
 }
 
-GstreamerCameraCapture::~GstreamerCameraCapture() {
-    if (this->pipeline) {
-        gst_element_set_state(this->pipeline, GST_STATE_NULL);
-        gst_object_unref(GST_OBJECT(this->pipeline));
+// Runs on the state worker, after an error or a long stall. A restart that
+// fails shows up on the bus again and the watchdog schedules the next one.
+void GstreamerCameraCapture::restart_pipeline() {
+    {
+        // Stopped since the watchdog decided to restart, stop() has set the state already
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (!this->capturing || this->failed) {
+            return;
+        }
+        this->busy = true;
+        this->gated.store(false);
+    }
+
+    gst_element_set_state(this->pipeline, GST_STATE_NULL);
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    this->busy = false;
+    if (this->capturing) {
+        this->start_pipeline();
+    } else {
+        this->enter_standby();
     }
 }
 
-void GstreamerCameraCapture::run() {
-    // Start pipeline
-    GstStateChangeReturn src_ret = gst_element_set_state(this->pipeline, GST_STATE_PLAYING);
-    
-    if (src_ret == GST_STATE_CHANGE_FAILURE) {
-        std::cerr << "Failed to start pipeline!" << std::endl;
+// Load of the last backpressure tick, runs on the scheduler thread
+LoadSample GstreamerCameraCapture::sample_load() {
+    LoadSample sample;
+
+    HealthStats stats = this->health.stats();
+    quint64 received = stats.buffers - std::min(stats.buffers, load_received);
+    quint64 dropped = stats.appsink_dropped - std::min(stats.appsink_dropped, load_dropped);
+    load_received = stats.buffers;
+    load_dropped = stats.appsink_dropped;
+
+    sample.frames = received;
+    sample.drop_ratio = received ? double(dropped) / double(received) : 0;
+
+    quint64 stage_dropped = 0;
+    if (this->processing.is_running()) {
+        for (const StageStats &stage : this->processing.stage_stats()) {
+            sample.queue_depth = std::max(sample.queue_depth, stage.queued);
+            stage_dropped += stage.dropped;
+        }
+    }
+    sample.stage_dropped = stage_dropped - std::min(stage_dropped, load_stage_dropped);
+    load_stage_dropped = stage_dropped;
+
+    // Only the frames since the previous tick, so a change shows at once.
+    // The whole path when frames are painted, the slowest step otherwise
+    quint64 sequence = frame_sequence.load();
+    std::vector<LatencyStats> steps = this->tracer.summarize(std::min(load_sequence, sequence));
+    load_sequence = sequence;
+
+    if (!steps.empty() && steps.back().samples > 0) {
+        sample.latency_p95_ms = steps.back().p95_ms;
+    } else {
+        for (const LatencyStats &step : steps) {
+            sample.latency_p95_ms = std::max(sample.latency_p95_ms, step.p95_ms);
+        }
+    }
+
+    return sample;
+}
+
+int GstreamerCameraCapture::nominal_fps() const {
+    {
+        std::lock_guard<std::mutex> lock(mode_mutex);
+        if (has_mode && current_mode.fps_d > 0) {
+            return std::max(1, current_mode.fps_n / current_mode.fps_d);
+        }
+    }
+
+    // Files, pushed frames and the default caps run at whatever rate was
+    // negotiated into the rate limiter, ahead of its own cap
+    int fps = 30;
+    GstPad *rate_pad = gst_element_get_static_pad(this->rate, "sink");
+    GstCaps *caps = gst_pad_get_current_caps(rate_pad);
+    gst_object_unref(rate_pad);
+
+    if (caps) {
+        gint fps_n = 0, fps_d = 0;
+        if (gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &fps_n, &fps_d) &&
+            fps_n > 0 && fps_d > 0) {
+            fps = std::max(1, fps_n / fps_d);
+        }
+        gst_caps_unref(caps);
+    }
+
+    return fps;
+}
+
+// Runs on the scheduler thread, or on the GUI thread when adaptive quality
+// is switched off. Every step is a property or caps change
+// that renegotiates in place, the pipeline keeps playing
+void GstreamerCameraCapture::apply_degrade(DegradeLevel level) {
+    int previous = degrade_level.exchange(level);
+
+    int max_rate = (level >= DegradeFramerate) ? std::max(1, this->nominal_fps() / 2) : G_MAXINT;
+    g_object_set(G_OBJECT(this->rate), "max-rate", max_rate, NULL);
+
+    if ((previous >= DegradeResolution) != (level >= DegradeResolution)) {
+        {
+            std::lock_guard<std::mutex> lock(mode_mutex);
+            GstCaps *caps = this->output_caps();
+            gst_app_sink_set_caps(GST_APP_SINK(this->sink), caps);
+            gst_caps_unref(caps);
+        }
+
+        // Upstream asks for the new size again
+        GstPad *sink_pad = gst_element_get_static_pad(this->sink, "sink");
+        gst_pad_push_event(sink_pad, gst_event_new_reconfigure());
+        gst_object_unref(sink_pad);
+    }
+
+    analysis_stride.store(level >= DegradeAnalysis ? 2 : 1);
+
+    // Frames now arrive at another rate, the gap detection starts over
+    this->health.reset_stream();
+}
+
+void GstreamerCameraCapture::set_zoom(double level) {
+    level = std::clamp(level, 0.0, 1.0);
+
+    if (this->controls_ready.load() && this->controls.available(ControlZoom)) {
+        this->controls.set(ControlZoom, level);
         return;
     }
-    
-    std::cout << "Pipeline started, capturing video..." << std::endl;
+
+    std::lock_guard<std::mutex> lock(crop_mutex);
+    digital_zoom = 1.0 + level * (MAX_DIGITAL_ZOOM - 1.0);
+    this->apply_crop();
 }
 
-void GstreamerCameraCapture::stop() {
-    GstStateChangeReturn src_ret = gst_element_set_state(this->pipeline, GST_STATE_PAUSED);
+bool GstreamerCameraCapture::set_focus(double level) {
+    if (!this->controls_ready.load() || !this->controls.available(ControlFocus)) {
+        return false;
+    }
 
-    if (src_ret == GST_STATE_CHANGE_FAILURE) {
-        std::cerr << "Failed to stop pipeline!" << std::endl;
+    this->controls.set(ControlFocus, level);
+    return true;
+}
+
+void GstreamerCameraCapture::set_crop_region(const CropRegion &region) {
+    std::lock_guard<std::mutex> lock(crop_mutex);
+
+    // Equal normalized sides are the frame's own aspect ratio
+    double size = std::clamp(std::max(region.width, region.height), 0.01, 1.0);
+    double centre_x = region.x + region.width / 2;
+    double centre_y = region.y + region.height / 2;
+
+    crop_region.width = size;
+    crop_region.height = size;
+    crop_region.x = std::clamp(centre_x - size / 2, 0.0, 1.0 - size);
+    crop_region.y = std::clamp(centre_y - size / 2, 0.0, 1.0 - size);
+    this->apply_crop();
+}
+
+void GstreamerCameraCapture::crop_to_shown(const CropRegion &selection) {
+    std::lock_guard<std::mutex> lock(crop_mutex);
+    CropRegion shown = this->shown_region();
+
+    // The region is picked so that, zoomed as it is, the selection's longer
+    // side fills the view and the frame's aspect ratio is kept
+    double size = std::clamp(std::max(selection.width * shown.width, selection.height * shown.height)
+                             * digital_zoom, 0.01, 1.0);
+    double centre_x = shown.x + (selection.x + selection.width / 2) * shown.width;
+    double centre_y = shown.y + (selection.y + selection.height / 2) * shown.height;
+
+    crop_region.width = size;
+    crop_region.height = size;
+    crop_region.x = std::clamp(centre_x - size / 2, 0.0, 1.0 - size);
+    crop_region.y = std::clamp(centre_y - size / 2, 0.0, 1.0 - size);
+    this->apply_crop();
+}
+
+// The region zoomed into, called with crop_mutex held
+CropRegion GstreamerCameraCapture::shown_region() const {
+    CropRegion shown;
+
+    shown.width = crop_region.width / digital_zoom;
+    shown.height = crop_region.height / digital_zoom;
+    shown.x = crop_region.x + (crop_region.width - shown.width) / 2;
+    shown.y = crop_region.y + (crop_region.height - shown.height) / 2;
+
+    return shown;
+}
+
+// Turns the region and zoom into pixel margins of the incoming frame,
+// called with crop_mutex held. videocrop only renegotiates its own output,
+// videoscale keeps the appsink size, so nothing past it notices.
+void GstreamerCameraCapture::apply_crop() {
+    if (crop_input_width <= 0 || crop_input_height <= 0) {
         return;
     }
 
-    std::cout << "Pipeline stoped..." << std::endl;
+    CropRegion shown = this->shown_region();
+
+    // Even offsets and sizes, so the chroma of 4:2:2 and 4:2:0 frames lines up
+    int left = int(std::lround(shown.x * crop_input_width)) & ~1;
+    int top = int(std::lround(shown.y * crop_input_height)) & ~1;
+    int shown_width = std::max(2, int(std::lround(shown.width * crop_input_width)) & ~1);
+    int shown_height = std::max(2, int(std::lround(shown.height * crop_input_height)) & ~1);
+    int right = std::max(0, crop_input_width - left - shown_width);
+    int bottom = std::max(0, crop_input_height - top - shown_height);
+
+    g_object_set(G_OBJECT(this->crop),
+                 "left", left,
+                 "right", right,
+                 "top", top,
+                 "bottom", bottom,
+                 NULL);
+
+    LOG_DEBUG("capture") << "Crop " << shown_width << "x" << shown_height << " at "
+        << left << "," << top << " of " << crop_input_width << "x" << crop_input_height;
 }
 
 // Message handler from GStreamer bus
 static gboolean bus_callback(GstBus *bus, GstMessage *message, gpointer data) {
     Q_UNUSED(bus)
-    Q_UNUSED(data)
-
-    switch (GST_MESSAGE_TYPE(message)) {
-        case GST_MESSAGE_ERROR: {
-            GError *err;
-            gchar *debug;
-            gst_message_parse_error(message, &err, &debug);
-            std::cerr << "Error: " << err->message << std::endl;
-            g_error_free(err);
-            g_free(debug);
-            break;
+
+    static_cast<HealthMonitor*>(data)->handle_message(message);
+    return TRUE;
+}
+
+// Links the first video pad of uridecodebin to the converter
+static void pad_added_callback(GstElement *element, GstPad *pad, gpointer data) {
+    Q_UNUSED(element)
+
+    GstElement *rate = static_cast<GstElement*>(data);
+    GstPad *sink_pad = gst_element_get_static_pad(rate, "sink");
+
+    if (gst_pad_is_linked(sink_pad)) {
+        gst_object_unref(sink_pad);
+        return;
+    }
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps) {
+        caps = gst_pad_query_caps(pad, NULL);
+    }
+
+    const gchar *name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+    if (g_str_has_prefix(name, "video/")) {
+        if (gst_pad_link(pad, sink_pad) != GST_PAD_LINK_OK) {
+            LOG_ERROR("capture") << "Cannot link decoded pad " << name;
         }
-        case GST_MESSAGE_EOS:
-            std::cout << "End of stream" << std::endl;
-            break;
-        default:
-            break;
     }
-    return TRUE;
+
+    gst_caps_unref(caps);
+    gst_object_unref(sink_pad);
 }
 
 // Convert mat to gst buffer function
@@ -126,14 +1340,15 @@ GstBuffer* GstreamerCameraCapture::mat_to_gst_buffer(const Mat &frame) {
     GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
 
     if (!buffer) {
-        std::cerr << "Couldn't create buffer!" << std::endl;
+        LOG_ERROR("capture") << "Couldn't create buffer!";
         return nullptr;
     }
 
     GstMapInfo map;
 
     if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
-        std::cerr << "Couldn't map buffer!" << std::endl;
+        LOG_ERROR("capture") << "Couldn't map buffer!";
+        gst_buffer_unref(buffer);
         return nullptr;
     }
 
@@ -151,14 +1366,17 @@ GstBuffer* GstreamerCameraCapture::mat_to_gst_buffer(const Mat &frame) {
 }
 
 // Convert mat to gst sample function
-GstSample* GstreamerCameraCapture::mat_to_gst_sample(const Mat &frame, GstCaps *caps) {
+GstSample* GstreamerCameraCapture::mat_to_gst_sample(const Mat &frame, GstCaps *caps,
+                                                     GstClockTime timestamp) {
     GstBuffer *buffer = mat_to_gst_buffer(frame);
 
     if (!buffer) {
         return nullptr;
     }
 
-    GstClockTime timestamp = gst_util_get_timestamp();
+    if (!GST_CLOCK_TIME_IS_VALID(timestamp)) {
+        timestamp = gst_util_get_timestamp();
+    }
 
     GST_BUFFER_PTS(buffer) = timestamp;
     GST_BUFFER_DTS(buffer) = timestamp;
@@ -170,163 +1388,405 @@ GstSample* GstreamerCameraCapture::mat_to_gst_sample(const Mat &frame, GstCaps *
     return sample;
 }
 
-// Function to convert gst sample to mat
-Mat GstreamerCameraCapture::gst_sample_to_mat(GstSample* sample) {
-    Mat result;
+// Keeps the buffer (and the sample it came in, if any) alive and mapped
+// for as long as a QImage references it
+struct MappedSample {
+    GstSample *sample;
+    GstVideoFrame frame;
+};
 
-    GstBuffer* buffer = gst_sample_get_buffer(sample);
-    GstMapInfo map;
-    
-    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-        std::cerr << "Cannot map gstreamer buffer" << std::endl;
-        return Mat();
+static void release_mapped_sample(void *info) {
+    MappedSample *mapped = static_cast<MappedSample*>(info);
+
+    gst_video_frame_unmap(&mapped->frame);
+    if (mapped->sample) {
+        gst_sample_unref(mapped->sample);
     }
-    
-    GstCaps* caps = gst_sample_get_caps(sample);
-    if (!caps) {
-        gst_buffer_unmap(buffer, &map);
-        std::cerr << "Cannot get caps from sample" << std::endl;
-        return result;
+    delete mapped;
+}
+
+// Maps the buffer for reading and wraps it into a QImage. The mapped frame
+// holds its own buffer reference, the sample is released with the image.
+static QImage wrap_video_buffer(GstSample *sample, GstBuffer *buffer,
+                                GstVideoInfo *info, QImage::Format format) {
+    MappedSample *mapped = new MappedSample;
+    mapped->sample = sample;
+
+    if (!gst_video_frame_map(&mapped->frame, info, buffer, GST_MAP_READ)) {
+        LOG_ERROR("capture") << "Cannot map gstreamer buffer";
+        if (sample) {
+            gst_sample_unref(sample);
+        }
+        delete mapped;
+        return QImage();
     }
 
-    GstStructure* structure = gst_caps_get_structure(caps, 0);
-    if (!structure) {
-        gst_buffer_unmap(buffer, &map);
-        gst_caps_unref(caps);
-        std::cerr << "Cannot get structure from caps" << std::endl;
-        return result;
+    // Read-only image, any write access would detach instead of touching the buffer
+    return QImage(
+        static_cast<const uchar*>(GST_VIDEO_FRAME_PLANE_DATA(&mapped->frame, 0)),
+        GST_VIDEO_FRAME_WIDTH(&mapped->frame),
+        GST_VIDEO_FRAME_HEIGHT(&mapped->frame),
+        GST_VIDEO_FRAME_PLANE_STRIDE(&mapped->frame, 0),
+        format,
+        release_mapped_sample,
+        mapped
+    );
+}
+
+// Wraps the sample memory into a QImage without copying.
+// Takes ownership of the sample, it is released by the image cleanup callback.
+QImage GstreamerCameraCapture::gst_sample_to_image(GstSample *sample) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    if (!buffer) {
+        LOG_ERROR("capture") << "Sample without a buffer";
+        gst_sample_unref(sample);
+        return QImage();
     }
-    
-    int width = 0, height = 0;
-    if (!gst_structure_get_int(structure, "width", &width) || 
-        !gst_structure_get_int(structure, "height", &height) ||
-        width <= 0 || height <= 0) {
-        gst_buffer_unmap(buffer, &map);
-        gst_caps_unref(caps);
-        std::cerr << "Invalid dimensions" << std::endl;
-        return result;
-    }
-
-    const char* format = gst_structure_get_string(structure, "format");
-    int type;
-
-    if (g_str_equal(format, "RGB")) {
-        type = CV_8UC3;
-    } else if (g_str_equal(format, "BGR")) {
-        type = CV_8UC3;
-    } else if (g_str_equal(format, "RGBA")) {
-        type = CV_8UC4;
-    } else if (g_str_equal(format, "BGRA")) {
-        type = CV_8UC4;
-    } else if (g_str_equal(format, "GRAY8")) {
-        type = CV_8UC1;
-    } else {
-        type = CV_8UC3;
+
+    if (!this->update_negotiated_caps(gst_sample_get_caps(sample)) ||
+        negotiated_format == QImage::Format_Invalid) {
+        gst_sample_unref(sample);
+        return QImage();
     }
 
-    Mat frame(height, width, type, (void*)map.data);
+    return wrap_video_buffer(sample, buffer, &negotiated_info, negotiated_format);
+}
 
-    if (g_str_equal(format, "RGB")) {
-        cvtColor(frame, frame, COLOR_RGB2BGR);
+// (Re)creates the pool of RGB buffers the native kernels convert into
+bool GstreamerCameraCapture::ensure_convert_pool(int width, int height) {
+    if (this->convert_pool &&
+        GST_VIDEO_INFO_WIDTH(&convert_info) == width &&
+        GST_VIDEO_INFO_HEIGHT(&convert_info) == height) {
+        return true;
     }
 
-    result = frame.clone();
+    if (this->convert_pool) {
+        gst_buffer_pool_set_active(this->convert_pool, FALSE);
+        gst_object_unref(this->convert_pool);
+        this->convert_pool = nullptr;
+    }
 
-    gst_buffer_unmap(buffer, &map);
-    //gst_caps_unref(caps);
-    
-    return result;
+    gst_video_info_set_format(&convert_info, GST_VIDEO_FORMAT_RGB, width, height);
+    GstCaps *caps = gst_video_info_to_caps(&convert_info);
+
+    GstBufferPool *pool = frame_pool_new(&convert_pool_counters);
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&convert_info),
+                                      FRAME_POOL_MIN, FRAME_POOL_SIZE);
+    gst_caps_unref(caps);
+
+    if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE)) {
+        LOG_ERROR("capture") << "Cannot activate conversion pool";
+        gst_object_unref(pool);
+        return false;
+    }
+
+    this->convert_pool = pool;
+    return true;
+}
+
+// Native conversion path: camera formats are converted by our own kernels
+// straight into a recycled RGB buffer. Takes ownership of the sample.
+QImage GstreamerCameraCapture::convert_sample(GstSample *sample) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    if (!buffer) {
+        LOG_ERROR("capture") << "Sample without a buffer";
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    if (!this->update_negotiated_caps(gst_sample_get_caps(sample))) {
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    GstVideoFormat format = GST_VIDEO_INFO_FORMAT(&negotiated_info);
+
+    // Already in display format, nothing to convert
+    if (format == GST_VIDEO_FORMAT_RGB) {
+        return this->gst_sample_to_image(sample);
+    }
+
+    int width = GST_VIDEO_INFO_WIDTH(&negotiated_info);
+    int height = GST_VIDEO_INFO_HEIGHT(&negotiated_info);
+
+    if (!this->ensure_convert_pool(width, height)) {
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    // The streaming thread never waits for the GUI to give a buffer back,
+    // the frame is dropped and counted instead
+    GstBuffer *output = nullptr;
+    GstBufferPoolAcquireParams params = {};
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    GstFlowReturn ret = gst_buffer_pool_acquire_buffer(this->convert_pool, &output, &params);
+    if (ret != GST_FLOW_OK) {
+        if (ret == GST_FLOW_EOS && convert_pool_counters.exhausted++ == 0) {
+            LOG_WARNING("capture") << "Conversion pool exhausted, frames are dropped until buffers come back";
+        }
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    GstVideoFrame in_frame, out_frame;
+    if (!gst_video_frame_map(&in_frame, &negotiated_info, buffer, GST_MAP_READ)) {
+        LOG_ERROR("capture") << "Cannot map gstreamer buffer";
+        gst_buffer_unref(output);
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    if (!gst_video_frame_map(&out_frame, &convert_info, output,
+                             static_cast<GstMapFlags>(GST_MAP_WRITE | GST_VIDEO_FRAME_MAP_FLAG_NO_REF))) {
+        LOG_ERROR("capture") << "Cannot map conversion buffer";
+        gst_video_frame_unmap(&in_frame);
+        gst_buffer_unref(output);
+        gst_sample_unref(sample);
+        return QImage();
+    }
+
+    uint8_t *dst = static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&out_frame, 0));
+    int dst_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&out_frame, 0);
+    const uint8_t *src = static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&in_frame, 0));
+    int src_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&in_frame, 0);
+
+    bool converted = true;
+    switch (format) {
+        case GST_VIDEO_FORMAT_YUY2:
+            convert_yuy2_to_rgb(src, src_stride, dst, dst_stride, width, height);
+            break;
+        case GST_VIDEO_FORMAT_NV12:
+            convert_nv12_to_rgb(src, src_stride,
+                                static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&in_frame, 1)),
+                                GST_VIDEO_FRAME_PLANE_STRIDE(&in_frame, 1),
+                                dst, dst_stride, width, height);
+            break;
+        case GST_VIDEO_FORMAT_BGR:
+            convert_swap_rb(src, src_stride, dst, dst_stride, width, height);
+            break;
+        default:
+            converted = false;
+            break;
+    }
+
+    gst_video_frame_unmap(&out_frame);
+    gst_video_frame_unmap(&in_frame);
+
+    // Timestamps travel with the converted frame, the input goes back upstream
+    gst_buffer_copy_into(output, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+    gst_sample_unref(sample);
+
+    if (!converted) {
+        LOG_ERROR("capture") << "No native conversion for " << GST_VIDEO_INFO_NAME(&negotiated_info);
+        gst_buffer_unref(output);
+        return QImage();
+    }
+
+    QImage image = wrap_video_buffer(nullptr, output, &convert_info, QImage::Format_RGB888);
+    gst_buffer_unref(output);
+
+    return image;
 }
 
 void GstreamerCameraCapture::new_frame(GstElement *sink) {
     GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
     
     if (!sample) {
-        std::cerr << "Couldn't acquire sample" << std::endl;
-        frame_ready.store(false);
+        LOG_ERROR("capture") << "Couldn't acquire sample";
         return;
     }
+    this->health.on_sample();
+
+    // The trace starts before conversion, a frame that fails to convert
+    // just leaves a gap in the sequence
+    quint64 sequence = ++frame_sequence;
+    int64_t capture_ns = this->capture_time_ns(sample);
+    this->tracer.begin(sequence, capture_ns);
 
-    QMutexLocker locker(&m_mutex);
-    // Convert sample to Mat
-    Mat frame = this->gst_sample_to_mat(sample);
-    gst_sample_unref(sample); // Only unref once
+    QImage image = (this->backend == NativeConvert)
+        ? this->convert_sample(sample)
+        : this->gst_sample_to_image(sample);
 
-    if (frame.empty()) {
-        std::cerr << "Empty frame!" << std::endl;
-        // Don't call gst_sample_unref(sample) again here
-        frame_ready.store(false);
+    // Counted only, every frame of rejected caps would end up here
+    if (image.isNull()) {
+        frames_refused.fetch_add(1, std::memory_order_relaxed);
         return;
     }
-    
-    // Process the image
-    this->processedFrame = frame;
-    cvtColor(processedFrame, processedFrame, COLOR_BGR2RGB);
 
-    frame_ready.store(true);
-}
+    this->tracer.mark(sequence, TRACE_CONVERTED);
 
-QPixmap GstreamerCameraCapture::pull_pixmap_from_frame() {
-    QMutexLocker locker(&m_mutex);
+    // The slot is owned by this thread until published and was emptied
+    // after the previous publish, nothing here waits for the GUI
+    CapturedFrame &slot = this->frames.write_slot();
+    slot.image.swap(image);
+    slot.sequence = sequence;
+    slot.capture_ns = capture_ns;
 
-    if (!this->frame_ready.load() || processedFrame.empty())
-        return QPixmap();
+    // Analysis and recording run on their own threads, this only queues references
+    if (this->processing.is_running() && sequence % analysis_stride.load(std::memory_order_relaxed) == 0) {
+        this->processing.submit(slot.image, sequence, capture_ns);
+    }
+    if (this->recorder.is_recording() && recording_source.load() == RecordRaw) {
+        this->recorder.submit(slot.image, capture_ns);
+    }
+    if (this->pre_event.is_running()) {
+        this->pre_event.submit(slot.image, capture_ns);
+    }
+    if (this->tracking.is_running()) {
+        this->tracking.submit(slot.image, sequence);
+    }
+    // One copy into the ring, readers map it from there without waiting on us
+    if (this->frame_export.is_open()) {
+        this->frame_export.publish(slot.image, capture_ns);
+    }
 
-    try {
-        QImage image(
-            processedFrame.data,
-            processedFrame.cols,
-            processedFrame.rows,
-            processedFrame.step,
-            QImage::Format_RGB888
-        );
+    this->frames.publish();
+    // The slot handed back holds an older frame, its buffer goes back to
+    // the pool now rather than when the next frame arrives
+    this->frames.write_slot() = CapturedFrame();
 
-        if (image.isNull()) {
-            return QPixmap();
-        }
+    if (this->first_frame_pending.exchange(false)) {
+        this->first_frame_ms.store((FrameTracer::now_ns() - this->run_start_ns) / 1e6);
+        LOG_INFO("capture") << "First frame " << this->first_frame_ms.load() << " ms after start";
+    }
 
-        return QPixmap::fromImage(image.copy());
-    } catch (const std::exception& e) {
-        std::cerr << "Exception in pull_pixmap_from_frame: " << e.what() << std::endl;
-        return QPixmap();
+    // Coalesce notifications while the GUI has not pulled the previous one
+    if (!signal_pending.exchange(true)) {
+        emit frameReady(sequence);
     }
 }
 
-// Function for frame processing using OpenCV
-Mat GstreamerCameraCapture::process_frame(const Mat &input_frame) {
-    if(input_frame.empty()) {
-        std::cerr << "Error: Empty input frame" << std::endl;
-        return Mat();
+// Buffer timestamp on the monotonic clock, 0 when the buffer has none
+int64_t GstreamerCameraCapture::capture_time_ns(GstSample *sample) const {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstSegment *segment = gst_sample_get_segment(sample);
+
+    if (!buffer || !segment || !GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return 0;
     }
-    Mat processed_frame;
 
-    // Copying input frame for processing
-    if (input_frame.cols > 640 || input_frame.rows > 480) {
-        resize(processed_frame, processed_frame, Size(640, 480));
-    } else {
-        processed_frame = input_frame.clone();
+    GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME,
+                                                             GST_BUFFER_PTS(buffer));
+    GstClockTime base_time = gst_element_get_base_time(this->pipeline);
+
+    if (!GST_CLOCK_TIME_IS_VALID(running_time) || !GST_CLOCK_TIME_IS_VALID(base_time)) {
+        return 0;
     }
 
-    // Apply Gaussian blur
-    GaussianBlur(processed_frame, processed_frame, Size(3, 3), 0.8);
+    // The pipeline runs on the system clock, which is CLOCK_MONOTONIC
+    return int64_t(base_time + running_time);
+}
+
+QImage GstreamerCameraCapture::pull_image_from_frame(quint64 *sequence, int64_t *capture_ns) {
+    // Cleared before reading so a frame arriving meanwhile notifies again
+    signal_pending.store(false);
+
+    // Picks up the newest published frame, if any
+    this->frames.update();
+    const CapturedFrame &frame = this->frames.read_slot();
+
+    if (frame.sequence == 0)
+        return QImage();
+
+    if (sequence)
+        *sequence = frame.sequence;
+
+    if (capture_ns)
+        *capture_ns = frame.capture_ns;
+
+    // Shallow copy, the buffer stays referenced until the GUI drops the image
+    return frame.image;
+}
+
+GstPadProbeReturn count_buffer_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    Q_UNUSED(pad)
+
+    GstreamerCameraCapture *capture = static_cast<GstreamerCameraCapture*>(data);
+    capture->health.on_buffer(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Drops every buffer while a live source idles in hot standby
+GstPadProbeReturn standby_gate_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    Q_UNUSED(pad)
+    Q_UNUSED(info)
+
+    GstreamerCameraCapture *capture = static_cast<GstreamerCameraCapture*>(data);
+    return capture->gated.load(std::memory_order_relaxed) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+// Follows the frame size reaching the crop, so the margins stay right across mode changes
+GstPadProbeReturn crop_caps_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    Q_UNUSED(pad)
 
-    // // Edge detection using Canny algorithm
-    // Mat edges;
-    // Canny(processed_frame, edges, 100, 200);
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstCaps *caps = nullptr;
+    gst_event_parse_caps(event, &caps);
+
+    GstVideoInfo video_info;
+    if (!caps || !gst_video_info_from_caps(&video_info, caps)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstreamerCameraCapture *capture = static_cast<GstreamerCameraCapture*>(data);
+    std::lock_guard<std::mutex> lock(capture->crop_mutex);
+    if (GST_VIDEO_INFO_WIDTH(&video_info) != capture->crop_input_width ||
+        GST_VIDEO_INFO_HEIGHT(&video_info) != capture->crop_input_height) {
+        capture->crop_input_width = GST_VIDEO_INFO_WIDTH(&video_info);
+        capture->crop_input_height = GST_VIDEO_INFO_HEIGHT(&video_info);
+        capture->apply_crop();
+    }
+
+    return GST_PAD_PROBE_OK;
+}
 
-    // // Find contours
-    // std::vector<std::vector<Point>> contours;
-    // findContours(edges, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+// Answers the allocation query of upstream with a fixed-size pool sized from
+// the negotiated caps, so conversion writes directly into recycled buffers
+GstPadProbeReturn allocation_query_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    Q_UNUSED(pad)
 
-    // // Draw contours on the original image
-    // drawContours(processed_frame, contours, -1, Scalar(0, 255, 0), 2);
+    GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstCaps *caps = nullptr;
+    gboolean need_pool = FALSE;
+    gst_query_parse_allocation(query, &caps, &need_pool);
+
+    GstVideoInfo video_info;
+    if (!caps || !gst_video_info_from_caps(&video_info, caps)) {
+        return GST_PAD_PROBE_OK;
+    }
 
-    // Add text with information
-    // std::string info = "Frame contours: " + std::to_string(contours.size());
-    // putText(processed_frame, info, Point(10, 30), FONT_HERSHEY_SIMPLEX, 0.7, Scalar(0, 0, 255), 2);
+    GstreamerCameraCapture *instance = static_cast<GstreamerCameraCapture*>(data);
+    guint pool_min = GstreamerCameraCapture::FRAME_POOL_MIN;
+    guint pool_size = GstreamerCameraCapture::FRAME_POOL_SIZE;
+
+    // A fresh pool per negotiation, upstream configures and activates it and
+    // the old one goes away once its last buffer is released
+    GstBufferPool *pool = frame_pool_new(&instance->pool_counters);
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&video_info),
+                                      pool_min, pool_size);
+    gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_buffer_pool_set_config(pool, config);
 
-    return processed_frame;
- }
+    gst_query_add_allocation_pool(query, pool, GST_VIDEO_INFO_SIZE(&video_info),
+                                  pool_min, pool_size);
+    gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL);
+    gst_object_unref(pool);
+
+    return GST_PAD_PROBE_HANDLED;
+}
 
 // Function registered for 
 GstFlowReturn new_sample_callback(GstElement *sink, gpointer data) {
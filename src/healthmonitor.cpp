@@ -0,0 +1,360 @@
+#include "inc/healthmonitor.h"
+#include "inc/capturescheduler.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <chrono>
+
+static int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Buffers of the current stream that never got pulled, one may still be
+// waiting in the appsink
+static quint64 stream_dropped(quint64 buffers, quint64 pulled) {
+    return (buffers > pulled + 1) ? buffers - pulled - 1 : 0;
+}
+
+HealthMonitor::HealthMonitor(const std::string &name) :
+    name(name),
+    pipeline(nullptr),
+    watchdog_source(nullptr),
+    active(false),
+    restart_on_stall(true),
+    ended(false),
+    started_ns(0),
+    last_buffer_ns(0),
+    pts_reset(true),
+    last_pts(GST_CLOCK_TIME_NONE),
+    frame_period(0),
+    buffers(0),
+    pulled(0),
+    buffers_base(0),
+    pulled_base(0),
+    dropped_base(0),
+    pts_gaps(0),
+    frames_missing(0),
+    discontinuities(0),
+    restart_due_ns(0),
+    backoff_ms(MIN_BACKOFF_MS),
+    ticks(0),
+    reported_dropped(0),
+    reported_gaps(0),
+    reported_qos_dropped(0),
+    state(GST_STATE_NULL),
+    qos_messages(0),
+    qos_dropped(0),
+    qos_jitter_ms(0),
+    latency_messages(0),
+    stalls(0),
+    stalled(false),
+    errors(0),
+    restarts(0),
+    restart_in_ms(0)
+{
+}
+
+HealthMonitor::~HealthMonitor() {
+    this->detach();
+}
+
+void HealthMonitor::attach(GstElement *pipeline, RestartHandler restart) {
+    {
+        std::lock_guard<std::mutex> lock(watchdog_mutex);
+        this->pipeline = pipeline;
+        this->restart = restart;
+    }
+    watchdog_source = CaptureScheduler::instance().add_timeout(WATCHDOG_MS, watchdog_callback, this);
+}
+
+void HealthMonitor::detach() {
+    CaptureScheduler::instance().remove_source(watchdog_source);
+    watchdog_source = nullptr;
+
+    // Wait out a watchdog call that was already running
+    std::lock_guard<std::mutex> lock(watchdog_mutex);
+    pipeline = nullptr;
+    restart = nullptr;
+}
+
+void HealthMonitor::set_active(bool active) {
+    if (active) {
+        this->reset_stream();
+    }
+    this->active.store(active);
+}
+
+void HealthMonitor::reset_stream() {
+    started_ns.store(monotonic_ns());
+    last_buffer_ns.store(0);
+    pts_reset.store(true);
+    ended.store(false);
+
+    // Whatever the old stream still held is flushed, not dropped. Drops
+    // counted so far are kept, so the total never goes backwards.
+    quint64 current_buffers = buffers.load();
+    quint64 current_pulled = pulled.load();
+    dropped_base.fetch_add(stream_dropped(current_buffers - buffers_base.load(),
+                                          current_pulled - pulled_base.load()));
+    buffers_base.store(current_buffers);
+    pulled_base.store(current_pulled);
+}
+
+void HealthMonitor::on_buffer(GstBuffer *buffer) {
+    buffers.fetch_add(1, std::memory_order_relaxed);
+    last_buffer_ns.store(monotonic_ns(), std::memory_order_relaxed);
+
+    if (pts_reset.exchange(false, std::memory_order_relaxed)) {
+        last_pts = GST_CLOCK_TIME_NONE;
+        frame_period.store(0, std::memory_order_relaxed);
+    }
+
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return;
+    }
+
+    if (GST_BUFFER_IS_DISCONT(buffer) && GST_CLOCK_TIME_IS_VALID(last_pts)) {
+        discontinuities.fetch_add(1, std::memory_order_relaxed);
+    } else if (GST_CLOCK_TIME_IS_VALID(last_pts)) {
+        if (pts <= last_pts) {
+            discontinuities.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            GstClockTime delta = pts - last_pts;
+            GstClockTime period = frame_period.load(std::memory_order_relaxed);
+            GstClockTime expected = GST_BUFFER_DURATION_IS_VALID(buffer)
+                ? GST_BUFFER_DURATION(buffer) : period;
+
+            // More than one and a half frames apart, at least one went missing
+            if (expected > 0 && delta > expected + expected / 2) {
+                pts_gaps.fetch_add(1, std::memory_order_relaxed);
+                frames_missing.fetch_add((delta + expected / 2) / expected - 1, std::memory_order_relaxed);
+            } else {
+                period = (period == 0) ? delta : period + (gint64(delta) - gint64(period)) / 8;
+                frame_period.store(period, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    last_pts = pts;
+}
+
+void HealthMonitor::on_sample() {
+    pulled.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HealthMonitor::handle_message(GstMessage *message) {
+    switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR: {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error(message, &err, &debug);
+        LOG_ERROR("health") << name << ": " << GST_OBJECT_NAME(GST_MESSAGE_SRC(message))
+            << ": " << err->message;
+
+        errors.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            last_error = err->message;
+        }
+        this->schedule_restart(err->message);
+
+        g_error_free(err);
+        g_free(debug);
+        break;
+    }
+    case GST_MESSAGE_WARNING: {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_warning(message, &err, &debug);
+        LOG_WARNING("health") << name << ": " << err->message;
+        g_error_free(err);
+        g_free(debug);
+        break;
+    }
+    case GST_MESSAGE_EOS:
+        ended.store(true);
+        LOG_INFO("health") << name << ": end of stream";
+        break;
+    case GST_MESSAGE_QOS: {
+        GstFormat format;
+        guint64 processed = 0;
+        guint64 dropped = 0;
+        gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+
+        gint64 jitter = 0;
+        gdouble proportion = 0;
+        gint quality = 0;
+        gst_message_parse_qos_values(message, &jitter, &proportion, &quality);
+
+        // The counts are running totals per element
+        if (format == GST_FORMAT_BUFFERS || format == GST_FORMAT_DEFAULT) {
+            quint64 &element_dropped = qos_dropped_by_element[GST_OBJECT_NAME(GST_MESSAGE_SRC(message))];
+            if (dropped > element_dropped) {
+                qos_dropped.fetch_add(dropped - element_dropped);
+                element_dropped = dropped;
+            }
+        }
+
+        qos_messages.fetch_add(1);
+        qos_jitter_ms.store(double(jitter) / 1e6);
+        break;
+    }
+    case GST_MESSAGE_LATENCY: {
+        latency_messages.fetch_add(1);
+        std::lock_guard<std::mutex> lock(watchdog_mutex);
+        if (pipeline) {
+            gst_bin_recalculate_latency(GST_BIN(pipeline));
+        }
+        break;
+    }
+    case GST_MESSAGE_STATE_CHANGED: {
+        bool from_pipeline;
+        {
+            std::lock_guard<std::mutex> lock(watchdog_mutex);
+            from_pipeline = pipeline && GST_MESSAGE_SRC(message) == GST_OBJECT(pipeline);
+        }
+        if (from_pipeline) {
+            GstState old_state, new_state;
+            gst_message_parse_state_changed(message, &old_state, &new_state, NULL);
+            state.store(new_state);
+            LOG_DEBUG("health") << name << ": " << gst_element_state_get_name(old_state)
+                << " -> " << gst_element_state_get_name(new_state);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void HealthMonitor::schedule_restart(const std::string &reason) {
+    if (!active.load() || restart_due_ns != 0) {
+        return;
+    }
+
+    LOG_WARNING("health") << name << ": restarting in " << backoff_ms << " ms (" << reason << ")";
+
+    restart_due_ns = monotonic_ns() + int64_t(backoff_ms) * 1000000;
+    restart_in_ms.store(backoff_ms);
+    backoff_ms = std::min(backoff_ms * 2, MAX_BACKOFF_MS);
+}
+
+gboolean HealthMonitor::watchdog_callback(gpointer data) {
+    static_cast<HealthMonitor*>(data)->watchdog();
+    return G_SOURCE_CONTINUE;
+}
+
+void HealthMonitor::watchdog() {
+    std::lock_guard<std::mutex> lock(watchdog_mutex);
+    if (!pipeline) {
+        return;
+    }
+
+    int64_t now = monotonic_ns();
+
+    if (!active.load()) {
+        restart_due_ns = 0;
+        restart_in_ms.store(0);
+        stalled.store(false);
+        return;
+    }
+
+    if (restart_due_ns != 0) {
+        if (now < restart_due_ns) {
+            restart_in_ms.store(int((restart_due_ns - now) / 1000000));
+            return;
+        }
+
+        restart_due_ns = 0;
+        restart_in_ms.store(0);
+        restarts.fetch_add(1);
+        this->reset_stream();
+
+        bool restarted = restart && restart();
+        LOG_INFO("health") << name << ": pipeline restart " << (restarted ? "scheduled" : "failed");
+        if (!restarted) {
+            this->schedule_restart("restart failed");
+        }
+        return;
+    }
+
+    // A finished stream is quiet, not stalled
+    if (ended.load()) {
+        stalled.store(false);
+        return;
+    }
+
+    // Silence counts from the start for a pipeline that never produced anything
+    int64_t last = std::max(last_buffer_ns.load(), started_ns.load());
+    int64_t idle_ms = (now - last) / 1000000;
+    int64_t stall_ms = std::max<int64_t>(STALL_MIN_MS, 10 * int64_t(frame_period.load() / GST_MSECOND));
+
+    if (idle_ms > stall_ms) {
+        if (!stalled.exchange(true)) {
+            stalls.fetch_add(1);
+            LOG_WARNING("health") << name << ": no buffers for " << idle_ms << " ms";
+        }
+        if (idle_ms > RESTART_AFTER_STALL_MS && restart_on_stall.load()) {
+            this->schedule_restart("stalled");
+        }
+    } else if (stalled.exchange(false)) {
+        LOG_INFO("health") << name << ": buffers flowing again";
+    }
+
+    // Running cleanly for a while, the next failure starts from the shortest delay
+    if (!stalled.load() && last_buffer_ns.load() - started_ns.load() > int64_t(HEALTHY_MS) * 1000000) {
+        backoff_ms = MIN_BACKOFF_MS;
+    }
+
+    // Losses go to the log about once a second, as deltas
+    if (++ticks % (1000 / WATCHDOG_MS) == 0) {
+        this->report();
+    }
+}
+
+void HealthMonitor::report() {
+    HealthStats current = this->stats();
+
+    quint64 dropped = current.appsink_dropped - std::min(current.appsink_dropped, reported_dropped);
+    quint64 gaps = current.pts_gaps - std::min(current.pts_gaps, reported_gaps);
+    quint64 qos = current.qos_dropped - std::min(current.qos_dropped, reported_qos_dropped);
+
+    reported_dropped = current.appsink_dropped;
+    reported_gaps = current.pts_gaps;
+    reported_qos_dropped = current.qos_dropped;
+
+    if (dropped || gaps || qos) {
+        LOG_WARNING("health") << name << ": " << dropped << " dropped at the appsink, "
+            << gaps << " PTS gaps, " << qos << " dropped for QoS in the last second";
+    }
+}
+
+HealthStats HealthMonitor::stats() const {
+    HealthStats stats;
+
+    stats.state = gst_element_state_get_name(GstState(state.load()));
+    stats.buffers = buffers.load();
+    stats.pulled = pulled.load();
+    stats.appsink_dropped = dropped_base.load() +
+        stream_dropped(stats.buffers - std::min(stats.buffers, buffers_base.load()),
+                       stats.pulled - std::min(stats.pulled, pulled_base.load()));
+    stats.qos_messages = qos_messages.load();
+    stats.qos_dropped = qos_dropped.load();
+    stats.qos_jitter_ms = qos_jitter_ms.load();
+    stats.latency_messages = latency_messages.load();
+    stats.pts_gaps = pts_gaps.load();
+    stats.frames_missing = frames_missing.load();
+    stats.discontinuities = discontinuities.load();
+    stats.stalls = stalls.load();
+    stats.stalled = stalled.load();
+    stats.errors = errors.load();
+    stats.restarts = restarts.load();
+    stats.restart_in_ms = restart_in_ms.load();
+
+    std::lock_guard<std::mutex> lock(error_mutex);
+    stats.last_error = last_error;
+
+    return stats;
+}
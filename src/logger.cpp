@@ -0,0 +1,272 @@
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+static const std::chrono::milliseconds WRITER_PERIOD(20);
+// Messages the rate limit lets through at once before it starts refusing
+static const int64_t RATE_BURST = 20;
+
+static int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Logger &Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() :
+    running(true),
+    level_threshold(LogInfo),
+    console(true),
+    rate_interval_ns(0),
+    rate_next_ns(0),
+    suppressed(0),
+    file(NULL),
+    max_bytes(0),
+    max_files(0),
+    file_bytes(0),
+    reported_suppressed(0),
+    reported_dropped(0),
+    written(0),
+    rotations(0)
+{
+    writer = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    running.store(false);
+    if (writer.joinable()) {
+        writer.join();
+    }
+
+    if (file) {
+        fclose(file);
+    }
+}
+
+const char *Logger::level_name(LogLevel level) {
+    switch (level) {
+    case LogDebug: return "DEBUG";
+    case LogInfo: return "INFO";
+    case LogWarning: return "WARN";
+    case LogError: return "ERROR";
+    }
+    return "?";
+}
+
+bool Logger::open_file(const std::string &file_path, size_t bytes, int files) {
+    FILE *opened = fopen(file_path.c_str(), "a");
+    if (!opened) {
+        LOG_ERROR("log") << "Cannot open log file " << file_path << ": " << strerror(errno);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (file) {
+        fclose(file);
+    }
+
+    file = opened;
+    path = file_path;
+    max_bytes = bytes;
+    max_files = std::max(1, files);
+    fseek(file, 0, SEEK_END);
+    file_bytes = size_t(std::max(0L, ftell(file)));
+
+    return true;
+}
+
+void Logger::set_rate_limit(int messages_per_second) {
+    rate_interval_ns.store(messages_per_second > 0 ? 1000000000LL / messages_per_second : 0);
+}
+
+bool Logger::rate_allowed() {
+    int64_t interval = rate_interval_ns.load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return true;
+    }
+
+    // Generic cell rate algorithm, a lock-free token bucket
+    int64_t now = monotonic_ns();
+    int64_t next = rate_next_ns.load(std::memory_order_relaxed);
+
+    for (;;) {
+        int64_t start = std::max(next, now);
+        if (start - now > interval * RATE_BURST) {
+            return false;
+        }
+        if (rate_next_ns.compare_exchange_weak(next, start + interval, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+void Logger::write(LogLevel level, const char *source, const std::string &message) {
+    if (!this->accepts(level)) {
+        return;
+    }
+
+    if (level < LogWarning && !this->rate_allowed()) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogEntry entry;
+    entry.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    entry.level = level;
+    strncpy(entry.source, source ? source : "", sizeof(entry.source) - 1);
+    entry.source[sizeof(entry.source) - 1] = '\0';
+
+    // Long messages are cut to the fixed entry size
+    size_t length = std::min(message.size(), sizeof(entry.text) - 1);
+    memcpy(entry.text, message.data(), length);
+    entry.text[length] = '\0';
+
+    queue.try_push(entry);
+}
+
+void Logger::format(const LogEntry &entry, std::string &line) const {
+    time_t seconds = time_t(entry.time_ns / 1000000000LL);
+    int milliseconds = int((entry.time_ns / 1000000) % 1000);
+
+    struct tm local;
+    localtime_r(&seconds, &local);
+
+    char prefix[64];
+    size_t size = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(prefix + size, sizeof(prefix) - size, ".%03d %-5s ", milliseconds, level_name(entry.level));
+
+    line = prefix;
+    if (entry.source[0]) {
+        line += entry.source;
+        line += ": ";
+    }
+    line += entry.text;
+}
+
+void Logger::rotate() {
+    fclose(file);
+    file = NULL;
+
+    // path.<n-1> -> path.<n>, ..., path -> path.1
+    for (int i = max_files - 1; i >= 1; i--) {
+        std::string from = path + "." + std::to_string(i);
+        std::string to = path + "." + std::to_string(i + 1);
+        rename(from.c_str(), to.c_str());
+    }
+    rename(path.c_str(), (path + ".1").c_str());
+
+    file = fopen(path.c_str(), "a");
+    file_bytes = 0;
+    rotations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::drain() {
+    std::vector<std::string> lines;
+    LogEntry entry;
+    std::string line;
+
+    while (queue.try_pop(entry)) {
+        this->format(entry, line);
+        lines.push_back(line);
+    }
+
+    // Losses are reported in the log itself, once per batch
+    uint64_t now_suppressed = suppressed.load(std::memory_order_relaxed);
+    uint64_t now_dropped = queue.dropped();
+    if (now_suppressed != reported_suppressed || now_dropped != reported_dropped) {
+        LogEntry note;
+        note.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        note.level = LogWarning;
+        strcpy(note.source, "log");
+        snprintf(note.text, sizeof(note.text), "%llu messages suppressed by the rate limit, %llu lost",
+                 (unsigned long long)(now_suppressed - reported_suppressed),
+                 (unsigned long long)(now_dropped - reported_dropped));
+        reported_suppressed = now_suppressed;
+        reported_dropped = now_dropped;
+
+        this->format(note, line);
+        lines.push_back(line);
+    }
+
+    if (lines.empty()) {
+        return;
+    }
+
+    std::string batch;
+    for (const std::string &text : lines) {
+        batch += text;
+        batch += '\n';
+    }
+
+    if (console.load(std::memory_order_relaxed)) {
+        fwrite(batch.data(), 1, batch.size(), stderr);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        if (file) {
+            fwrite(batch.data(), 1, batch.size(), file);
+            fflush(file);
+            file_bytes += batch.size();
+            if (max_bytes && file_bytes >= max_bytes) {
+                this->rotate();
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(view_mutex);
+        for (std::string &text : lines) {
+            view_lines.push_back(std::move(text));
+        }
+        while (view_lines.size() > VIEW_BACKLOG) {
+            view_lines.pop_front();
+        }
+    }
+
+    written.fetch_add(lines.size(), std::memory_order_relaxed);
+}
+
+void Logger::run() {
+    while (running.load()) {
+        this->drain();
+        std::this_thread::sleep_for(WRITER_PERIOD);
+    }
+
+    // Whatever was logged before shutdown still reaches the file
+    this->drain();
+}
+
+std::vector<std::string> Logger::take_view_lines() {
+    std::lock_guard<std::mutex> lock(view_mutex);
+
+    std::vector<std::string> lines(std::make_move_iterator(view_lines.begin()),
+                                   std::make_move_iterator(view_lines.end()));
+    view_lines.clear();
+
+    return lines;
+}
+
+LoggerStats Logger::stats() const {
+    LoggerStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        stats.path = path;
+    }
+    stats.written = written.load();
+    stats.suppressed = suppressed.load();
+    stats.dropped = queue.dropped();
+    stats.rotations = rotations.load();
+
+    return stats;
+}
@@ -1,10 +1,85 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 #include "inc/window.h"
+#include "inc/tiles.h"
+
+#include <algorithm>
+#include <thread>
 
 
 int main(int argc, char **argv) {
     QApplication app (argc, argv);
-    Window window;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption sourceOption("source",
+        "Capture source: v4l2[:device], test[:pattern], file:<path>, uri:<uri> or appsrc. "
+        "Repeat for several cameras, the first one is the primary.",
+        "source", "v4l2");
+    parser.addOption(sourceOption);
+    QCommandLineOption convertOption("convert",
+        "Colour conversion backend: videoconvert or native (SIMD kernels).",
+        "backend", "videoconvert");
+    parser.addOption(convertOption);
+    QCommandLineOption actuatorOption("actuator",
+        "Stream the turret setpoints to a serial device, or to a new pseudo terminal with 'pty'.",
+        "device");
+    parser.addOption(actuatorOption);
+    QCommandLineOption logOption("log",
+        "Log file, rotated to <file>.1 .. <file>.3 every 10 MiB.",
+        "file", "capture.log");
+    parser.addOption(logOption);
+    QCommandLineOption metricsOption("metrics-port",
+        "Serve Prometheus metrics on http://127.0.0.1:<port>/metrics.",
+        "port");
+    parser.addOption(metricsOption);
+    QCommandLineOption exportOption("export-frames",
+        "Publish frames to the POSIX shared-memory ring <name>, further cameras to <name>-1, <name>-2...",
+        "name");
+    parser.addOption(exportOption);
+    QCommandLineOption benchTilesOption("bench-tiles",
+        "Benchmark the tiled image operations from 1 to N threads and exit.");
+    parser.addOption(benchTilesOption);
+    parser.process(app);
+
+    if (parser.isSet(benchTilesOption)) {
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        return run_tile_benchmark(threads, 20) ? 0 : 1;
+    }
+
+    Logger::instance().open_file(parser.value(logOption).toStdString());
+
+    std::vector<CaptureSource> sources;
+    for (const QString &value : parser.values(sourceOption)) {
+        CaptureSource source;
+        if (!CaptureSource::from_string(value.toStdString(), source)) {
+            qCritical() << "Invalid capture source:" << value;
+            return 1;
+        }
+        sources.push_back(source);
+    }
+
+    ConvertBackend backend = VideoConvert;
+    if (parser.value(convertOption) == "native") {
+        backend = NativeConvert;
+    } else if (parser.value(convertOption) != "videoconvert") {
+        qCritical() << "Invalid conversion backend:" << parser.value(convertOption);
+        return 1;
+    }
+
+    quint16 metricsPort = 0;
+    if (parser.isSet(metricsOption)) {
+        bool valid = false;
+        metricsPort = parser.value(metricsOption).toUShort(&valid);
+        if (!valid || metricsPort == 0) {
+            qCritical() << "Invalid metrics port:" << parser.value(metricsOption);
+            return 1;
+        }
+    }
+
+    Window window(sources, backend, parser.value(actuatorOption), metricsPort,
+                  parser.value(exportOption));
 
     window.show();
 
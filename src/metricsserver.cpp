@@ -0,0 +1,275 @@
+#include "inc/metricsserver.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Largest request head read from a client, the rest is ignored
+static const size_t MAX_REQUEST = 4096;
+// A client that sends nothing for this long is dropped
+static const int CLIENT_TIMEOUT_MS = 1000;
+
+Metric::Metric(const std::string &name, MetricType type, const std::string &help, const std::string &labels) :
+    name(name),
+    type(type),
+    help(help),
+    labels(labels),
+    current(0)
+{
+}
+
+MetricsServer::MetricsServer() :
+    listen_fd(-1),
+    wake_fd(-1),
+    bound_port(0),
+    running(false),
+    scrape_count(0)
+{
+}
+
+MetricsServer::~MetricsServer() {
+    this->stop();
+}
+
+bool MetricsServer::start(uint16_t port) {
+    if (running.load()) {
+        return false;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("metrics") << "Failed to create metrics socket: " << strerror(errno);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd, 4) != 0) {
+        LOG_ERROR("metrics") << "Failed to listen on 127.0.0.1:" << port << ": " << strerror(errno);
+        this->stop();
+        return false;
+    }
+
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&address), &length);
+    bound_port = ntohs(address.sin_port);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        this->stop();
+        return false;
+    }
+
+    running.store(true);
+    worker = std::thread(&MetricsServer::run, this);
+
+    LOG_INFO("metrics") << "Metrics on http://127.0.0.1:" << bound_port << "/metrics";
+    return true;
+}
+
+void MetricsServer::stop() {
+    if (running.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The thread still sees the flag on its next poll timeout
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    for (int *descriptor : { &listen_fd, &wake_fd }) {
+        if (*descriptor >= 0) {
+            close(*descriptor);
+            *descriptor = -1;
+        }
+    }
+}
+
+Metric *MetricsServer::metric(const std::string &name, MetricType type, const std::string &help,
+                              const std::string &labels) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    Metric *&entry = index[std::make_pair(name, labels)];
+    if (!entry) {
+        metrics.push_back(std::unique_ptr<Metric>(new Metric(name, type, help, labels)));
+        entry = metrics.back().get();
+    }
+
+    return entry;
+}
+
+std::string MetricsServer::render() const {
+    // Metrics are never removed, so the pointers stay valid once copied
+    std::vector<const Metric*> metrics;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const std::unique_ptr<Metric> &metric : this->metrics) {
+            metrics.push_back(metric.get());
+        }
+    }
+
+    std::string text;
+    std::vector<bool> written(metrics.size(), false);
+    char value[32];
+
+    // Samples of one family have to follow its HELP and TYPE lines together
+    for (size_t i = 0; i < metrics.size(); i++) {
+        if (written[i]) {
+            continue;
+        }
+
+        const Metric &family = *metrics[i];
+        text += "# HELP " + family.name + " " + family.help + "\n";
+        text += "# TYPE " + family.name + (family.type == MetricCounter ? " counter\n" : " gauge\n");
+
+        for (size_t j = i; j < metrics.size(); j++) {
+            const Metric &sample = *metrics[j];
+            if (written[j] || sample.name != family.name) {
+                continue;
+            }
+            written[j] = true;
+
+            snprintf(value, sizeof(value), "%.15g", sample.value());
+            text += sample.name;
+            if (!sample.labels.empty()) {
+                text += "{" + sample.labels + "}";
+            }
+            text += " ";
+            text += value;
+            text += "\n";
+        }
+    }
+
+    return text;
+}
+
+uint64_t MetricsServer::resident_memory_bytes() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+
+    return fields == 2 ? uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+double MetricsServer::process_age_ms() {
+    FILE *stat = fopen("/proc/self/stat", "r");
+    if (!stat) {
+        return 0;
+    }
+
+    char line[1024];
+    bool read = fgets(line, sizeof(line), stat) != nullptr;
+    fclose(stat);
+
+    // The command name may hold spaces, fields are counted after its closing parenthesis
+    const char *fields = read ? strrchr(line, ')') : nullptr;
+    unsigned long long start_ticks = 0;
+    if (!fields || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                          &start_ticks) != 1) {
+        return 0;
+    }
+
+    // The start time counts clock ticks since boot
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    double now_ms = now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+    return std::max(0.0, now_ms - start_ticks * 1e3 / sysconf(_SC_CLK_TCK));
+}
+
+void MetricsServer::serve(int client) {
+    struct timeval timeout;
+    timeout.tv_sec = CLIENT_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (CLIENT_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters, read up to the end of the head
+    std::string request;
+    char chunk[512];
+    while (request.size() < MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos) {
+        ssize_t size = recv(client, chunk, sizeof(chunk), 0);
+        if (size <= 0) {
+            break;
+        }
+        request.append(chunk, size_t(size));
+    }
+
+    std::string status;
+    std::string type = "text/plain; charset=utf-8";
+    std::string body;
+
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0) {
+        status = "200 OK";
+        type = "text/plain; version=0.0.4; charset=utf-8";
+        body = this->render();
+        scrape_count.fetch_add(1, std::memory_order_relaxed);
+    } else if (request.compare(0, 4, "GET ") == 0) {
+        status = "404 Not Found";
+        body = "Metrics are served on /metrics\n";
+    } else {
+        status = "405 Method Not Allowed";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: " + type + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    size_t offset = 0;
+    while (offset < response.size()) {
+        ssize_t size = send(client, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+        if (size <= 0) {
+            break;
+        }
+        offset += size_t(size);
+    }
+}
+
+void MetricsServer::run() {
+    while (running.load()) {
+        struct pollfd descriptors[2];
+        descriptors[0].fd = listen_fd;
+        descriptors[0].events = POLLIN;
+        descriptors[1].fd = wake_fd;
+        descriptors[1].events = POLLIN;
+
+        if (poll(descriptors, 2, 1000) <= 0 || !(descriptors[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+
+        // One scraper at a time is all a loopback endpoint needs
+        this->serve(client);
+        close(client);
+    }
+}
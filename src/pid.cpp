@@ -0,0 +1,52 @@
+#include "inc/pid.h"
+
+#include <algorithm>
+
+Pid::Pid(double kp, double ki, double kd, double limit) :
+    kp(kp),
+    ki(ki),
+    kd(kd),
+    limit(limit),
+    integral(0),
+    previous_error(0),
+    has_previous(false)
+{
+}
+
+void Pid::set_gains(double kp, double ki, double kd) {
+    this->kp = kp;
+    this->ki = ki;
+    this->kd = kd;
+}
+
+void Pid::set_output_limit(double limit) {
+    this->limit = limit;
+}
+
+double Pid::update(double error, double dt) {
+    if (dt <= 0) {
+        return 0;
+    }
+
+    double derivative = has_previous ? (error - previous_error) / dt : 0;
+    previous_error = error;
+    has_previous = true;
+
+    double candidate = integral + error * dt;
+    double output = kp * error + ki * candidate + kd * derivative;
+
+    if (limit > 0 && (output > limit || output < -limit)) {
+        // Saturated, keep the integral where it was
+        output = std::clamp(kp * error + ki * integral + kd * derivative, -limit, limit);
+    } else {
+        integral = candidate;
+    }
+
+    return output;
+}
+
+void Pid::reset() {
+    integral = 0;
+    previous_error = 0;
+    has_previous = false;
+}
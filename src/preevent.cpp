@@ -0,0 +1,354 @@
+#include "inc/preevent.h"
+#include "inc/logger.h"
+
+#include <gst/app/gstappsrc.h>
+
+#include <algorithm>
+
+// Beyond its own length, how long the tail of a clip may take to arrive
+// and the muxer to finish, a stalled stream closes the clip with what it has
+static const GstClockTime EXPORT_MARGIN = 5 * GST_SECOND;
+
+static bool is_keyframe(GstSample *sample) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    return buffer && !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+static GstClockTime sample_pts(GstSample *sample) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    return buffer ? GST_BUFFER_PTS(buffer) : GST_CLOCK_TIME_NONE;
+}
+
+static size_t sample_size(GstSample *sample) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    return buffer ? gst_buffer_get_size(buffer) : 0;
+}
+
+PreEventBuffer::PreEventBuffer() :
+    codec(RecordH264Mp4),
+    ring_bytes(0),
+    window(0),
+    max_bytes(0),
+    export_pipeline(nullptr),
+    export_source(nullptr),
+    export_base(0),
+    export_end(0),
+    exporting(false)
+{
+}
+
+PreEventBuffer::~PreEventBuffer() {
+    // No more encoded frames after this, then the clip can be closed
+    this->stop();
+    encoder.wait();
+
+    if (export_worker.joinable()) {
+        export_worker.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (GstSample *sample : ring) {
+        gst_sample_unref(sample);
+    }
+}
+
+bool PreEventBuffer::start(RecordingCodec codec, double window_seconds, size_t max_bytes) {
+    if (this->is_running() || window_seconds <= 0 || max_bytes == 0) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (GstSample *sample : ring) {
+            gst_sample_unref(sample);
+        }
+        ring.clear();
+        ring_bytes = 0;
+
+        this->codec = codec;
+        this->window = GstClockTime(window_seconds * GST_SECOND);
+        this->max_bytes = max_bytes;
+    }
+
+    bool started = encoder.start_encoded(codec, KEYFRAME_INTERVAL, [this](GstSample *sample) {
+        this->on_encoded(sample);
+    });
+
+    if (started) {
+        LOG_INFO("preevent") << "Pre-event buffer started (" << window_seconds << " s, "
+            << (max_bytes >> 20) << " MiB)";
+    }
+
+    return started;
+}
+
+void PreEventBuffer::stop() {
+    encoder.stop();
+
+    // A clip still waiting for its tail is closed with what it has
+    std::lock_guard<std::mutex> lock(mutex);
+    if (export_source) {
+        gst_app_src_end_of_stream(GST_APP_SRC(export_source));
+        export_source = nullptr;
+    }
+}
+
+// Called on the encoder's streaming thread for every encoded frame
+void PreEventBuffer::on_encoded(GstSample *sample) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The ring always starts on a keyframe
+    if (ring.empty() && !is_keyframe(sample)) {
+        return;
+    }
+
+    ring.push_back(gst_sample_ref(sample));
+    ring_bytes += sample_size(sample);
+    this->trim();
+
+    if (export_source) {
+        this->push_to_export(gst_sample_get_buffer(sample));
+
+        if (sample_pts(sample) >= export_end) {
+            gst_app_src_end_of_stream(GST_APP_SRC(export_source));
+            export_source = nullptr;
+        }
+    }
+}
+
+// Drops whole keyframe intervals from the front while the ring is over
+// budget or the next interval alone still covers the window. The newest
+// interval is always kept, so a budget below one interval keeps just that.
+void PreEventBuffer::trim() {
+    GstClockTime newest = sample_pts(ring.back());
+
+    while (true) {
+        size_t next = 1;
+        while (next < ring.size() && !is_keyframe(ring[next])) {
+            ++next;
+        }
+
+        if (next >= ring.size()) {
+            break;
+        }
+
+        GstClockTime next_start = sample_pts(ring[next]);
+        bool over_budget = ring_bytes > max_bytes;
+        bool outside_window = newest >= next_start && newest - next_start >= window;
+
+        if (!over_budget && !outside_window) {
+            break;
+        }
+
+        for (size_t i = 0; i < next; ++i) {
+            ring_bytes -= sample_size(ring.front());
+            gst_sample_unref(ring.front());
+            ring.pop_front();
+        }
+    }
+}
+
+// Shares the encoded memory, only the timestamps are rebased to the clip
+void PreEventBuffer::push_to_export(GstBuffer *buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    GstBuffer *copy = gst_buffer_copy(buffer);
+
+    if (GST_BUFFER_PTS_IS_VALID(copy)) {
+        GST_BUFFER_PTS(copy) = GST_BUFFER_PTS(copy) >= export_base
+            ? GST_BUFFER_PTS(copy) - export_base : 0;
+    }
+    if (GST_BUFFER_DTS_IS_VALID(copy)) {
+        GST_BUFFER_DTS(copy) = GST_BUFFER_DTS(copy) >= export_base
+            ? GST_BUFFER_DTS(copy) - export_base : 0;
+    }
+
+    // appsrc takes ownership of the buffer
+    gst_app_src_push_buffer(GST_APP_SRC(export_source), copy);
+}
+
+bool PreEventBuffer::export_clip(const std::string &path, double post_seconds) {
+    if (exporting.load()) {
+        LOG_WARNING("preevent") << "A clip is still being written to " << export_path;
+        return false;
+    }
+
+    if (export_worker.joinable()) {
+        export_worker.join();
+    }
+
+    // The clip pipeline is built and started without holding up the encoder
+    GstCaps *caps = nullptr;
+    RecordingCodec ring_codec;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (ring.empty()) {
+            LOG_WARNING("preevent") << "Pre-event buffer is empty";
+            return false;
+        }
+
+        caps = gst_caps_ref(gst_sample_get_caps(ring.front()));
+        ring_codec = codec;
+    }
+
+    // Already encoded, H.264 is only parsed and muxed, JPEG frames go
+    // straight into the muxer
+    bool h264 = (ring_codec == RecordH264Mp4);
+    const char *muxer_name = h264 ? "mp4mux" : "avimux";
+
+    GstElement *pipeline = gst_pipeline_new("clip_pipeline");
+    GstElement *source = gst_element_factory_make("appsrc", "clip_source");
+    GstElement *parser = h264 ? gst_element_factory_make("h264parse", "clip_parser") : nullptr;
+    GstElement *muxer = gst_element_factory_make(muxer_name, "clip_muxer");
+    GstElement *sink = gst_element_factory_make("filesink", "clip_sink");
+
+    if (!pipeline || !source || (h264 && !parser) || !muxer || !sink) {
+        LOG_ERROR("preevent") << "Failed to create clip elements";
+
+        GstElement *elements[] = { source, parser, muxer, sink };
+        for (GstElement *element : elements) {
+            if (element) {
+                gst_object_unref(gst_object_ref_sink(element));
+            }
+        }
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        gst_caps_unref(caps);
+        return false;
+    }
+
+    // Unbounded, the whole ring is queued at once as references
+    g_object_set(G_OBJECT(source),
+                 "caps", caps,
+                 "format", GST_FORMAT_TIME,
+                 "max-bytes", guint64(0),
+                 NULL);
+    g_object_set(G_OBJECT(sink), "location", path.c_str(), NULL);
+    gst_caps_unref(caps);
+
+    gst_bin_add_many(GST_BIN(pipeline), source, muxer, sink, NULL);
+    bool linked;
+    if (parser) {
+        gst_bin_add(GST_BIN(pipeline), parser);
+        linked = gst_element_link_many(source, parser, muxer, sink, NULL);
+    } else {
+        linked = gst_element_link_many(source, muxer, sink, NULL);
+    }
+
+    if (!linked || gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("preevent") << "Clip pipeline cannot be started";
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Restarted meanwhile, the ring no longer matches the clip's caps
+    if (ring.empty() || codec != ring_codec) {
+        LOG_WARNING("preevent") << "Pre-event buffer restarted, clip not saved";
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    GstBuffer *first = gst_sample_get_buffer(ring.front());
+    export_base = GST_BUFFER_DTS_IS_VALID(first) ? GST_BUFFER_DTS(first) : GST_BUFFER_PTS(first);
+    export_end = sample_pts(ring.back()) + GstClockTime(post_seconds * GST_SECOND);
+    export_pipeline = pipeline;
+    export_source = source;
+    export_path = path;
+
+    for (GstSample *sample : ring) {
+        this->push_to_export(gst_sample_get_buffer(sample));
+    }
+
+    // Nothing more is coming when the encoder has stopped
+    GstClockTime tail = GstClockTime(std::max(0.0, post_seconds) * GST_SECOND);
+    if (!this->is_running() || post_seconds <= 0) {
+        gst_app_src_end_of_stream(GST_APP_SRC(export_source));
+        export_source = nullptr;
+        tail = 0;
+    }
+
+    exporting.store(true);
+    export_worker = std::thread(&PreEventBuffer::wait_for_export, this, tail + EXPORT_MARGIN);
+
+    LOG_INFO("preevent") << "Writing " << ring.size() << " buffered frames to " << path;
+    return true;
+}
+
+RecordingCodec PreEventBuffer::clip_codec() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return codec;
+}
+
+// Runs until the muxer has written the end of the clip. Frames stop coming
+// when capture stops or stalls, so the tail is only waited for so long
+// before the clip is closed with what it has.
+void PreEventBuffer::wait_for_export(GstClockTime tail_timeout) {
+    const GstMessageType types = static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    GstBus *bus = gst_element_get_bus(export_pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, tail_timeout, types);
+
+    if (!message) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (export_source) {
+                LOG_WARNING("preevent") << "No frames for the rest of the clip, closing it early";
+                gst_app_src_end_of_stream(GST_APP_SRC(export_source));
+                export_source = nullptr;
+            }
+        }
+        message = gst_bus_timed_pop_filtered(bus, EXPORT_MARGIN, types);
+    }
+    gst_object_unref(bus);
+
+    if (!message) {
+        LOG_ERROR("preevent") << "Clip " << export_path << " was not finished in time";
+    } else if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+        GError *err = nullptr;
+        gst_message_parse_error(message, &err, NULL);
+        LOG_ERROR("preevent") << "Clip error: " << err->message;
+        g_error_free(err);
+    } else {
+        LOG_INFO("preevent") << "Clip written to " << export_path;
+    }
+    if (message) {
+        gst_message_unref(message);
+    }
+
+    GstElement *pipeline = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pipeline = export_pipeline;
+        export_pipeline = nullptr;
+        export_source = nullptr;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    exporting.store(false);
+}
+
+PreEventStats PreEventBuffer::stats() const {
+    PreEventStats stats;
+
+    stats.running = this->is_running();
+    stats.exporting = exporting.load();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.frames = ring.size();
+    stats.bytes = ring_bytes;
+    if (!ring.empty()) {
+        stats.seconds = double(sample_pts(ring.back()) - sample_pts(ring.front())) / GST_SECOND;
+    }
+
+    return stats;
+}
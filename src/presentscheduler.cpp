@@ -0,0 +1,132 @@
+#include "inc/presentscheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The playout delay comes down by this share of its excess per frame,
+// a late arrival raises it at once
+static const double PLAYOUT_DECAY = 1.0 / 64;
+// Weight of each new frame in the judder average
+static const double JUDDER_WEIGHT = 1.0 / 16;
+
+PresentScheduler::PresentScheduler() :
+    present_mode(PresentLowestLatency),
+    period_ns(int64_t(1e9 / DEFAULT_REFRESH_HZ)),
+    playout_ns(0),
+    last_present_ns(0),
+    last_capture_ns(0),
+    judder_ns(0),
+    shown(0),
+    dropped(0),
+    late(0),
+    latencies{},
+    latency_count(0)
+{
+}
+
+void PresentScheduler::set_mode(PresentMode mode) {
+    if (mode != present_mode) {
+        present_mode = mode;
+        this->reset();
+    }
+}
+
+void PresentScheduler::set_refresh_rate(double hz) {
+    period_ns = int64_t(1e9 / (hz > 1 ? hz : DEFAULT_REFRESH_HZ));
+}
+
+void PresentScheduler::reset() {
+    queue.clear();
+    playout_ns = 0;
+    last_present_ns = 0;
+    last_capture_ns = 0;
+    judder_ns = 0;
+}
+
+void PresentScheduler::push(const QImage &image, quint64 sequence, int64_t capture_ns, int64_t arrival_ns) {
+    if (capture_ns <= 0 || capture_ns > arrival_ns) {
+        capture_ns = arrival_ns;
+    }
+
+    int64_t due_ns = arrival_ns;
+
+    if (present_mode == PresentSmoothest) {
+        // Half a refresh of margin, so a frame arriving as slowly as the
+        // slowest recent ones is still due on time
+        int64_t target = (arrival_ns - capture_ns) + period_ns / 2;
+        if (target > playout_ns) {
+            playout_ns = target;
+        } else {
+            playout_ns -= int64_t((playout_ns - target) * PLAYOUT_DECAY);
+        }
+        due_ns = capture_ns + playout_ns;
+    }
+
+    queue.push_back(Pending{image, sequence, capture_ns, due_ns});
+
+    // The refreshes stopped coming, keep only the newest frames
+    while (queue.size() > MAX_QUEUED) {
+        queue.pop_front();
+        dropped++;
+    }
+}
+
+bool PresentScheduler::present(int64_t now_ns, PresentedFrame &frame) {
+    // Frames due before the middle of this refresh, the newest of them is shown
+    int64_t horizon = now_ns + period_ns / 2;
+    size_t due = 0;
+    while (due < queue.size() && queue[due].due_ns <= horizon) {
+        due++;
+    }
+
+    if (due == 0) {
+        return false;
+    }
+
+    dropped += due - 1;
+    Pending pending = std::move(queue[due - 1]);
+    queue.erase(queue.begin(), queue.begin() + due);
+
+    if (now_ns - pending.due_ns > period_ns) {
+        late++;
+    }
+
+    if (last_present_ns != 0) {
+        double mismatch = std::fabs(double((now_ns - last_present_ns) - (pending.capture_ns - last_capture_ns)));
+        judder_ns += (mismatch - judder_ns) * JUDDER_WEIGHT;
+    }
+    last_present_ns = now_ns;
+    last_capture_ns = pending.capture_ns;
+
+    latencies[latency_count % LATENCY_SAMPLES] = now_ns - pending.capture_ns;
+    latency_count++;
+    shown++;
+
+    frame.image.swap(pending.image);
+    frame.sequence = pending.sequence;
+    frame.capture_ns = pending.capture_ns;
+    return true;
+}
+
+PresentStats PresentScheduler::stats() const {
+    PresentStats stats;
+
+    stats.mode = present_mode;
+    stats.refresh_hz = 1e9 / period_ns;
+    stats.shown = shown;
+    stats.dropped = dropped;
+    stats.late = late;
+    stats.judder_ms = judder_ns / 1e6;
+    stats.playout_delay_ms = (present_mode == PresentSmoothest) ? playout_ns / 1e6 : 0;
+
+    std::vector<int64_t> samples(latencies.begin(),
+                                 latencies.begin() + std::min(latency_count, LATENCY_SAMPLES));
+    if (!samples.empty()) {
+        std::sort(samples.begin(), samples.end());
+        stats.latency_p50_ms = samples[samples.size() / 2] / 1e6;
+        stats.latency_p95_ms = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)] / 1e6;
+    }
+
+    return stats;
+}
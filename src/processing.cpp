@@ -0,0 +1,237 @@
+#include "inc/processing.h"
+#include "inc/logger.h"
+#include "inc/tiles.h"
+
+#include <algorithm>
+#include <chrono>
+
+ProcessingEngine::ProcessingEngine(QObject *parent) :
+    QObject(parent),
+    drop_policy(DropOldest),
+    queue_capacity(1),
+    running(false),
+    signal_pending(false),
+    tracer(nullptr)
+{
+}
+
+ProcessingEngine::~ProcessingEngine() {
+    this->stop();
+}
+
+bool ProcessingEngine::add_stage(const std::string &name, StageFunction function) {
+    if (running.load()) {
+        LOG_ERROR("processing") << "Cannot add stage " << name << " while processing is running";
+        return false;
+    }
+
+    std::unique_ptr<Stage> stage(new Stage(name, function));
+    stage->input.set_policy(drop_policy);
+    stage->input.set_capacity(queue_capacity);
+    stages.push_back(std::move(stage));
+
+    return true;
+}
+
+void ProcessingEngine::clear_stages() {
+    if (!running.load()) {
+        stages.clear();
+    }
+}
+
+void ProcessingEngine::set_drop_policy(DropPolicy policy) {
+    drop_policy = policy;
+    for (auto &stage : stages) {
+        stage->input.set_policy(policy);
+    }
+}
+
+void ProcessingEngine::set_queue_capacity(size_t capacity) {
+    capacity = std::clamp<size_t>(capacity, 1, MAX_QUEUE_CAPACITY);
+    queue_capacity = capacity;
+    for (auto &stage : stages) {
+        stage->input.set_capacity(capacity);
+    }
+}
+
+void ProcessingEngine::start() {
+    if (running.load() || stages.empty()) {
+        return;
+    }
+
+    running.store(true);
+    signal_pending.store(false);
+
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i]->input.reopen();
+        stages[i]->worker = std::thread(&ProcessingEngine::run_stage, this, i);
+    }
+
+    LOG_INFO("processing") << "Processing started with " << stages.size() << " stages";
+}
+
+void ProcessingEngine::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    // Closing the queues front to back lets every worker drain and exit
+    for (auto &stage : stages) {
+        stage->input.close();
+        if (stage->worker.joinable()) {
+            stage->worker.join();
+        }
+    }
+
+    LOG_INFO("processing") << "Processing stopped";
+}
+
+bool ProcessingEngine::submit(const QImage &image, quint64 sequence, int64_t capture_ns) {
+    if (!running.load() || stages.empty() || image.isNull()) {
+        return false;
+    }
+
+    // Only a reference to the frame, the copy is made by the first worker
+    std::unique_ptr<ProcessingFrame> frame(new ProcessingFrame);
+    frame->source = image;
+    frame->sequence = sequence;
+    frame->capture_ns = capture_ns;
+
+    return stages.front()->input.push(std::move(frame));
+}
+
+void ProcessingEngine::run_stage(size_t index) {
+    Stage &stage = *stages[index];
+    std::unique_ptr<ProcessingFrame> frame;
+
+    while (stage.input.pop(frame)) {
+        auto started = std::chrono::steady_clock::now();
+
+        // First stage takes a private RGB copy and lets the captured buffer go
+        if (frame->image.empty() && !frame->source.isNull()) {
+            QImage source = frame->source.convertToFormat(QImage::Format_RGB888);
+            Mat view(source.height(), source.width(), CV_8UC3,
+                     const_cast<uchar*>(source.constBits()), source.bytesPerLine());
+            frame->image = view.clone();
+            frame->source = QImage();
+        }
+
+        stage.function(*frame);
+
+        double elapsed = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - started).count();
+
+        quint64 processed = ++stage.processed;
+        double average = stage.average_ms.load();
+        stage.last_ms = elapsed;
+        stage.average_ms = (processed == 1) ? elapsed : average + (elapsed - average) / 16.0;
+        if (elapsed > stage.max_ms.load()) {
+            stage.max_ms = elapsed;
+        }
+
+        if (index + 1 < stages.size()) {
+            stages[index + 1]->input.push(std::move(frame));
+        } else {
+            this->publish(std::move(frame));
+        }
+    }
+}
+
+static void release_mat(void *info) {
+    delete static_cast<Mat*>(info);
+}
+
+void ProcessingEngine::publish(std::unique_ptr<ProcessingFrame> frame) {
+    if (frame->image.empty()) {
+        return;
+    }
+
+    if (tracer) {
+        tracer->mark(frame->sequence, TRACE_PROCESSED);
+    }
+
+    // The QImage shares the Mat data, the Mat header lives as long as the image
+    Mat *holder = new Mat(frame->image);
+
+    ProcessedFrame &slot = results.write_slot();
+    slot.image = QImage(holder->data, holder->cols, holder->rows, int(holder->step),
+                        QImage::Format_RGB888, release_mat, holder);
+    slot.sequence = frame->sequence;
+    slot.contours = frame->contours.size();
+
+    if (result_sink) {
+        result_sink(slot.image, slot.sequence, frame->capture_ns);
+    }
+
+    results.publish();
+
+    if (!signal_pending.exchange(true)) {
+        emit resultReady(frame->sequence);
+    }
+}
+
+ProcessedFrame ProcessingEngine::pull_result() {
+    signal_pending.store(false);
+
+    results.update();
+    return results.read_slot();
+}
+
+std::vector<StageStats> ProcessingEngine::stage_stats() const {
+    std::vector<StageStats> stats;
+
+    for (const auto &stage : stages) {
+        StageStats entry;
+        entry.name = stage->name;
+        entry.processed = stage->processed.load();
+        entry.dropped = stage->input.dropped();
+        entry.queued = stage->input.size();
+        entry.last_ms = stage->last_ms.load();
+        entry.average_ms = stage->average_ms.load();
+        entry.max_ms = stage->max_ms.load();
+        stats.push_back(entry);
+    }
+
+    return stats;
+}
+
+// Stages, working on RGB frames
+
+static void blur_stage(ProcessingFrame &frame) {
+    // Analysis does not need more than VGA
+    if (frame.image.cols > 640 || frame.image.rows > 480) {
+        resize(frame.image, frame.image, Size(640, 480));
+    }
+
+    tiled_gaussian_blur(WorkStealingPool::shared(), frame.image, frame.image, Size(3, 3), 0.8);
+}
+
+static void edges_stage(ProcessingFrame &frame) {
+    Mat gray;
+    tiled_cvt_color(WorkStealingPool::shared(), frame.image, gray, COLOR_RGB2GRAY);
+
+    // Hysteresis follows edges across the whole frame, not split into bands
+    Canny(gray, frame.edges, 100, 200);
+}
+
+static void contours_stage(ProcessingFrame &frame) {
+    if (frame.edges.empty()) {
+        return;
+    }
+
+    findContours(frame.edges, frame.contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+}
+
+static void overlay_stage(ProcessingFrame &frame) {
+    drawContours(frame.image, frame.contours, -1, Scalar(0, 255, 0), 2);
+
+    std::string info = "Frame contours: " + std::to_string(frame.contours.size());
+    putText(frame.image, info, Point(10, 30), FONT_HERSHEY_SIMPLEX, 0.7, Scalar(255, 0, 0), 2);
+}
+
+void register_default_stages(ProcessingEngine &engine) {
+    engine.add_stage("blur", blur_stage);
+    engine.add_stage("edges", edges_stage);
+    engine.add_stage("contours", contours_stage);
+    engine.add_stage("overlay", overlay_stage);
+}
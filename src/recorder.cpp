@@ -0,0 +1,340 @@
+#include "inc/recorder.h"
+#include "inc/logger.h"
+#include "inc/gstreamer.h"
+#include "inc/frametrace.h"
+
+#include <algorithm>
+
+Recorder::Recorder() :
+    codec(RecordH264Mp4),
+    keyframe_interval(0),
+    queue(QUEUE_CAPACITY, DropOldest),
+    recording(false),
+    pipeline(nullptr),
+    source(nullptr),
+    caps(nullptr),
+    caps_width(0),
+    caps_height(0),
+    first_time_ns(0),
+    submitted(0),
+    written(0),
+    skipped(0),
+    dropped_base(0)
+{
+}
+
+Recorder::~Recorder() {
+    this->stop();
+    this->wait();
+}
+
+bool Recorder::start(const std::string &path, RecordingCodec codec) {
+    if (recording.load()) {
+        return false;
+    }
+
+    // The previous file is finalised before its worker is reused
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    this->path = path;
+    this->codec = codec;
+    this->encoded_sink = nullptr;
+    this->keyframe_interval = 0;
+
+    LOG_INFO("recorder") << "Recording to " << path;
+    return this->start_worker();
+}
+
+bool Recorder::start_encoded(RecordingCodec codec, int keyframe_interval, EncodedSink sink) {
+    if (recording.load() || !sink) {
+        return false;
+    }
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    this->path.clear();
+    this->codec = codec;
+    this->encoded_sink = sink;
+    this->keyframe_interval = keyframe_interval;
+
+    return this->start_worker();
+}
+
+bool Recorder::start_worker() {
+    submitted = 0;
+    written = 0;
+    skipped = 0;
+    dropped_base = queue.dropped();
+
+    queue.reopen();
+    recording.store(true);
+    worker = std::thread(&Recorder::run, this);
+
+    return true;
+}
+
+GstFlowReturn encoded_sample_callback(GstElement *sink, gpointer data) {
+    Recorder *recorder = static_cast<Recorder*>(data);
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+
+    if (sample) {
+        recorder->encoded_sink(sample);
+        gst_sample_unref(sample);
+    }
+
+    return GST_FLOW_OK;
+}
+
+void Recorder::stop() {
+    if (!recording.exchange(false)) {
+        return;
+    }
+
+    // The worker drains what is queued, sends EOS and exits on its own
+    queue.close();
+}
+
+void Recorder::wait() {
+    if (!recording.load() && worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool Recorder::submit(const QImage &image, int64_t capture_ns) {
+    if (!recording.load() || image.isNull()) {
+        return false;
+    }
+
+    RecordFrame frame;
+    frame.image = image;
+    frame.time_ns = (capture_ns > 0) ? capture_ns : FrameTracer::now_ns();
+
+    ++submitted;
+    return queue.push(std::move(frame));
+}
+
+RecordingStats Recorder::stats() const {
+    RecordingStats stats;
+
+    stats.active = recording.load();
+    stats.path = path;
+    stats.submitted = submitted.load();
+    stats.written = written.load();
+    stats.dropped = queue.dropped() - dropped_base + skipped.load();
+
+    return stats;
+}
+
+void Recorder::run() {
+    RecordFrame frame;
+
+    while (queue.pop(frame)) {
+        QImage image = frame.image.convertToFormat(QImage::Format_RGB888);
+        frame.image = QImage();
+
+        if (!this->pipeline) {
+            if (!this->create_pipeline(image)) {
+                ++skipped;
+                continue;
+            }
+            first_time_ns = frame.time_ns;
+        }
+
+        if (!this->check_bus()) {
+            ++skipped;
+            continue;
+        }
+
+        // Never wait on the encoder, what does not fit its input queue is dropped
+        guint64 max_bytes = gst_app_src_get_max_bytes(GST_APP_SRC(this->source));
+        if (gst_app_src_get_current_level_bytes(GST_APP_SRC(this->source)) >= max_bytes) {
+            ++skipped;
+            continue;
+        }
+
+        if (image.width() != caps_width || image.height() != caps_height) {
+            gst_caps_replace(&this->caps, NULL);
+            caps_width = image.width();
+            caps_height = image.height();
+            this->caps = gst_caps_new_simple("video/x-raw",
+                                             "format", G_TYPE_STRING, "RGB",
+                                             "width", G_TYPE_INT, caps_width,
+                                             "height", G_TYPE_INT, caps_height,
+                                             "framerate", GST_TYPE_FRACTION, 0, 1,
+                                             NULL);
+        }
+
+        Mat view(image.height(), image.width(), CV_8UC3,
+                 const_cast<uchar*>(image.constBits()), image.bytesPerLine());
+        GstSample *sample = GstreamerCameraCapture::mat_to_gst_sample(
+            view, this->caps, GstClockTime(std::max<int64_t>(0, frame.time_ns - first_time_ns)));
+
+        // The copy is in the sample, the captured frame can go back to its pool
+        image = QImage();
+
+        if (!sample) {
+            ++skipped;
+            continue;
+        }
+
+        if (gst_app_src_push_sample(GST_APP_SRC(this->source), sample) == GST_FLOW_OK) {
+            ++written;
+        } else {
+            ++skipped;
+        }
+        gst_sample_unref(sample);
+    }
+
+    this->finish_pipeline();
+}
+
+// Built on the first frame, the file keeps that size and later frames are scaled to it
+bool Recorder::create_pipeline(const QImage &first) {
+    const char *encoder_name = (codec == RecordH264Mp4) ? "x264enc" : "jpegenc";
+    // Encoded output skips the muxer, an identity keeps the chain the same shape
+    const char *muxer_name = encoded_sink ? "identity"
+                                          : (codec == RecordH264Mp4) ? "mp4mux" : "avimux";
+    const char *sink_name = encoded_sink ? "appsink" : "filesink";
+
+    this->pipeline = gst_pipeline_new("rec_pipeline");
+    this->source = gst_element_factory_make("appsrc", "rec_source");
+    GstElement *scale = gst_element_factory_make("videoscale", "rec_scale");
+    GstElement *filter = gst_element_factory_make("capsfilter", "rec_filter");
+    GstElement *convert = gst_element_factory_make("videoconvert", "rec_convert");
+    GstElement *encoder = gst_element_factory_make(encoder_name, "rec_encoder");
+    GstElement *muxer = gst_element_factory_make(muxer_name, "rec_muxer");
+    GstElement *sink = gst_element_factory_make(sink_name, "rec_sink");
+
+    if (!this->pipeline || !this->source || !scale || !filter || !convert ||
+        !encoder || !muxer || !sink) {
+        LOG_ERROR("recorder") << "Failed to create recording elements (" << encoder_name << ", "
+            << muxer_name << ")";
+
+        GstElement *elements[] = { this->source, scale, filter, convert, encoder, muxer, sink };
+        for (GstElement *element : elements) {
+            if (element) {
+                gst_object_unref(gst_object_ref_sink(element));
+            }
+        }
+        if (this->pipeline) {
+            gst_object_unref(this->pipeline);
+        }
+        this->pipeline = nullptr;
+        this->source = nullptr;
+        this->stop();
+        return false;
+    }
+
+    // Bounded by bytes, two frames is enough to ride out encoder jitter
+    g_object_set(G_OBJECT(this->source),
+                 "format", GST_FORMAT_TIME,
+                 "block", FALSE,
+                 "max-bytes", guint64(2) * guint64(first.width()) * guint64(first.height()) * 3,
+                 NULL);
+
+    GstCaps *size_caps = gst_caps_new_simple("video/x-raw",
+                                             "width", G_TYPE_INT, first.width(),
+                                             "height", G_TYPE_INT, first.height(),
+                                             NULL);
+    g_object_set(G_OBJECT(filter), "caps", size_caps, NULL);
+    gst_caps_unref(size_caps);
+
+    if (codec == RecordH264Mp4) {
+        gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "ultrafast");
+        gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+        if (keyframe_interval > 0) {
+            g_object_set(G_OBJECT(encoder), "key-int-max", guint(keyframe_interval), NULL);
+        }
+    }
+
+    if (encoded_sink) {
+        // Whole access units with codec data in the caps, ready to be muxed later
+        GstCaps *sink_caps = (codec == RecordH264Mp4)
+            ? gst_caps_new_simple("video/x-h264",
+                                  "stream-format", G_TYPE_STRING, "avc",
+                                  "alignment", G_TYPE_STRING, "au",
+                                  NULL)
+            : gst_caps_new_empty_simple("image/jpeg");
+        gst_app_sink_set_caps(GST_APP_SINK(sink), sink_caps);
+        gst_caps_unref(sink_caps);
+
+        g_object_set(G_OBJECT(sink), "emit-signals", TRUE, "sync", FALSE, NULL);
+        g_signal_connect(sink, "new-sample", G_CALLBACK(encoded_sample_callback), this);
+    } else {
+        g_object_set(G_OBJECT(sink), "location", path.c_str(), NULL);
+    }
+
+    gst_bin_add_many(GST_BIN(this->pipeline), this->source, scale, filter, convert,
+                     encoder, muxer, sink, NULL);
+
+    if (!gst_element_link_many(this->source, scale, filter, convert, encoder, muxer, sink, NULL) ||
+        gst_element_set_state(this->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("recorder") << "Recording pipeline cannot be started";
+        gst_element_set_state(this->pipeline, GST_STATE_NULL);
+        gst_object_unref(this->pipeline);
+        this->pipeline = nullptr;
+        this->source = nullptr;
+        this->stop();
+        return false;
+    }
+
+    caps_width = 0;
+    caps_height = 0;
+    return true;
+}
+
+// Stops recording on the first pipeline error, e.g. a full disk
+bool Recorder::check_bus() {
+    GstBus *bus = gst_element_get_bus(this->pipeline);
+    GstMessage *message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    gst_object_unref(bus);
+
+    if (!message) {
+        return true;
+    }
+
+    GError *err = nullptr;
+    gst_message_parse_error(message, &err, NULL);
+    LOG_ERROR("recorder") << "Recording error: " << err->message;
+    g_error_free(err);
+    gst_message_unref(message);
+
+    this->stop();
+    return false;
+}
+
+void Recorder::finish_pipeline() {
+    if (this->pipeline) {
+        // The muxer writes its index on EOS, wait for it to reach the file
+        gst_app_src_end_of_stream(GST_APP_SRC(this->source));
+
+        GstBus *bus = gst_element_get_bus(this->pipeline);
+        GstMessage *message = gst_bus_timed_pop_filtered(
+            bus, 5 * GST_SECOND, static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        gst_object_unref(bus);
+
+        if (!message || GST_MESSAGE_TYPE(message) != GST_MESSAGE_EOS) {
+            LOG_WARNING("recorder") << "Recording " << (encoded_sink ? "stream" : path)
+                << " was not finalised cleanly";
+        }
+        if (message) {
+            gst_message_unref(message);
+        }
+
+        gst_element_set_state(this->pipeline, GST_STATE_NULL);
+        gst_object_unref(this->pipeline);
+        this->pipeline = nullptr;
+        this->source = nullptr;
+    }
+
+    gst_caps_replace(&this->caps, NULL);
+
+    if (!encoded_sink) {
+        LOG_INFO("recorder") << "Recording finished: " << written.load() << " frames written, "
+            << (queue.dropped() - dropped_base + skipped.load()) << " dropped";
+    }
+}
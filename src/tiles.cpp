@@ -0,0 +1,115 @@
+#include "inc/tiles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+// Bands per thread, a few more than threads so stealing can even out the load
+static const int BANDS_PER_THREAD = 4;
+static const int MIN_BAND_ROWS = 16;
+
+void parallel_bands(WorkStealingPool &pool, const Mat &src, Mat &dst,
+                    int halo, const BandOperation &op) {
+    int rows = src.rows;
+    int bands = std::max(1, std::min(int(pool.size()) * BANDS_PER_THREAD, rows / MIN_BAND_ROWS));
+
+    if (bands == 1) {
+        op(src, dst);
+        return;
+    }
+
+    pool.run(size_t(bands), [&](size_t band) {
+        int top = int(int64_t(rows) * int64_t(band) / bands);
+        int bottom = int(int64_t(rows) * int64_t(band + 1) / bands);
+        int halo_top = std::max(0, top - halo);
+        int halo_bottom = std::min(rows, bottom + halo);
+
+        // The input band is a view, only the output needs its own memory
+        Mat input = src.rowRange(halo_top, halo_bottom);
+        Mat output;
+        op(input, output);
+
+        output.rowRange(top - halo_top, bottom - halo_top).copyTo(dst.rowRange(top, bottom));
+    });
+}
+
+void tiled_gaussian_blur(WorkStealingPool &pool, const Mat &src, Mat &dst,
+                         Size ksize, double sigma) {
+    Mat result(src.size(), src.type());
+    int halo = std::max(ksize.width, ksize.height) / 2;
+
+    // BORDER_ISOLATED keeps each band to its halo rows, the image edges get
+    // the same reflection the full-frame call applies
+    parallel_bands(pool, src, result, halo, [ksize, sigma](const Mat &in, Mat &out) {
+        GaussianBlur(in, out, ksize, sigma, 0, BORDER_REFLECT_101 | BORDER_ISOLATED);
+    });
+
+    dst = result;
+}
+
+void tiled_cvt_color(WorkStealingPool &pool, const Mat &src, Mat &dst, int code) {
+    // Per-pixel, no halo needed, the output type is found on a single pixel
+    Mat probe;
+    cvtColor(src(Rect(0, 0, 1, 1)), probe, code);
+
+    Mat result(src.size(), probe.type());
+    parallel_bands(pool, src, result, 0, [code](const Mat &in, Mat &out) {
+        cvtColor(in, out, code);
+    });
+
+    dst = result;
+}
+
+bool run_tile_benchmark(unsigned max_threads, int iterations) {
+    const Size resolutions[] = { Size(1280, 720), Size(1920, 1080) };
+    const Size ksize(5, 5);
+    const double sigma = 1.2;
+
+    // Keep OpenCV from threading internally so only our scheduler scales
+    int opencv_threads = getNumThreads();
+    setNumThreads(0);
+
+    bool identical = true;
+    RNG rng(0x7117);
+
+    std::printf("%-10s %8s %12s %9s %10s\n", "frame", "threads", "ms/frame", "speedup", "identical");
+
+    for (const Size &size : resolutions) {
+        Mat frame(size, CV_8UC3);
+        rng.fill(frame, RNG::UNIFORM, 0, 256);
+
+        Mat reference;
+        GaussianBlur(frame, reference, ksize, sigma, 0, BORDER_REFLECT_101);
+
+        double single_ms = 0;
+
+        for (unsigned threads = 1; threads <= max_threads; ++threads) {
+            WorkStealingPool pool(threads);
+            Mat result;
+
+            // Warm-up run also provides the result to compare
+            tiled_gaussian_blur(pool, frame, result, ksize, sigma);
+            bool same = norm(result, reference, NORM_INF) == 0;
+            identical = identical && same;
+
+            auto started = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                tiled_gaussian_blur(pool, frame, result, ksize, sigma);
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - started).count() / iterations;
+
+            if (threads == 1) {
+                single_ms = ms;
+            }
+
+            std::printf("%4dx%-5d %8u %12.3f %8.2fx %10s\n", size.width, size.height, threads,
+                        ms, single_ms / ms, same ? "yes" : "NO");
+        }
+    }
+
+    setNumThreads(opencv_threads);
+
+    return identical;
+}
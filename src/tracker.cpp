@@ -0,0 +1,317 @@
+#include "inc/tracker.h"
+#include "inc/logger.h"
+#include "inc/frametrace.h"
+#include "inc/turretcontroller.h"
+
+#include <algorithm>
+
+// Axis speed in position units per second for a target at the frame edge
+static const double TRACK_KP = 120.0;
+static const double TRACK_KI = 10.0;
+static const double TRACK_KD = 8.0;
+static const double TRACK_MAX_SPEED = 200.0;
+
+// Above this the template slowly follows changes in the target's appearance
+static const double ADAPT_SCORE = 0.85;
+static const double ADAPT_RATE = 0.1;
+
+TemplateTracker::TemplateTracker() :
+    scale(1.0)
+{
+}
+
+void TemplateTracker::reset() {
+    templ.release();
+    box = Rect2f();
+}
+
+Mat TemplateTracker::prepare(const Mat &frame, const Rect &area) const {
+    Size size(std::max(1, cvRound(area.width * scale)), std::max(1, cvRound(area.height * scale)));
+
+    // Downscale first, the colour conversion then runs on the small patch
+    Mat small, gray;
+    resize(frame(area), small, size, 0, 0, INTER_AREA);
+    cvtColor(small, gray, COLOR_RGB2GRAY);
+
+    return gray;
+}
+
+bool TemplateTracker::init(const Mat &frame, const Rect &target) {
+    Rect area = target & Rect(0, 0, frame.cols, frame.rows);
+
+    if (area.width < 8 || area.height < 8) {
+        this->reset();
+        return false;
+    }
+
+    scale = std::min(1.0, double(TEMPLATE_SIZE) / std::max(area.width, area.height));
+    templ = this->prepare(frame, area);
+    box = Rect2f(area);
+
+    return true;
+}
+
+bool TemplateTracker::update(const Mat &frame, Rect2f &target, double &score) {
+    score = 0;
+    target = box;
+
+    if (templ.empty()) {
+        return false;
+    }
+
+    // Search one target size around the last position
+    Rect bounds(0, 0, frame.cols, frame.rows);
+    Rect last(box);
+    int margin = std::max(last.width, last.height);
+    Rect search = Rect(last.x - margin, last.y - margin,
+                       last.width + 2 * margin, last.height + 2 * margin) & bounds;
+
+    if (search.width < last.width || search.height < last.height) {
+        return false;
+    }
+
+    Mat patch = this->prepare(frame, search);
+    if (patch.cols < templ.cols || patch.rows < templ.rows) {
+        return false;
+    }
+
+    Mat response;
+    matchTemplate(patch, templ, response, TM_CCOEFF_NORMED);
+
+    Point best;
+    minMaxLoc(response, NULL, &score, NULL, &best);
+
+    if (score < MIN_SCORE) {
+        return false;
+    }
+
+    box.x = float(search.x + best.x / scale);
+    box.y = float(search.y + best.y / scale);
+    target = box;
+
+    if (score > ADAPT_SCORE) {
+        Rect area = Rect(box) & bounds;
+        Mat current = this->prepare(frame, area);
+        if (current.size() == templ.size()) {
+            addWeighted(templ, 1.0 - ADAPT_RATE, current, ADAPT_RATE, 0, templ);
+        }
+    }
+
+    return true;
+}
+
+TrackingLoop::TrackingLoop(QObject *parent) :
+    QObject(parent),
+    queue(QUEUE_CAPACITY, DropOldest),
+    running(false),
+    target_cleared(false),
+    x_pid(TRACK_KP, TRACK_KI, TRACK_KD, TRACK_MAX_SPEED),
+    y_pid(TRACK_KP, TRACK_KI, TRACK_KD, TRACK_MAX_SPEED),
+    x_position(0),
+    y_position(0),
+    last_frame_ns(0),
+    last_submit_ns(0),
+    locked(false),
+    score(0),
+    frames(0),
+    late(0),
+    replaced(0),
+    last_ms(0),
+    average_ms(0),
+    max_ms(0),
+    frame_period_ms(0)
+{
+}
+
+TrackingLoop::~TrackingLoop() {
+    this->stop();
+}
+
+void TrackingLoop::start(double x, double y) {
+    if (running.load()) {
+        return;
+    }
+
+    x_position = x;
+    y_position = y;
+    last_frame_ns = 0;
+    last_submit_ns = 0;
+    x_pid.reset();
+    y_pid.reset();
+
+    frames = 0;
+    late = 0;
+    replaced = 0;
+    max_ms = 0;
+    frame_period_ms = 0;
+
+    running.store(true);
+    queue.reopen();
+    worker = std::thread(&TrackingLoop::run, this);
+
+    LOG_INFO("tracking") << "Tracking started";
+}
+
+void TrackingLoop::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    queue.close();
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    locked = false;
+    LOG_INFO("tracking") << "Tracking stopped";
+}
+
+void TrackingLoop::select_target(const QRectF &target) {
+    std::lock_guard<std::mutex> lock(target_mutex);
+    pending_target = target;
+    target_cleared = false;
+}
+
+void TrackingLoop::clear_target() {
+    std::lock_guard<std::mutex> lock(target_mutex);
+    pending_target.reset();
+    target_cleared = true;
+}
+
+bool TrackingLoop::submit(const QImage &image, quint64 sequence) {
+    if (!running.load() || image.isNull()) {
+        return false;
+    }
+
+    TrackingFrame frame;
+    frame.image = image;
+    frame.sequence = sequence;
+    frame.time_ns = FrameTracer::now_ns();
+
+    // The period is taken here rather than from the frames the worker
+    // gets, which a slow worker would stretch to its own pace
+    if (last_submit_ns) {
+        double interval = double(frame.time_ns - last_submit_ns) / 1e6;
+        double period = frame_period_ms.load();
+        frame_period_ms = (period == 0) ? interval : period + (interval - period) / 16.0;
+    }
+    last_submit_ns = frame.time_ns;
+
+    // Only the newest frame matters, an older one still queued is replaced.
+    // push() also fails once closed, the drop count tells the two apart
+    uint64_t dropped = queue.dropped();
+    bool queued = queue.push(std::move(frame));
+    if (queue.dropped() != dropped) {
+        ++replaced;
+    }
+    return queued;
+}
+
+void TrackingLoop::run() {
+    TrackingFrame frame;
+
+    while (queue.pop(frame)) {
+        // Between the frames actually tracked, what the PID integrates over
+        double dt = 0;
+        if (last_frame_ns) {
+            dt = double(frame.time_ns - last_frame_ns) / 1e9;
+        }
+        last_frame_ns = frame.time_ns;
+
+        this->track(frame, dt);
+        frame.image = QImage();
+
+        // From frame arrival to the axis command, queueing included
+        double elapsed = double(FrameTracer::now_ns() - frame.time_ns) / 1e6;
+        quint64 count = ++frames;
+        double average = average_ms.load();
+        last_ms = elapsed;
+        average_ms = (count == 1) ? elapsed : average + (elapsed - average) / 16.0;
+        if (elapsed > max_ms.load()) {
+            max_ms = elapsed;
+        }
+        if (frame_period_ms.load() > 0 && elapsed > frame_period_ms.load()) {
+            ++late;
+        }
+    }
+}
+
+void TrackingLoop::track(TrackingFrame &frame, double dt) {
+    std::optional<QRectF> selected;
+    bool cleared = false;
+    {
+        std::lock_guard<std::mutex> lock(target_mutex);
+        selected.swap(pending_target);
+        std::swap(cleared, target_cleared);
+    }
+
+    if (cleared) {
+        tracker.reset();
+        locked = false;
+        return;
+    }
+
+    QImage image = (frame.image.format() == QImage::Format_RGB888)
+        ? frame.image
+        : frame.image.convertToFormat(QImage::Format_RGB888);
+    Mat view(image.height(), image.width(), CV_8UC3,
+             const_cast<uchar*>(image.constBits()), image.bytesPerLine());
+
+    if (selected) {
+        Rect target(cvRound(selected->x() * view.cols), cvRound(selected->y() * view.rows),
+                    cvRound(selected->width() * view.cols), cvRound(selected->height() * view.rows));
+        if (!tracker.init(view, target)) {
+            LOG_WARNING("tracking") << "Tracking target too small";
+        }
+        x_pid.reset();
+        y_pid.reset();
+    }
+
+    if (!tracker.is_initialized()) {
+        locked = false;
+        return;
+    }
+
+    Rect2f box;
+    double match = 0;
+    bool found = tracker.update(view, box, match);
+    score = match;
+    locked = found;
+
+    emit targetUpdated(QRectF(box.x / view.cols, box.y / view.rows,
+                              box.width / view.cols, box.height / view.rows), found);
+
+    // A lost target holds the axes where they are
+    if (!found || dt <= 0) {
+        return;
+    }
+
+    // Offset from the image centre in [-1, 1], up and right are positive
+    double half_width = view.cols / 2.0;
+    double half_height = view.rows / 2.0;
+    double x_error = (box.x + box.width / 2.0 - half_width) / half_width;
+    double y_error = -(box.y + box.height / 2.0 - half_height) / half_height;
+
+    const double limit = TurretController::AXIS_LIMIT;
+    x_position = std::clamp(x_position + x_pid.update(x_error, dt) * dt, -limit, limit);
+    y_position = std::clamp(y_position + y_pid.update(y_error, dt) * dt, -limit, limit);
+
+    emit axesCommanded(x_position, y_position);
+}
+
+TrackingStats TrackingLoop::stats() const {
+    TrackingStats stats;
+
+    stats.running = running.load();
+    stats.locked = locked.load();
+    stats.score = score.load();
+    stats.frames = frames.load();
+    stats.late = late.load();
+    stats.replaced = replaced.load();
+    stats.last_ms = last_ms.load();
+    stats.average_ms = average_ms.load();
+    stats.max_ms = max_ms.load();
+    stats.frame_period_ms = frame_period_ms.load();
+
+    return stats;
+}
@@ -0,0 +1,271 @@
+#include "inc/turretcontroller.h"
+#include "inc/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// Defaults match the old 5 units per 50 ms keyboard step, reached in 100 ms
+static const double DEFAULT_MAX_SPEED = 100.0;
+static const double DEFAULT_ACCELERATION = 1000.0;
+
+// Closer than this to a position target the axis is considered there
+static const double POSITION_TOLERANCE = 0.01;
+
+static int64_t timespec_ns(const struct timespec &time) {
+    return int64_t(time.tv_sec) * 1000000000LL + time.tv_nsec;
+}
+
+static struct timespec ns_timespec(int64_t ns) {
+    struct timespec time;
+    time.tv_sec = ns / 1000000000LL;
+    time.tv_nsec = ns % 1000000000LL;
+    return time;
+}
+
+static int64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_ns(now);
+}
+
+TurretController::TurretController(int rate_hz) :
+    running(false),
+    position_mode(false),
+    max_speed(DEFAULT_MAX_SPEED),
+    acceleration(DEFAULT_ACCELERATION),
+    rate_hz(std::max(1, rate_hz)),
+    period_ns(1000000000LL / std::max(1, rate_hz)),
+    ticks(0),
+    overruns(0),
+    jitter_sum_us(0),
+    jitter_window_max_us(0),
+    jitter_peak_us(0),
+    jitter_samples(0),
+    jitter_average_us(0),
+    jitter_max_us(0)
+{
+}
+
+TurretController::~TurretController() {
+    this->stop();
+}
+
+void TurretController::start() {
+    if (running.exchange(true)) {
+        return;
+    }
+
+    worker = std::thread(&TurretController::run, this);
+
+    // A real-time class keeps the loop on time under load, it needs
+    // CAP_SYS_NICE or an rtprio limit and runs as a normal thread otherwise
+    struct sched_param param;
+    param.sched_priority = 10;
+    int error = pthread_setschedparam(worker.native_handle(), SCHED_FIFO, &param);
+    if (error != 0) {
+        LOG_WARNING("turret") << "Turret control thread runs without real-time priority: "
+            << strerror(error);
+    }
+}
+
+void TurretController::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool TurretController::submit(const TurretCommand &command) {
+    return commands.try_push(command);
+}
+
+bool TurretController::jog(int x_direction, int y_direction) {
+    TurretCommand command;
+    command.type = TurretJog;
+    command.x = std::clamp(x_direction, -1, 1);
+    command.y = std::clamp(y_direction, -1, 1);
+    return this->submit(command);
+}
+
+bool TurretController::move_to(double x, double y) {
+    TurretCommand command;
+    command.type = TurretMoveTo;
+    command.x = x;
+    command.y = y;
+    return this->submit(command);
+}
+
+bool TurretController::halt() {
+    TurretCommand command;
+    command.type = TurretHalt;
+    return this->submit(command);
+}
+
+bool TurretController::set_speed(double units_per_second) {
+    TurretCommand command;
+    command.type = TurretSetSpeed;
+    command.x = units_per_second;
+    return this->submit(command);
+}
+
+bool TurretController::set_acceleration(double units_per_second2) {
+    TurretCommand command;
+    command.type = TurretSetAcceleration;
+    command.x = units_per_second2;
+    return this->submit(command);
+}
+
+bool TurretController::set_rate(int hz) {
+    TurretCommand command;
+    command.type = TurretSetRate;
+    command.x = hz;
+    return this->submit(command);
+}
+
+const TurretState &TurretController::state() {
+    states.update();
+    return states.read_slot();
+}
+
+void TurretController::apply(const TurretCommand &command) {
+    switch (command.type) {
+    case TurretJog:
+        position_mode = false;
+        x_axis.direction = int(command.x);
+        y_axis.direction = int(command.y);
+        break;
+    case TurretMoveTo:
+        position_mode = true;
+        x_axis.target = std::clamp(command.x, -AXIS_LIMIT, AXIS_LIMIT);
+        y_axis.target = std::clamp(command.y, -AXIS_LIMIT, AXIS_LIMIT);
+        break;
+    case TurretHalt:
+        position_mode = false;
+        x_axis.direction = 0;
+        y_axis.direction = 0;
+        break;
+    case TurretSetSpeed:
+        if (command.x > 0)
+            max_speed = command.x;
+        break;
+    case TurretSetAcceleration:
+        if (command.x > 0)
+            acceleration = command.x;
+        break;
+    case TurretSetRate:
+        if (command.x >= 1) {
+            rate_hz = int(command.x);
+            period_ns = 1000000000LL / rate_hz;
+        }
+        break;
+    }
+}
+
+void TurretController::step(Axis &axis, double dt) {
+    double desired = 0;
+
+    if (position_mode) {
+        // Fastest speed that can still stop at the target
+        double error = axis.target - axis.position;
+        double stopping = std::sqrt(2.0 * acceleration * std::fabs(error));
+        desired = std::copysign(std::min(max_speed, stopping), error);
+
+        if (std::fabs(error) < POSITION_TOLERANCE && std::fabs(axis.velocity) < acceleration * dt) {
+            axis.position = axis.target;
+            axis.velocity = 0;
+            return;
+        }
+    } else {
+        desired = axis.direction * max_speed;
+    }
+
+    double change = std::clamp(desired - axis.velocity, -acceleration * dt, acceleration * dt);
+    axis.velocity += change;
+    axis.position += axis.velocity * dt;
+
+    if (axis.position > AXIS_LIMIT || axis.position < -AXIS_LIMIT) {
+        axis.position = std::clamp(axis.position, -AXIS_LIMIT, AXIS_LIMIT);
+        axis.velocity = 0;
+    }
+}
+
+void TurretController::publish(double lateness_us) {
+    jitter_sum_us += lateness_us;
+    jitter_samples++;
+    jitter_window_max_us = std::max(jitter_window_max_us, lateness_us);
+    jitter_peak_us = std::max(jitter_peak_us, lateness_us);
+
+    // Roll the reported window over about once a second
+    if (jitter_samples >= rate_hz) {
+        jitter_average_us = jitter_sum_us / jitter_samples;
+        jitter_max_us = jitter_window_max_us;
+        jitter_sum_us = 0;
+        jitter_window_max_us = 0;
+        jitter_samples = 0;
+    }
+
+    TurretState &state = states.write_slot();
+    state.x = x_axis.position;
+    state.y = y_axis.position;
+    state.x_velocity = x_axis.velocity;
+    state.y_velocity = y_axis.velocity;
+    state.moving = x_axis.velocity != 0 || y_axis.velocity != 0;
+    state.rate_hz = rate_hz;
+    state.ticks = ticks;
+    state.jitter_average_us = jitter_average_us;
+    state.jitter_max_us = jitter_max_us;
+    state.jitter_peak_us = jitter_peak_us;
+    state.overruns = overruns;
+    state.commands_dropped = commands.dropped();
+    states.publish();
+}
+
+void TurretController::run() {
+    int64_t deadline = monotonic_ns();
+    int64_t previous = deadline;
+
+    while (running.load(std::memory_order_relaxed)) {
+        TurretCommand command;
+        while (commands.try_pop(command)) {
+            this->apply(command);
+        }
+
+        deadline += period_ns;
+
+        struct timespec wake = ns_timespec(deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+        }
+
+        int64_t now = monotonic_ns();
+        double lateness_us = double(now - deadline) / 1e3;
+
+        // A whole period missed, start again from now instead of catching up
+        if (now - deadline > period_ns) {
+            overruns++;
+            deadline = now;
+        }
+
+        // The actual elapsed time, so motion stays correct when late
+        double dt = double(now - previous) / 1e9;
+        previous = now;
+
+        this->step(x_axis, dt);
+        this->step(y_axis, dt);
+        ticks++;
+
+        if (output_sink) {
+            output_sink(x_axis.position, y_axis.position);
+        }
+
+        this->publish(lateness_us);
+    }
+}
@@ -4,15 +4,51 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QComboBox>
+#include <QCheckBox>
 #include <QFormLayout>
 #include <QApplication>
 #include <QKeyEvent>
 #include <QTimer>
+#include <QFileDialog>
+#include <QFontDatabase>
+#include <QDateTime>
+#include <QGridLayout>
+
+#include <algorithm>
+#include <cmath>
 #include <QDebug>
 
-Window::Window(QWidget *parent) : 
+Window::Window(const std::vector<CaptureSource> &sources, ConvertBackend backend,
+               const QString &actuatorPath, quint16 metricsPort, const QString &exportName,
+               QWidget *parent) : 
     QMainWindow(parent),
-    frameTimer(nullptr),
+    m_cameraStatsLabel(nullptr),
+    m_lastFrameSequence(0),
+    m_presentTimer(nullptr),
+    m_nextRefreshNs(0),
+    m_lastProcessedSequence(0),
+    m_showProcessed(false),
+    m_processingStatsLabel(nullptr),
+    m_latencyStatsLabel(nullptr),
+    m_modeSelect(nullptr),
+    m_recordingSource(RecordRaw),
+    m_recordingCodec(RecordH264Mp4),
+    m_preEventEnabled(false),
+    m_preEventSeconds(10),
+    m_postEventSeconds(5),
+    m_preEventBudgetMb(128),
+    m_preEventStatsLabel(nullptr),
+    m_backpressureStatsLabel(nullptr),
+    m_controlTimer(nullptr),
+    m_pendingZoom(-1),
+    m_pendingFocus(-1),
+    m_trackingEnabled(false),
+    m_trackingStatsLabel(nullptr),
+    m_turretStatsLabel(nullptr),
+    m_loggerStatsLabel(nullptr),
+    m_windowShownMs(0),
+    m_camerasReadyMs(0),
+    m_camerasPrepared(0),
     m_buttonPressCounter(0),
     m_xPosition(0),
     m_yPosition(0),
@@ -23,22 +59,132 @@ Window::Window(QWidget *parent) :
     setFocusPolicy(Qt::StrongFocus);
     resize(800, 600);
     
+    for (const CaptureSource &source : sources) {
+        m_cameras.push_back(new GstreamerCameraCapture(source, backend, this));
+    }
+    if (m_cameras.empty()) {
+        m_cameras.push_back(new GstreamerCameraCapture(CaptureSource(), backend, this));
+    }
+    camera = m_cameras.front();
+    m_cameraSequences.assign(m_cameras.size(), 0);
+    m_cameraDelivered.assign(m_cameras.size(), 0);
+    m_metricsDelivered.assign(m_cameras.size(), 0);
+
+    // The primary camera exports to exportName, the others to exportName-<index>
+    if (!exportName.isEmpty()) {
+        for (size_t i = 0; i < m_cameras.size(); i++) {
+            QString name = (i == 0) ? exportName : QString("%1-%2").arg(exportName).arg(i);
+            m_cameras[i]->shared_frames()->open(name.toStdString());
+        }
+    }
+
     setupUI();
     setupConnections();
 
-    // Start the timer for progress bar updates
+    // Devices are opened and probed off the GUI thread, the window shows meanwhile
+    for (size_t i = 0; i < m_cameras.size(); i++) {
+        connect(m_cameras[i], &GstreamerCameraCapture::prepared, this, [this, i](bool ok) {
+            cameraPrepared(i, ok);
+        }, Qt::QueuedConnection);
+        m_cameras[i]->prepare();
+    }
+    QTimer::singleShot(0, this, [this]() {
+        m_windowShownMs = MetricsServer::process_age_ms();
+        LOG_INFO("ui") << QString("Window up %1 ms after launch").arg(m_windowShownMs, 0, 'f', 0);
+    });
+
+    // Setpoints only leave the control thread through the link's mailbox
+    if (!actuatorPath.isEmpty()) {
+        m_actuator.open(actuatorPath.toStdString());
+    }
+    m_turret.set_output_sink([this](double x, double y) {
+        m_actuator.submit(x, y);
+    });
+
+    // Keyboard steps used to be m_speed units every 50 ms
+    m_turret.set_speed(m_speed * 20);
+    m_turret.start();
+
+    // Once per display refresh while capturing
+    m_presentTimer = new QTimer(this);
+    m_presentTimer->setTimerType(Qt::PreciseTimer);
+    m_presentTimer->setSingleShot(true);
+    connect(m_presentTimer, &QTimer::timeout, this, &Window::presentFrame);
+
+    // The bars only show the controller state, about 30 times a second
     QTimer *timer = new QTimer(this);
     connect(timer, &QTimer::timeout, this, &Window::updateProgressBars);
-    timer->start(50);
+    timer->start(33);
+
+    // Frames are pushed from the streaming thread and queued to the GUI thread
+    connect(camera, &GstreamerCameraCapture::frameReady, this, &Window::updateFrame,
+            Qt::QueuedConnection);
+    connect(camera->processing_engine(), &ProcessingEngine::resultReady,
+            this, &Window::updateProcessedFrame, Qt::QueuedConnection);
+    connect(camera, &GstreamerCameraCapture::modeApplied, this, [](bool ok) {
+        LOG_INFO("ui") << (ok ? "Capture mode applied" : "Capture mode change failed");
+    }, Qt::QueuedConnection);
+
+    // The other cameras only feed their own tile
+    for (size_t i = 1; i < m_cameras.size(); i++) {
+        connect(m_cameras[i], &GstreamerCameraCapture::frameReady, this, [this, i]() {
+            updateCameraFrame(i);
+        }, Qt::QueuedConnection);
+    }
 
-    camera = new GstreamerCameraCapture();
+    // The tracker runs on its own thread and steers the axes through the GUI
+    TrackingLoop *tracking = camera->tracking_loop();
+    // A region picks the target while tracking, and crops the view otherwise
+    connect(frameDisplay, &FrameWidget::regionSelected, this, [this, tracking](QRectF region) {
+        if (m_trackingEnabled) {
+            tracking->select_target(region);
+            return;
+        }
 
-    frameTimer = new QTimer(this);
-    connect(frameTimer, &QTimer::timeout, this, &Window::updateFrame);
+        CropRegion selection;
+        selection.x = region.x();
+        selection.y = region.y();
+        selection.width = region.width();
+        selection.height = region.height();
+        camera->crop_to_shown(selection);
+        LOG_INFO("ui") << "View cropped to the selected region, Escape shows the whole frame";
+    });
+    // Straight from the tracking thread into the controller's command queue
+    connect(tracking, &TrackingLoop::axesCommanded, this, [this](double x, double y) {
+        m_turret.move_to(x, y);
+    }, Qt::DirectConnection);
+    connect(tracking, &TrackingLoop::targetUpdated, frameDisplay, &FrameWidget::setOverlay,
+            Qt::QueuedConnection);
+
+    QTimer *statsTimer = new QTimer(this);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateProcessingStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateLatencyStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateRecordingStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateTrackingStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateTurretStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateLoggerStats);
+    connect(statsTimer, &QTimer::timeout, this, &Window::updateBackpressureStats);
+    statsTimer->start(1000);
+
+    if (metricsPort != 0 && m_metrics.start(metricsPort)) {
+        setupMetrics();
+        m_metricsClock.start();
+        connect(statsTimer, &QTimer::timeout, this, &Window::publishMetrics);
+    }
+
+    // The log view is filled in batches, never once per message
+    QTimer *logTimer = new QTimer(this);
+    connect(logTimer, &QTimer::timeout, this, &Window::flushLogView);
+    logTimer->start(200);
     
     setFocus();
 }
 
+Window::~Window() {
+    // The tracker feeds m_turret directly, it must be gone before the controller
+    camera->tracking_loop()->stop();
+}
+
 void Window::setupUI() {
     m_tabWidget = new QTabWidget(this);
     
@@ -78,8 +224,16 @@ void Window::setupMainTab() {
     slidersLayout->addWidget(foucsSlider);
     
     
-    rightLayout->addWidget(frameDisplayLabel);
+    // Grid as square as possible, the primary camera top left
+    QGridLayout *displayLayout = new QGridLayout();
+    int columns = int(std::ceil(std::sqrt(double(m_frameDisplays.size()))));
+    for (size_t i = 0; i < m_frameDisplays.size(); i++) {
+        displayLayout->addWidget(m_frameDisplays[i], int(i) / columns, int(i) % columns);
+    }
+
+    rightLayout->addLayout(displayLayout, 1);
     rightLayout->addWidget(m_captureButton);
+    rightLayout->addWidget(m_recordButton);
     rightLayout->addWidget(m_xProgressBar);
     rightLayout->addLayout(slidersLayout);
     
@@ -142,10 +296,22 @@ void Window::setupProgressBars() {
 }
 
 void Window::setupCameraWidget() {
-    frameDisplayLabel = new QLabel(this);
-    frameDisplayLabel->setMinimumSize(640, 480);
-    frameDisplayLabel->setScaledContents(true);
-    frameDisplayLabel->setAlignment(Qt::AlignCenter);
+    for (size_t i = 0; i < m_cameras.size(); i++) {
+        FrameWidget *display = new FrameWidget(this);
+        display->clear("Waiting for stream...");
+
+        // Tiles of a grid may shrink below the single-camera size
+        if (m_cameras.size() > 1)
+            display->setMinimumSize(320, 240);
+
+        m_frameDisplays.push_back(display);
+    }
+    frameDisplay = m_frameDisplays.front();
+
+    // Painting happens on the GUI thread, the mark is taken right after drawImage
+    connect(frameDisplay, &FrameWidget::framePainted, this, [this](quint64 sequence) {
+        camera->frame_tracer()->mark(sequence, TRACE_PAINTED);
+    });
 }
 
 void Window::setupZoomAndFocusControl(QSlider *zoomSlider, QSlider *focusSlider) {
@@ -154,8 +320,13 @@ void Window::setupZoomAndFocusControl(QSlider *zoomSlider, QSlider *focusSlider)
     zoomSlider->setValue(0);
 
     focusSlider->setOrientation(Qt::Horizontal);
-    zoomSlider->setRange(0, 100);
-    zoomSlider->setValue(0);
+    focusSlider->setRange(0, 100);
+    focusSlider->setValue(0);
+
+    m_controlTimer = new QTimer(this);
+    m_controlTimer->setSingleShot(true);
+    m_controlTimer->setInterval(40);
+    connect(m_controlTimer, &QTimer::timeout, this, &Window::applyCameraControls);
 
     connect(zoomSlider, SIGNAL(valueChanged(int)), this, SLOT(setZoom(int)));
     connect(focusSlider, SIGNAL(valueChanged(int)), this, SLOT(setCameraFocus(int)));
@@ -164,21 +335,34 @@ void Window::setupZoomAndFocusControl(QSlider *zoomSlider, QSlider *focusSlider)
 void Window::setupControlsWidget() {
     m_captureButton = new QPushButton("Start capturing", this);
     m_captureButton->setCheckable(true);
+
+    m_recordButton = new QPushButton("Start recording", this);
+    m_recordButton->setCheckable(true);
 }
 
 void Window::setupTextWidget() {
     m_logTextEdit = new QPlainTextEdit();
     m_logTextEdit->setReadOnly(true);
+    // Oldest lines are dropped, the file keeps the full history
+    m_logTextEdit->setMaximumBlockCount(2000);
 }
 
 void Window::setupSettingsBoxes(QBoxLayout *mainLayout) {
     QGroupBox *turrertSettingsBox = new QGroupBox(tr("Turret Settings"));
+    QGroupBox *cameraSettingsBox = new QGroupBox(tr("Camera Settings"));
+    QGroupBox *processingSettingsBox = new QGroupBox(tr("Processing"));
     QGroupBox *loggerSettingsBox = new QGroupBox(tr("Logger Settings"));
     QGroupBox *appSettingsBox = new QGroupBox(tr("App Settings"));
 
     setupTurretSettingsBox(turrertSettingsBox);
+    setupCameraSettingsBox(cameraSettingsBox);
+    setupProcessingSettingsBox(processingSettingsBox);
+    setupLoggerSettingsBox(loggerSettingsBox);
+    setupAppSettingsBox(appSettingsBox);
 
     mainLayout->addWidget(turrertSettingsBox);
+    mainLayout->addWidget(cameraSettingsBox);
+    mainLayout->addWidget(processingSettingsBox);
     mainLayout->addWidget(loggerSettingsBox);
     mainLayout->addWidget(appSettingsBox);
 }
@@ -197,16 +381,272 @@ void Window::setupTurretSettingsBox(QGroupBox *settingsBox) {
         setSpeed(data.toInt());
     });
 
+    QComboBox *rateSelect = new QComboBox();
+    for (int hz : {100, 250, 500, 1000}) {
+        rateSelect->addItem(QString("%1 Hz").arg(hz), QVariant(hz));
+    }
+    rateSelect->setCurrentIndex(rateSelect->findData(TurretController::DEFAULT_RATE_HZ));
+
+    connect(rateSelect, &QComboBox::currentIndexChanged, this, [this, rateSelect]() {
+        m_turret.set_rate(rateSelect->currentData().toInt());
+    });
+
+    m_turretStatsLabel = new QLabel();
+    m_turretStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+    QCheckBox *trackingCheck = new QCheckBox();
+    m_trackingStatsLabel = new QLabel("Tracking off, drag a box over the video to pick a target");
+    m_trackingStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+    connect(trackingCheck, &QCheckBox::toggled, this, &Window::setTrackingEnabled);
+
     formLayout->addRow("Turret speed:", speedSelect);
+    formLayout->addRow("Control rate:", rateSelect);
+    formLayout->addRow("Auto tracking:", trackingCheck);
 
     QVBoxLayout *turretSettingsLayout = new QVBoxLayout();
     turretSettingsLayout->addLayout(formLayout);
+    turretSettingsLayout->addWidget(m_turretStatsLabel);
+    turretSettingsLayout->addWidget(m_trackingStatsLabel);
 
     settingsBox->setLayout(turretSettingsLayout);
 }
 
+void Window::setupCameraSettingsBox(QGroupBox *settingsBox) {
+    QFormLayout *formLayout = new QFormLayout();
+    QComboBox *modeSelect = new QComboBox();
+    QComboBox *standbySelect = new QComboBox();
+    QComboBox *presentSelect = new QComboBox();
+
+    // The device's own modes are added by cameraPrepared()
+    m_modeSelect = modeSelect;
+    modeSelect->addItem("Default (640x480 RGB)", QVariant(-1));
+
+    connect(modeSelect, &QComboBox::currentIndexChanged, this, [this, modeSelect]() {
+        setCameraMode(modeSelect->currentData().toInt());
+    });
+
+    // Lowest latency shows the newest frame, smoothest paces frames by their timestamps
+    presentSelect->addItem("Lowest latency", QVariant(int(PresentLowestLatency)));
+    presentSelect->addItem("Smoothest", QVariant(int(PresentSmoothest)));
+
+    connect(presentSelect, &QComboBox::currentIndexChanged, this, [this, presentSelect]() {
+        m_presenter.set_mode(static_cast<PresentMode>(presentSelect->currentData().toInt()));
+        LOG_INFO("ui") << "Display mode: " << presentSelect->currentText();
+    });
+
+    // Hot standby starts within a frame, the others save power and the device
+    for (StandbyMode mode : { StandbyHot, StandbyReady, StandbyClosed }) {
+        standbySelect->addItem(GstreamerCameraCapture::standby_name(mode), QVariant(int(mode)));
+    }
+
+    connect(standbySelect, &QComboBox::currentIndexChanged, this, [this, standbySelect]() {
+        StandbyMode mode = static_cast<StandbyMode>(standbySelect->currentData().toInt());
+        for (GstreamerCameraCapture *capture : m_cameras) {
+            capture->set_standby_mode(mode);
+        }
+        LOG_INFO("ui") << "Stopped cameras stay in " << GstreamerCameraCapture::standby_name(mode);
+    });
+
+    QComboBox *recordSourceSelect = new QComboBox();
+    recordSourceSelect->addItem("Camera stream", QVariant(int(RecordRaw)));
+    recordSourceSelect->addItem("Analysed frames", QVariant(int(RecordProcessed)));
+
+    QComboBox *recordCodecSelect = new QComboBox();
+    recordCodecSelect->addItem("H.264 (mp4)", QVariant(int(RecordH264Mp4)));
+    recordCodecSelect->addItem("MJPEG (avi)", QVariant(int(RecordMjpegAvi)));
+
+    // Applied on the next recording
+    connect(recordSourceSelect, &QComboBox::currentIndexChanged, this, [this, recordSourceSelect]() {
+        m_recordingSource = static_cast<RecordingSource>(recordSourceSelect->currentData().toInt());
+    });
+    connect(recordCodecSelect, &QComboBox::currentIndexChanged, this, [this, recordCodecSelect]() {
+        m_recordingCodec = static_cast<RecordingCodec>(recordCodecSelect->currentData().toInt());
+    });
+
+    // Event clips, the ring is rebuilt when one of its limits changes
+    QCheckBox *preEventCheck = new QCheckBox();
+    QComboBox *preSecondsSelect = new QComboBox();
+    QComboBox *postSecondsSelect = new QComboBox();
+    QComboBox *budgetSelect = new QComboBox();
+    m_preEventStatsLabel = new QLabel("Pre-event buffer off, F9 saves a clip");
+
+    for (int seconds : { 5, 10, 30 }) {
+        preSecondsSelect->addItem(QString("%1 s").arg(seconds), QVariant(seconds));
+        postSecondsSelect->addItem(QString("%1 s").arg(seconds), QVariant(seconds));
+    }
+    for (int megabytes : { 64, 128, 256, 512 }) {
+        budgetSelect->addItem(QString("%1 MiB").arg(megabytes), QVariant(megabytes));
+    }
+    preSecondsSelect->setCurrentIndex(preSecondsSelect->findData(m_preEventSeconds));
+    postSecondsSelect->setCurrentIndex(postSecondsSelect->findData(m_postEventSeconds));
+    budgetSelect->setCurrentIndex(budgetSelect->findData(m_preEventBudgetMb));
+
+    connect(preEventCheck, &QCheckBox::toggled, this, &Window::setPreEventEnabled);
+    connect(preSecondsSelect, &QComboBox::currentIndexChanged, this, [this, preSecondsSelect]() {
+        m_preEventSeconds = preSecondsSelect->currentData().toInt();
+        if (m_preEventEnabled) {
+            setPreEventEnabled(false);
+            setPreEventEnabled(true);
+        }
+    });
+    connect(postSecondsSelect, &QComboBox::currentIndexChanged, this, [this, postSecondsSelect]() {
+        m_postEventSeconds = postSecondsSelect->currentData().toInt();
+    });
+    connect(budgetSelect, &QComboBox::currentIndexChanged, this, [this, budgetSelect]() {
+        m_preEventBudgetMb = budgetSelect->currentData().toInt();
+        if (m_preEventEnabled) {
+            setPreEventEnabled(false);
+            setPreEventEnabled(true);
+        }
+    });
+
+    // Trades frame rate, resolution and analysis rate for latency on every camera
+    QCheckBox *adaptiveCheck = new QCheckBox();
+    QComboBox *ceilingSelect = new QComboBox();
+    m_backpressureStatsLabel = new QLabel("Adaptive quality off");
+
+    for (int ms : { 50, 100, 200, 500 }) {
+        ceilingSelect->addItem(QString("%1 ms").arg(ms), QVariant(ms));
+    }
+    ceilingSelect->setCurrentIndex(ceilingSelect->findData(int(BackpressureController::DEFAULT_CEILING_MS)));
+
+    connect(adaptiveCheck, &QCheckBox::toggled, this, [this](bool checked) {
+        for (GstreamerCameraCapture *capture : m_cameras) {
+            capture->backpressure_controller()->set_enabled(checked);
+        }
+    });
+    connect(ceilingSelect, &QComboBox::currentIndexChanged, this, [this, ceilingSelect]() {
+        for (GstreamerCameraCapture *capture : m_cameras) {
+            capture->backpressure_controller()->set_latency_ceiling(ceilingSelect->currentData().toInt());
+        }
+    });
+
+    formLayout->addRow("Capture mode:", modeSelect);
+    formLayout->addRow("Display:", presentSelect);
+    formLayout->addRow("When stopped:", standbySelect);
+    formLayout->addRow("Adaptive quality:", adaptiveCheck);
+    formLayout->addRow("Latency ceiling:", ceilingSelect);
+    formLayout->addRow("Record:", recordSourceSelect);
+    formLayout->addRow("Record format:", recordCodecSelect);
+    formLayout->addRow("Pre-event buffer:", preEventCheck);
+    formLayout->addRow("Before event:", preSecondsSelect);
+    formLayout->addRow("After event:", postSecondsSelect);
+    formLayout->addRow("Memory budget:", budgetSelect);
+
+    QVBoxLayout *cameraSettingsLayout = new QVBoxLayout();
+    cameraSettingsLayout->addLayout(formLayout);
+    cameraSettingsLayout->addWidget(m_backpressureStatsLabel);
+    cameraSettingsLayout->addWidget(m_preEventStatsLabel);
+    cameraSettingsLayout->addStretch();
+
+    settingsBox->setLayout(cameraSettingsLayout);
+}
+
+void Window::setupProcessingSettingsBox(QGroupBox *settingsBox) {
+    QFormLayout *formLayout = new QFormLayout();
+    QCheckBox *enableCheck = new QCheckBox();
+    QComboBox *policySelect = new QComboBox();
+    QComboBox *queueSelect = new QComboBox();
+    m_processingStatsLabel = new QLabel("Processing stopped");
+
+    policySelect->addItem("Drop oldest", QVariant(int(DropOldest)));
+    policySelect->addItem("Drop newest", QVariant(int(DropNewest)));
+
+    for (int i = 1; i <= int(ProcessingEngine::MAX_QUEUE_CAPACITY); i++) {
+        queueSelect->addItem(QString("%1").arg(i), QVariant(i));
+    }
+
+    connect(enableCheck, &QCheckBox::toggled, this, &Window::setProcessingEnabled);
+    connect(policySelect, &QComboBox::currentIndexChanged, this, [this, policySelect]() {
+        camera->processing_engine()->set_drop_policy(
+            static_cast<DropPolicy>(policySelect->currentData().toInt()));
+    });
+    connect(queueSelect, &QComboBox::currentIndexChanged, this, [this, queueSelect]() {
+        camera->processing_engine()->set_queue_capacity(queueSelect->currentData().toInt());
+    });
+
+    formLayout->addRow("Show analysis:", enableCheck);
+    formLayout->addRow("When behind:", policySelect);
+    formLayout->addRow("Queue depth:", queueSelect);
+
+    QVBoxLayout *processingSettingsLayout = new QVBoxLayout();
+    processingSettingsLayout->addLayout(formLayout);
+    processingSettingsLayout->addWidget(m_processingStatsLabel);
+    processingSettingsLayout->addStretch();
+
+    settingsBox->setLayout(processingSettingsLayout);
+}
+
+void Window::setupLoggerSettingsBox(QGroupBox *settingsBox) {
+    QFormLayout *formLayout = new QFormLayout();
+    QComboBox *levelSelect = new QComboBox();
+    QComboBox *rateSelect = new QComboBox();
+    QComboBox *viewSelect = new QComboBox();
+    m_loggerStatsLabel = new QLabel();
+    m_loggerStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+    for (LogLevel level : { LogDebug, LogInfo, LogWarning, LogError }) {
+        levelSelect->addItem(Logger::level_name(level), QVariant(int(level)));
+    }
+    levelSelect->setCurrentIndex(levelSelect->findData(int(Logger::instance().level())));
+
+    rateSelect->addItem("Unlimited", QVariant(0));
+    for (int rate : { 10, 50, 200 }) {
+        rateSelect->addItem(QString("%1 / s").arg(rate), QVariant(rate));
+    }
+
+    for (int lines : { 500, 2000, 10000 }) {
+        viewSelect->addItem(QString("%1").arg(lines), QVariant(lines));
+    }
+    viewSelect->setCurrentIndex(viewSelect->findData(m_logTextEdit->maximumBlockCount()));
+
+    connect(levelSelect, &QComboBox::currentIndexChanged, this, [levelSelect]() {
+        Logger::instance().set_level(static_cast<LogLevel>(levelSelect->currentData().toInt()));
+    });
+    connect(rateSelect, &QComboBox::currentIndexChanged, this, [rateSelect]() {
+        Logger::instance().set_rate_limit(rateSelect->currentData().toInt());
+    });
+    connect(viewSelect, &QComboBox::currentIndexChanged, this, [this, viewSelect]() {
+        m_logTextEdit->setMaximumBlockCount(viewSelect->currentData().toInt());
+    });
+
+    formLayout->addRow("Level:", levelSelect);
+    formLayout->addRow("Debug/info rate:", rateSelect);
+    formLayout->addRow("View lines:", viewSelect);
+
+    QVBoxLayout *loggerSettingsLayout = new QVBoxLayout();
+    loggerSettingsLayout->addLayout(formLayout);
+    loggerSettingsLayout->addWidget(m_loggerStatsLabel);
+    loggerSettingsLayout->addStretch();
+
+    settingsBox->setLayout(loggerSettingsLayout);
+}
+
+void Window::setupAppSettingsBox(QGroupBox *settingsBox) {
+    QPushButton *dumpButton = new QPushButton("Dump trace...");
+    m_latencyStatsLabel = new QLabel("No frames traced");
+    m_latencyStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+    connect(dumpButton, &QPushButton::clicked, this, &Window::dumpLatencyTrace);
+
+    m_cameraStatsLabel = new QLabel();
+    m_cameraStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+    QVBoxLayout *appSettingsLayout = new QVBoxLayout();
+    appSettingsLayout->addWidget(new QLabel("Cameras:"));
+    appSettingsLayout->addWidget(m_cameraStatsLabel);
+    appSettingsLayout->addWidget(new QLabel("Latency, ms (p50 / p95 / p99):"));
+    appSettingsLayout->addWidget(m_latencyStatsLabel);
+    appSettingsLayout->addWidget(dumpButton);
+    appSettingsLayout->addStretch();
+
+    settingsBox->setLayout(appSettingsLayout);
+}
+
 void Window::setupConnections() {
     connect(m_captureButton, &QPushButton::clicked, this, &Window::slotButtonClicked);
+    connect(m_recordButton, &QPushButton::clicked, this, &Window::setRecording);
 }
 
 void Window::keyPressEvent(QKeyEvent *event) {
@@ -224,9 +664,21 @@ void Window::keyPressEvent(QKeyEvent *event) {
     case Qt::Key_Down:
         m_keyStates.down = true;
         break;
+    case Qt::Key_F9:
+        if (!event->isAutoRepeat())
+            exportEventClip();
+        return;
+    case Qt::Key_Escape:
+        camera->set_crop_region(CropRegion());
+        return;
     default:
         QMainWindow::keyPressEvent(event);
+        return;
     }
+
+    // Held keys keep the axis moving, repeats carry no new input
+    if (!event->isAutoRepeat())
+        sendJog();
 }
 
 void Window::keyReleaseEvent(QKeyEvent *event) {
@@ -245,102 +697,733 @@ void Window::keyReleaseEvent(QKeyEvent *event) {
         break;
     default:
         QMainWindow::keyReleaseEvent(event);
+        return;
     }
+
+    if (!event->isAutoRepeat())
+        sendJog();
+}
+
+void Window::sendJog() {
+    // The tracker owns the axes while it runs
+    if (m_trackingEnabled)
+        return;
+
+    // Opposite keys cancel out
+    int x = int(m_keyStates.right) - int(m_keyStates.left);
+    int y = int(m_keyStates.up) - int(m_keyStates.down);
+    m_turret.jog(x, y);
 }
 
 void Window::updateProgressBars() {
-    bool valueChanged = false;
-    int x_max = m_xProgressBar->maximum();
-    int x_min = m_xProgressBar->minimum();
-    int y_max = m_yProgressBar->maximum();
-    int y_min = m_yProgressBar->minimum();
-
-    // Handle X-axis movement
-    if (m_keyStates.left && !m_keyStates.right && m_xProgressBar->value() > x_min) {
-        m_xPosition = m_xProgressBar->value() - m_speed < x_min ? x_min : m_xProgressBar->value() - m_speed;
-        m_xProgressBar->setValue(m_xPosition);
-        valueChanged = true;
-    } else if (m_keyStates.right && !m_keyStates.left && m_xProgressBar->value() < x_max) {
-        m_xPosition = m_xProgressBar->value() + m_speed > x_max ? x_max : m_xProgressBar->value() + m_speed;
-        m_xProgressBar->setValue(m_xPosition);
-        valueChanged = true;
+    const TurretState &state = m_turret.state();
+    int x = qRound(state.x);
+    int y = qRound(state.y);
+
+    if (x == m_xPosition && y == m_yPosition)
+        return;
+
+    m_xPosition = x;
+    m_yPosition = y;
+    m_xProgressBar->setValue(m_xPosition);
+    m_yProgressBar->setValue(m_yPosition);
+
+    // Tracking moves the axes continuously, only manual moves are logged
+    if (!m_trackingEnabled) {
+        LOG_DEBUG("ui") << QString("Position: x = %1, y = %2").arg(m_xPosition).arg(m_yPosition);
     }
+}
+
+void Window::updateFrame() {
+    // Frames the GUI fell behind on are coalesced, the rest wait for their refresh
+    quint64 sequence = 0;
+    int64_t captureNs = 0;
+    QImage frame = camera->pull_image_from_frame(&sequence, &captureNs);
     
-    // Handle Y-axis movement - only process if one direction is pressed, not both
-    if (m_keyStates.down && !m_keyStates.up && m_yProgressBar->value() > y_min) {
-        m_yPosition = m_yProgressBar->value() - m_speed < y_min ? y_min : m_yProgressBar->value() - m_speed;
-        m_yProgressBar->setValue(m_yPosition);
-        valueChanged = true;
-    } else if (m_keyStates.up && !m_keyStates.down && m_yProgressBar->value() < y_max) {
-        m_yPosition = m_yProgressBar->value() + m_speed > y_max ? y_max : m_yProgressBar->value() + m_speed;
-        m_yProgressBar->setValue(m_yPosition);
-        valueChanged = true;
+    if (!m_captureButton->isChecked() || frame.isNull() || sequence == m_lastFrameSequence)
+        return;
+
+    m_lastFrameSequence = sequence;
+
+    // The analysed view is fed by updateProcessedFrame
+    if (!m_showProcessed) {
+        m_presenter.push(frame, sequence, captureNs, FrameTracer::now_ns());
     }
-    
-    // Log position changes
-    if (valueChanged) {
-        QMutexLocker locker(&m_logMutex);
-        m_logTextEdit->appendPlainText(
-            QString("Position: x = %1, y = %2").arg(m_xPosition).arg(m_yPosition)
-        );
+}
+
+void Window::presentFrame() {
+    // Deadlines advance by the exact period, so whole-millisecond timers never
+    // drift against the refresh, a late tick starts over from now
+    int64_t now = FrameTracer::now_ns();
+    int64_t period = m_presenter.refresh_period_ns();
+    m_nextRefreshNs += period;
+    if (m_nextRefreshNs <= now)
+        m_nextRefreshNs = now + period;
+    m_presentTimer->start(int((m_nextRefreshNs - now + 500000) / 1000000));
+
+    PresentedFrame frame;
+    if (m_showProcessed || !m_presenter.present(now, frame))
+        return;
+
+    camera->frame_tracer()->mark(frame.sequence, TRACE_HANDED);
+    frameDisplay->setFrame(frame.image, frame.sequence);
+}
+
+void Window::updateCameraFrame(size_t index) {
+    quint64 sequence = 0;
+    QImage frame = m_cameras[index]->pull_image_from_frame(&sequence);
+
+    if (!m_captureButton->isChecked() || frame.isNull() || sequence == m_cameraSequences[index])
+        return;
+
+    m_cameraSequences[index] = sequence;
+    m_frameDisplays[index]->setFrame(frame, sequence);
+}
+
+void Window::updateProcessedFrame() {
+    ProcessedFrame result = camera->processing_engine()->pull_result();
+
+    if (!m_showProcessed || !m_captureButton->isChecked() ||
+        result.image.isNull() || result.sequence == m_lastProcessedSequence)
+        return;
+
+    m_lastProcessedSequence = result.sequence;
+    camera->frame_tracer()->mark(result.sequence, TRACE_HANDED);
+    frameDisplay->setFrame(result.image, result.sequence);
+}
+
+void Window::updateProcessingStats() {
+    if (!m_processingStatsLabel || !camera->processing_engine()->is_running())
+        return;
+
+    QStringList lines;
+    for (const StageStats &stage : camera->processing_engine()->stage_stats()) {
+        lines << QString("%1: %2 ms avg, %3 ms max, %4 frames, %5 dropped")
+                     .arg(QString::fromStdString(stage.name))
+                     .arg(stage.average_ms, 0, 'f', 2)
+                     .arg(stage.max_ms, 0, 'f', 2)
+                     .arg(stage.processed)
+                     .arg(stage.dropped);
     }
+
+    m_processingStatsLabel->setText(lines.join("\n"));
 }
 
-void Window::updateFrame() {
-    frame = camera->pull_pixmap_from_frame();
-    
-    if (!frame.isNull()) {
-        frameDisplayLabel->setPixmap(frame);
+void Window::updateLatencyStats() {
+    if (!m_latencyStatsLabel || !m_captureButton->isChecked())
+        return;
+
+    // Delivered frames per camera over the last timer period, with its pipeline health
+    QStringList cameras;
+    for (size_t i = 0; i < m_cameras.size(); i++) {
+        quint64 delivered = m_cameras[i]->counters().delivered;
+        HealthStats health = m_cameras[i]->health_stats();
+
+        QString line = QString("%1: %2 fps, %3, %4 dropped, %5 QoS dropped, %6 gaps (%7 missing), %8 stalls, %9 restarts")
+                           .arg(i)
+                           .arg(delivered - m_cameraDelivered[i])
+                           .arg(QString::fromStdString(health.state))
+                           .arg(health.appsink_dropped)
+                           .arg(health.qos_dropped)
+                           .arg(health.pts_gaps)
+                           .arg(health.frames_missing)
+                           .arg(health.stalls)
+                           .arg(health.restarts);
+        if (health.stalled)
+            line += ", stalled";
+        if (health.restart_in_ms > 0)
+            line += QString(", restart in %1 ms").arg(health.restart_in_ms);
+        double firstFrameMs = m_cameras[i]->startup_stats().first_frame_ms;
+        if (firstFrameMs > 0)
+            line += QString(", first frame in %1 ms").arg(firstFrameMs, 0, 'f', 1);
+        cameras << line;
+
+        m_cameraDelivered[i] = delivered;
+    }
+    m_cameraStatsLabel->setText(cameras.join("\n"));
+
+    QStringList lines;
+    for (const LatencyStats &step : camera->frame_tracer()->summarize()) {
+        if (step.samples == 0)
+            continue;
+
+        lines << QString("%1 %2 / %3 / %4")
+                     .arg(QString::fromStdString(step.name), -24)
+                     .arg(step.p50_ms, 6, 'f', 2)
+                     .arg(step.p95_ms, 6, 'f', 2)
+                     .arg(step.p99_ms, 6, 'f', 2);
     }
+
+    // Chosen per refresh, so shown + dropped is every frame that reached the GUI
+    PresentStats present = m_presenter.stats();
+    lines << QString("display %1 Hz: %2 shown, %3 dropped, %4 late, %5 / %6 ms, judder %7 ms")
+                 .arg(present.refresh_hz, 0, 'f', 0)
+                 .arg(present.shown)
+                 .arg(present.dropped)
+                 .arg(present.late)
+                 .arg(present.latency_p50_ms, 0, 'f', 1)
+                 .arg(present.latency_p95_ms, 0, 'f', 1)
+                 .arg(present.judder_ms, 0, 'f', 1);
+    if (present.mode == PresentSmoothest)
+        lines.last() += QString(", held %1 ms").arg(present.playout_delay_ms, 0, 'f', 1);
+
+    m_latencyStatsLabel->setText(lines.join("\n"));
+}
+
+void Window::dumpLatencyTrace() {
+    QString path = QFileDialog::getSaveFileName(this, "Dump latency trace",
+                                                "latency-trace.csv", "CSV files (*.csv)");
+    if (path.isEmpty())
+        return;
+
+    bool written = camera->frame_tracer()->dump(path.toStdString());
+
+    LOG_INFO("ui") << QString("Latency trace %1: %2").arg(written ? "written" : "failed").arg(path);
 }
 
 void Window::slotButtonClicked(bool checked) {
     if (checked) {
         m_captureButton->setText("Stop capturing");
 
-        camera->run();
-        frameTimer->start(33);
+        // No vsync reaches a QWidget, refreshes are timed from the screen's rate
+        m_presenter.reset();
+        m_presenter.set_refresh_rate(screen()->refreshRate());
+        m_nextRefreshNs = FrameTracer::now_ns();
+        m_presentTimer->start(0);
 
-        QMutexLocker locker(&m_logMutex);
-        m_logTextEdit->appendPlainText("Started capturing...");
+        for (GstreamerCameraCapture *capture : m_cameras)
+            capture->run();
+
+        LOG_INFO("ui") << "Started capturing...";
     } else {
         m_captureButton->setText("Start capturing");
 
-        frameTimer->stop();
-        camera->stop();
+        for (GstreamerCameraCapture *capture : m_cameras)
+            capture->stop();
+
+        m_presentTimer->stop();
+        m_presenter.reset();
 
-        frameDisplayLabel->clear();
-        frameDisplayLabel->setStyleSheet("background-color: black;");
-        frameDisplayLabel->setText("Waiting for stream...");
+        for (FrameWidget *display : m_frameDisplays)
+            display->clear("Waiting for stream...");
 
-        QMutexLocker locker(&m_logMutex);
-        m_logTextEdit->appendPlainText("Stoped capturing.");
+        LOG_INFO("ui") << "Stoped capturing.";
     }
 }
 
-void Window::setSpeed(int val) {
-    this->m_speed = val;
+void Window::setRecording(bool checked) {
+    if (checked) {
+        QString extension = (m_recordingCodec == RecordH264Mp4) ? "mp4" : "avi";
+        QString path = QString("recording-%1.%2")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
+            .arg(extension);
+
+        if (!camera->start_recording(path.toStdString(), m_recordingSource, m_recordingCodec)) {
+            m_recordButton->setChecked(false);
+            return;
+        }
+
+        m_recordButton->setText("Stop recording");
+
+        LOG_INFO("ui") << QString("Recording to %1").arg(path);
+    } else {
+        camera->stop_recording();
+        m_recordButton->setText("Start recording");
+
+        RecordingStats stats = camera->recording_stats();
+
+        LOG_INFO("ui") << QString("Recording stopped: %1 frames, %2 dropped")
+            .arg(stats.written)
+            .arg(stats.dropped);
+    }
+}
+
+void Window::updateRecordingStats() {
+    if (m_preEventEnabled) {
+        PreEventStats stats = camera->pre_event_buffer()->stats();
+        m_preEventStatsLabel->setText(
+            QString("%1 s buffered, %2 frames, %3 MiB%4")
+                .arg(stats.seconds, 0, 'f', 1)
+                .arg(stats.frames)
+                .arg(double(stats.bytes) / (1 << 20), 0, 'f', 1)
+                .arg(stats.exporting ? ", saving clip" : "")
+        );
+    }
+
+    if (!m_recordButton->isChecked())
+        return;
+
+    RecordingStats stats = camera->recording_stats();
+
+    // The recorder stops on its own when its pipeline fails
+    if (!stats.active) {
+        m_recordButton->setChecked(false);
+        setRecording(false);
+        return;
+    }
+
+    m_recordButton->setText(QString("Stop recording (%1 frames, %2 dropped)")
+                                .arg(stats.written)
+                                .arg(stats.dropped));
+}
+
+void Window::setPreEventEnabled(bool enabled) {
+    m_preEventEnabled = enabled;
+
+    if (enabled) {
+        size_t budget = size_t(m_preEventBudgetMb) << 20;
+        camera->pre_event_buffer()->start(m_recordingCodec, m_preEventSeconds, budget);
+    } else {
+        camera->pre_event_buffer()->stop();
+        m_preEventStatsLabel->setText("Pre-event buffer off, F9 saves a clip");
+    }
+}
+
+void Window::exportEventClip() {
+    if (!m_preEventEnabled)
+        return;
+
+    // The ring keeps the codec it was started with
+    RecordingCodec codec = camera->pre_event_buffer()->clip_codec();
+    QString extension = (codec == RecordH264Mp4) ? "mp4" : "avi";
+    QString path = QString("event-%1.%2")
+        .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
+        .arg(extension);
+
+    bool started = camera->pre_event_buffer()->export_clip(path.toStdString(), m_postEventSeconds);
+
+    LOG_INFO("ui") << (started ? QString("Saving event clip to %1").arg(path)
+                               : QString("Event clip not saved"));
+}
+
+void Window::setTrackingEnabled(bool enabled) {
+    m_trackingEnabled = enabled;
+    TrackingLoop *tracking = camera->tracking_loop();
+
+    if (enabled) {
+        const TurretState &state = m_turret.state();
+        m_turret.halt();
+        tracking->clear_target();
+        tracking->start(state.x, state.y);
+    } else {
+        // Stopped first, so no tracking command can follow the halt
+        tracking->stop();
+        m_turret.halt();
+        frameDisplay->clearOverlay();
+        m_trackingStatsLabel->setText("Tracking off, drag a box over the video to pick a target");
+    }
+
+    LOG_INFO("ui") << (enabled ? "Tracking enabled" : "Tracking disabled");
+}
+
+void Window::updateBackpressureStats() {
+    BackpressureStats stats = camera->backpressure_controller()->stats();
+    if (!stats.enabled) {
+        m_backpressureStatsLabel->setText("Adaptive quality off");
+        return;
+    }
 
-    QMutexLocker locker(&m_logMutex);
-    m_logTextEdit->appendPlainText(
-        QString("Turret speed set to: %1").arg(val)
+    m_backpressureStatsLabel->setText(
+        QString("%1, %2 steps down, %3 up\n"
+                "p95 %4 ms of %5 ms, %6% dropped, %7 dropped by analysis")
+            .arg(BackpressureController::level_name(stats.level))
+            .arg(stats.degrades)
+            .arg(stats.restores)
+            .arg(stats.last.latency_p95_ms, 0, 'f', 1)
+            .arg(stats.latency_ceiling_ms, 0, 'f', 0)
+            .arg(stats.last.drop_ratio * 100, 0, 'f', 1)
+            .arg(stats.last.stage_dropped)
     );
 }
 
-void Window::setZoom(int val) {
-    // m_camera->zoomTo(val, 1);
+void Window::updateTrackingStats() {
+    if (!m_trackingEnabled)
+        return;
 
-    QMutexLocker locker(&m_logMutex);
-    m_logTextEdit->appendPlainText(
-        QString("Camera zoom set to: %1").arg(val)
+    TrackingStats stats = camera->tracking_loop()->stats();
+    m_trackingStatsLabel->setText(
+        QString("%1, score %2\n"
+                "latency %3 / %4 / %5 ms (last / avg / max)\n"
+                "frame period %6 ms, %7 of %8 late, %9 replaced")
+            .arg(stats.locked ? "Locked" : "No target")
+            .arg(stats.score, 0, 'f', 2)
+            .arg(stats.last_ms, 0, 'f', 1)
+            .arg(stats.average_ms, 0, 'f', 1)
+            .arg(stats.max_ms, 0, 'f', 1)
+            .arg(stats.frame_period_ms, 0, 'f', 1)
+            .arg(stats.late)
+            .arg(stats.frames)
+            .arg(stats.replaced)
     );
 }
 
-void Window::setCameraFocus(int val) {
-    // m_camera->setFocusDistance(val);
+void Window::updateTurretStats() {
+    const TurretState &state = m_turret.state();
+    m_turretStatsLabel->setText(
+        QString("%1 Hz loop, %2 ticks\n"
+                "jitter %3 / %4 us (avg / max), peak %5 us\n"
+                "%6 overruns, %7 commands dropped")
+            .arg(state.rate_hz)
+            .arg(state.ticks)
+            .arg(state.jitter_average_us, 0, 'f', 1)
+            .arg(state.jitter_max_us, 0, 'f', 1)
+            .arg(state.jitter_peak_us, 0, 'f', 1)
+            .arg(state.overruns)
+            .arg(state.commands_dropped)
+    );
+
+    if (!m_actuator.is_open())
+        return;
 
-    QMutexLocker locker(&m_logMutex);
-    m_logTextEdit->appendPlainText(
-        QString("Camera focus set to: %1").arg(val)
+    ActuatorStats link = m_actuator.stats();
+    m_turretStatsLabel->setText(m_turretStatsLabel->text() + QString(
+        "\nActuator %1\n"
+        "%2 sent, %3 acked, %4 coalesced, %5 timed out\n"
+        "rtt %6 / %7 / %8 ms (last / avg / max)")
+            .arg(QString::fromStdString(link.path))
+            .arg(link.sent)
+            .arg(link.acked)
+            .arg(link.coalesced)
+            .arg(link.timeouts)
+            .arg(link.rtt_last_ms, 0, 'f', 2)
+            .arg(link.rtt_average_ms, 0, 'f', 2)
+            .arg(link.rtt_max_ms, 0, 'f', 2)
     );
 }
+
+void Window::flushLogView() {
+    std::vector<std::string> lines = Logger::instance().take_view_lines();
+    if (lines.empty())
+        return;
+
+    QStringList text;
+    for (const std::string &line : lines)
+        text << QString::fromStdString(line);
+
+    // One block append per batch, the view trims itself to its line limit
+    m_logTextEdit->appendPlainText(text.join('\n'));
+}
+
+void Window::updateLoggerStats() {
+    LoggerStats stats = Logger::instance().stats();
+    m_loggerStatsLabel->setText(
+        QString("%1\n%2 written, %3 rate limited, %4 lost, %5 rotations")
+            .arg(stats.path.empty() ? QString("No log file") : QString::fromStdString(stats.path))
+            .arg(stats.written)
+            .arg(stats.suppressed)
+            .arg(stats.dropped)
+            .arg(stats.rotations)
+    );
+}
+
+void Window::setupMetrics() {
+    for (size_t i = 0; i < m_cameras.size(); i++) {
+        std::string labels = QString("camera=\"%1\"").arg(i).toStdString();
+        CameraMetrics metrics = {};
+
+        metrics.fps = m_metrics.metric("capture_fps", MetricGauge,
+                                       "Frames delivered per second", labels);
+        metrics.received = m_metrics.metric("capture_frames_received_total", MetricCounter,
+                                            "Buffers that reached the appsink", labels);
+        metrics.delivered = m_metrics.metric("capture_frames_delivered_total", MetricCounter,
+                                             "Frames pulled from the appsink", labels);
+        metrics.refused = m_metrics.metric("capture_frames_refused_total", MetricCounter,
+                                           "Frames pulled but not converted", labels);
+        metrics.appsinkDropped = m_metrics.metric("capture_appsink_dropped_total", MetricCounter,
+                                                  "Frames replaced in the appsink before they were pulled", labels);
+        metrics.qosDropped = m_metrics.metric("capture_qos_dropped_total", MetricCounter,
+                                              "Frames dropped by pipeline elements for QoS", labels);
+        metrics.ptsGaps = m_metrics.metric("capture_pts_gaps_total", MetricCounter,
+                                           "Gaps in the buffer timestamps", labels);
+        metrics.framesMissing = m_metrics.metric("capture_frames_missing_total", MetricCounter,
+                                                 "Frames missing from the timestamp gaps", labels);
+        metrics.stalls = m_metrics.metric("capture_stalls_total", MetricCounter,
+                                          "Times the pipeline stopped producing buffers", labels);
+        metrics.stalled = m_metrics.metric("capture_stalled", MetricGauge,
+                                           "1 while the pipeline produces no buffers", labels);
+        metrics.errors = m_metrics.metric("capture_errors_total", MetricCounter,
+                                          "Errors posted on the pipeline bus", labels);
+        metrics.restarts = m_metrics.metric("capture_restarts_total", MetricCounter,
+                                            "Automatic pipeline restarts", labels);
+        metrics.poolExhausted = m_metrics.metric("capture_pool_exhausted_total", MetricCounter,
+                                                 "Times the frame pool ran out of buffers", labels);
+        metrics.prepareMs = m_metrics.metric("capture_prepare_ms", MetricGauge,
+                                             "Time to open the device and reach the standby state", labels);
+        metrics.firstFrameMs = m_metrics.metric("capture_time_to_first_frame_ms", MetricGauge,
+                                                "Time from the last start to the first frame delivered", labels);
+        metrics.standbyMode = m_metrics.metric("capture_standby_mode", MetricGauge,
+                                               "State kept while stopped: 0 hot standby, 1 device open, 2 device closed",
+                                               labels);
+        metrics.degradeLevel = m_metrics.metric("capture_degrade_level", MetricGauge,
+                                                "Quality steps taken down by backpressure, 0 for full quality", labels);
+        m_cameraMetrics.push_back(metrics);
+    }
+
+    m_appMetrics = {};
+    m_appMetrics.recordingDropped = m_metrics.metric("recording_dropped_total", MetricCounter,
+        "Frames the recorder dropped because the encoder fell behind");
+    m_appMetrics.trackingLocked = m_metrics.metric("tracking_locked", MetricGauge,
+        "1 while the tracker holds a target");
+    m_appMetrics.trackingLatency = m_metrics.metric("tracking_latency_ms", MetricGauge,
+        "Average time from capture to axis command");
+    m_appMetrics.turretTicks = m_metrics.metric("turret_loop_ticks_total", MetricCounter,
+        "Control loop iterations");
+    m_appMetrics.turretJitterAverage = m_metrics.metric("turret_loop_jitter_us", MetricGauge,
+        "Control loop wake-up lateness over the last second", "window=\"average\"");
+    m_appMetrics.turretJitterMax = m_metrics.metric("turret_loop_jitter_us", MetricGauge,
+        "Control loop wake-up lateness over the last second", "window=\"max\"");
+    m_appMetrics.turretOverruns = m_metrics.metric("turret_loop_overruns_total", MetricCounter,
+        "Control loop periods missed entirely");
+    m_appMetrics.turretCommandsDropped = m_metrics.metric("turret_commands_dropped_total", MetricCounter,
+        "Commands lost because the control queue was full");
+    if (m_actuator.is_open()) {
+        m_appMetrics.actuatorTimeouts = m_metrics.metric("actuator_timeouts_total", MetricCounter,
+            "Setpoint frames never acknowledged");
+        m_appMetrics.actuatorRtt = m_metrics.metric("actuator_rtt_ms", MetricGauge,
+            "Average setpoint round trip to the device");
+    }
+    m_appMetrics.displayShown = m_metrics.metric("display_frames_total", MetricCounter,
+        "Frames of the primary camera by what the display did with them", "result=\"shown\"");
+    m_appMetrics.displayDropped = m_metrics.metric("display_frames_total", MetricCounter,
+        "Frames of the primary camera by what the display did with them", "result=\"dropped\"");
+    // Late frames were shown too, they are not a third outcome
+    m_appMetrics.displayLate = m_metrics.metric("display_late_frames_total", MetricCounter,
+        "Frames shown more than a refresh after they were due");
+    m_appMetrics.displayLatencyP50 = m_metrics.metric("display_latency_p50_ms", MetricGauge,
+        "Median time from capture to the refresh that showed the frame");
+    m_appMetrics.displayLatencyP95 = m_metrics.metric("display_latency_p95_ms", MetricGauge,
+        "95th percentile of the time from capture to the refresh that showed the frame");
+    m_appMetrics.displayJudder = m_metrics.metric("display_judder_ms", MetricGauge,
+        "Difference between display and capture intervals of consecutive frames");
+    m_appMetrics.displayPlayout = m_metrics.metric("display_playout_delay_ms", MetricGauge,
+        "Delay after capture frames are held to in the smoothest mode");
+    m_appMetrics.startupWindow = m_metrics.metric("app_startup_ms", MetricGauge,
+        "Time from process start to each startup step", "step=\"window\"");
+    m_appMetrics.startupCameras = m_metrics.metric("app_startup_ms", MetricGauge,
+        "Time from process start to each startup step", "step=\"cameras\"");
+    m_appMetrics.logSuppressed = m_metrics.metric("log_suppressed_total", MetricCounter,
+        "Log messages refused by the rate limit");
+    m_appMetrics.logDropped = m_metrics.metric("log_dropped_total", MetricCounter,
+        "Log messages lost because the queue was full");
+    m_appMetrics.residentMemory = m_metrics.metric("process_resident_memory_bytes", MetricGauge,
+        "Resident memory size in bytes");
+}
+
+void Window::publishMetrics() {
+    double seconds = std::max(1e-3, m_metricsClock.restart() / 1000.0);
+
+    for (size_t i = 0; i < m_cameras.size(); i++) {
+        CameraMetrics &metrics = m_cameraMetrics[i];
+        std::string labels = QString("camera=\"%1\"").arg(i).toStdString();
+        CaptureCounters counters = m_cameras[i]->counters();
+        HealthStats health = m_cameras[i]->health_stats();
+        FramePoolStats pool = m_cameras[i]->pool_stats();
+        StartupStats startup = m_cameras[i]->startup_stats();
+
+        metrics.fps->set((counters.delivered - m_metricsDelivered[i]) / seconds);
+        m_metricsDelivered[i] = counters.delivered;
+
+        metrics.received->set(counters.received);
+        metrics.delivered->set(counters.delivered);
+        metrics.refused->set(counters.refused);
+        metrics.appsinkDropped->set(health.appsink_dropped);
+        metrics.qosDropped->set(health.qos_dropped);
+        metrics.ptsGaps->set(health.pts_gaps);
+        metrics.framesMissing->set(health.frames_missing);
+        metrics.stalls->set(health.stalls);
+        metrics.stalled->set(health.stalled ? 1 : 0);
+        metrics.errors->set(health.errors);
+        metrics.restarts->set(health.restarts);
+        metrics.poolExhausted->set(pool.exhausted);
+        metrics.prepareMs->set(startup.prepare_ms);
+        metrics.firstFrameMs->set(startup.first_frame_ms);
+        metrics.standbyMode->set(int(startup.standby));
+        metrics.degradeLevel->set(m_cameras[i]->backpressure_controller()->stats().level);
+
+        // Controls open once the camera is prepared
+        CameraControlStats controls = m_cameras[i]->control_stats();
+        if (controls.open) {
+            if (!metrics.controlsApplied) {
+                metrics.controlsApplied = m_metrics.metric("camera_controls_applied_total", MetricCounter,
+                                                           "Zoom and focus values set on the device", labels);
+                metrics.controlsCoalesced = m_metrics.metric("camera_controls_coalesced_total", MetricCounter,
+                                                             "Zoom and focus values replaced before the device took them",
+                                                             labels);
+            }
+            metrics.controlsApplied->set(controls.applied);
+            metrics.controlsCoalesced->set(controls.coalesced);
+        }
+
+        FrameExportStats shared = m_cameras[i]->shared_frames()->stats();
+        if (shared.open) {
+            if (!metrics.exportFrames) {
+                metrics.exportFrames = m_metrics.metric("export_frames_total", MetricCounter,
+                                                        "Frames published to the shared-memory ring", labels);
+                metrics.exportSkipped = m_metrics.metric("export_skipped_total", MetricCounter,
+                                                         "Frames too large or in a format the ring cannot carry", labels);
+            }
+            metrics.exportFrames->set(shared.published);
+            metrics.exportSkipped->set(shared.skipped);
+        }
+    }
+
+    // Rolling percentiles of the primary camera's frame path
+    for (const LatencyStats &step : camera->frame_tracer()->summarize()) {
+        if (step.samples == 0)
+            continue;
+
+        std::array<Metric*, 3> &metrics = m_latencyMetrics[step.name];
+        if (!metrics[0]) {
+            std::string stage = "stage=\"" + step.name + "\"";
+            metrics[0] = m_metrics.metric("frame_latency_p50_ms", MetricGauge,
+                                          "Median frame latency between trace points over the recent frames", stage);
+            metrics[1] = m_metrics.metric("frame_latency_p95_ms", MetricGauge,
+                                          "95th percentile of the frame latency between trace points", stage);
+            metrics[2] = m_metrics.metric("frame_latency_p99_ms", MetricGauge,
+                                          "99th percentile of the frame latency between trace points", stage);
+        }
+        metrics[0]->set(step.p50_ms);
+        metrics[1]->set(step.p95_ms);
+        metrics[2]->set(step.p99_ms);
+    }
+
+    for (const StageStats &stage : camera->processing_engine()->stage_stats()) {
+        std::array<Metric*, 3> &metrics = m_stageMetrics[stage.name];
+        if (!metrics[0]) {
+            std::string labels = "stage=\"" + stage.name + "\"";
+            metrics[0] = m_metrics.metric("processing_frames_total", MetricCounter,
+                                          "Frames through each processing stage", labels);
+            metrics[1] = m_metrics.metric("processing_dropped_total", MetricCounter,
+                                          "Frames dropped by each processing stage's queue", labels);
+            metrics[2] = m_metrics.metric("processing_average_ms", MetricGauge,
+                                          "Average time per frame in each processing stage", labels);
+        }
+        metrics[0]->set(stage.processed);
+        metrics[1]->set(stage.dropped);
+        metrics[2]->set(stage.average_ms);
+    }
+
+    m_appMetrics.recordingDropped->set(camera->recording_stats().dropped);
+
+    TrackingStats tracking = camera->tracking_loop()->stats();
+    m_appMetrics.trackingLocked->set(tracking.locked ? 1 : 0);
+    m_appMetrics.trackingLatency->set(tracking.average_ms);
+
+    const TurretState &turret = m_turret.state();
+    m_appMetrics.turretTicks->set(turret.ticks);
+    m_appMetrics.turretJitterAverage->set(turret.jitter_average_us);
+    m_appMetrics.turretJitterMax->set(turret.jitter_max_us);
+    m_appMetrics.turretOverruns->set(turret.overruns);
+    m_appMetrics.turretCommandsDropped->set(turret.commands_dropped);
+
+    if (m_appMetrics.actuatorTimeouts) {
+        ActuatorStats link = m_actuator.stats();
+        m_appMetrics.actuatorTimeouts->set(link.timeouts);
+        m_appMetrics.actuatorRtt->set(link.rtt_average_ms);
+    }
+
+    PresentStats present = m_presenter.stats();
+    m_appMetrics.displayShown->set(present.shown);
+    m_appMetrics.displayDropped->set(present.dropped);
+    m_appMetrics.displayLate->set(present.late);
+    m_appMetrics.displayLatencyP50->set(present.latency_p50_ms);
+    m_appMetrics.displayLatencyP95->set(present.latency_p95_ms);
+    m_appMetrics.displayJudder->set(present.judder_ms);
+    m_appMetrics.displayPlayout->set(present.playout_delay_ms);
+
+    m_appMetrics.startupWindow->set(m_windowShownMs);
+    m_appMetrics.startupCameras->set(m_camerasReadyMs);
+
+    LoggerStats log = Logger::instance().stats();
+    m_appMetrics.logSuppressed->set(log.suppressed);
+    m_appMetrics.logDropped->set(log.dropped);
+
+    m_appMetrics.residentMemory->set(MetricsServer::resident_memory_bytes());
+}
+
+void Window::setSpeed(int val) {
+    this->m_speed = val;
+    m_turret.set_speed(val * 20);
+
+    LOG_INFO("ui") << QString("Turret speed set to: %1").arg(val);
+}
+
+void Window::cameraPrepared(size_t index, bool ok) {
+    if (!ok) {
+        LOG_WARNING("ui") << QString("Camera %1 could not be prepared, Start will open it").arg(index);
+    }
+
+    // Modes the device reports natively, compressed ones are decoded in the pipeline
+    if (index == 0 && m_modeSelect) {
+        m_cameraModes = camera->prepared_modes();
+
+        for (size_t i = 0; i < m_cameraModes.size(); i++) {
+            m_modeSelect->addItem(QString::fromStdString(m_cameraModes[i].to_string()),
+                                  QVariant(int(i)));
+        }
+    }
+
+    if (++m_camerasPrepared == m_cameras.size()) {
+        m_camerasReadyMs = MetricsServer::process_age_ms();
+        LOG_INFO("ui") << QString("Cameras ready %1 ms after launch").arg(m_camerasReadyMs, 0, 'f', 0);
+    }
+}
+
+// Applied on the camera's state worker, modeApplied reports back
+void Window::setCameraMode(int index) {
+    if (index < 0) {
+        camera->reset_mode();
+        LOG_INFO("ui") << "Capture mode reset to the default requested";
+        return;
+    }
+
+    if (index >= int(m_cameraModes.size()))
+        return;
+
+    const VideoMode &mode = m_cameraModes[index];
+    camera->set_mode(mode);
+
+    LOG_INFO("ui") << QString("Capture mode %1 requested").arg(QString::fromStdString(mode.to_string()));
+}
+
+void Window::setProcessingEnabled(bool enabled) {
+    m_showProcessed = enabled;
+    m_presenter.reset();
+
+    if (enabled) {
+        camera->processing_engine()->start();
+    } else {
+        camera->processing_engine()->stop();
+        m_processingStatsLabel->setText("Processing stopped");
+    }
+
+    LOG_INFO("ui") << (enabled ? "Analysis enabled" : "Analysis disabled");
+}
+
+void Window::setZoom(int val) {
+    m_pendingZoom = val;
+    if (!m_controlTimer->isActive())
+        m_controlTimer->start();
+}
+
+void Window::setCameraFocus(int val) {
+    m_pendingFocus = val;
+    if (!m_controlTimer->isActive())
+        m_controlTimer->start();
+}
+
+// Only the last slider position since the previous call reaches the camera
+void Window::applyCameraControls() {
+    if (m_pendingZoom >= 0) {
+        camera->set_zoom(m_pendingZoom / 100.0);
+        LOG_INFO("ui") << QString("Camera zoom set to: %1").arg(m_pendingZoom);
+        m_pendingZoom = -1;
+    }
+
+    if (m_pendingFocus >= 0) {
+        bool applied = camera->set_focus(m_pendingFocus / 100.0);
+        LOG_INFO("ui") << (applied ? QString("Camera focus set to: %1").arg(m_pendingFocus)
+                                   : QString("Camera has no focus control"));
+        m_pendingFocus = -1;
+    }
+}
@@ -0,0 +1,141 @@
+#include "inc/workstealingpool.h"
+
+WorkStealingPool::WorkStealingPool(unsigned threads) :
+    pending(0),
+    stopping(false)
+{
+    unsigned count = threads > 1 ? threads - 1 : 0;
+
+    for (unsigned i = 0; i < count; ++i) {
+        workers.emplace_back(new Worker);
+    }
+
+    // Started once every deque exists, workers steal from all of them
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread = std::thread(&WorkStealingPool::worker_loop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &worker : workers) {
+        worker->thread.join();
+    }
+}
+
+WorkStealingPool &WorkStealingPool::shared() {
+    static WorkStealingPool pool;
+    return pool;
+}
+
+void WorkStealingPool::run(size_t count, const std::function<void(size_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+
+    // Nothing to spread over, run inline
+    if (workers.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.task = &task;
+    batch.remaining = count;
+
+    // Counted before queueing so a task is never popped before it is pending
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        pending += count;
+    }
+
+    // Round-robin over the deques, the calling thread steals like a worker
+    for (size_t i = 0; i < count; ++i) {
+        Worker &worker = *workers[i % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(Task{&batch, i});
+    }
+    wake.notify_all();
+
+    Task next;
+    while (batch.remaining.load() > 0) {
+        if (steal(workers.size(), next)) {
+            execute(next);
+            continue;
+        }
+
+        // Everything is taken, wait for the workers to finish our tasks
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        done.wait(lock, [&batch]() { return batch.remaining.load() == 0; });
+    }
+}
+
+void WorkStealingPool::worker_loop(size_t self) {
+    Task task;
+
+    for (;;) {
+        if (pop_local(self, task) || steal(self, task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [this]() { return stopping || pending.load() > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::pop_local(size_t self, Task &task) {
+    Worker &worker = *workers[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+
+    if (worker.tasks.empty()) {
+        return false;
+    }
+
+    task = worker.tasks.back();
+    worker.tasks.pop_back();
+    pending--;
+    return true;
+}
+
+bool WorkStealingPool::steal(size_t thief, Task &task) {
+    size_t count = workers.size();
+
+    for (size_t offset = 1; offset <= count; ++offset) {
+        size_t victim = (thief + offset) % count;
+        if (victim == thief) {
+            continue;
+        }
+
+        Worker &worker = *workers[victim];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = worker.tasks.front();
+            worker.tasks.pop_front();
+            pending--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::execute(const Task &task) {
+    (*task.batch->task)(task.index);
+
+    // The last task of a batch wakes the thread waiting in run()
+    if (--task.batch->remaining == 0) {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        done.notify_all();
+    }
+}